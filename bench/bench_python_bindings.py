@@ -0,0 +1,56 @@
+#!/usr/bin/env python3
+# Measures the overhead of the Python bindings: building and iterating event
+# buffers one event at a time against the numpy bulk paths. The results are
+# printed in the JSON format of bench_trace_file.
+import argparse
+import json
+import time
+
+import numpy as np
+import tracefile as tf
+
+
+def measure(benchmark: str, variant: str, events: int, repeat: int, function) -> dict:
+    best = min(timed(function) for _ in range(repeat))
+    return { "benchmark": benchmark, "variant": variant, "events": events, "seconds": best,
+             "events_per_second": events / best }
+
+
+def timed(function) -> float:
+    start = time.perf_counter()
+    function()
+    return time.perf_counter() - start
+
+
+def append_events(events: int):
+    buffer = tf.EventVectorBuffer()
+    for i in range(events):
+        buffer.append(tf.AccessEvent(i, i * 64, 0x400000, tf.AccessType.LOAD, tf.MemoryLevel.MEM_LVL_L1))
+    return buffer
+
+
+def extend_events(events: int):
+    buffer = tf.EventVectorBuffer()
+    buffer.extend_from_arrays(np.arange(events, dtype=np.uint64),
+                              np.arange(events, dtype=np.uint64) * 64,
+                              np.full(events, 0x400000, dtype=np.uint64),
+                              np.full(events, int(tf.AccessType.LOAD), dtype=np.uint32),
+                              np.full(events, int(tf.MemoryLevel.MEM_LVL_L1), dtype=np.uint32))
+    return buffer
+
+
+if __name__ == "__main__":
+    parser = argparse.ArgumentParser()
+    parser.add_argument("--events", help="Events per buffer", type=int, default=1000000)
+    parser.add_argument("--repeat", help="Runs per measurement, the fastest is reported", type=int, default=3)
+    args = parser.parse_args()
+
+    n = args.events
+    buffer = extend_events(n)
+    results = [
+        measure("python_append", "per_event", n, args.repeat, lambda: append_events(n)),
+        measure("python_append", "extend_from_arrays", n, args.repeat, lambda: extend_events(n)),
+        measure("python_iterate", "per_event", n, args.repeat, lambda: sum(e.ip for e in buffer)),
+        measure("python_iterate", "numpy", n, args.repeat, lambda: np.asarray(buffer)["ip"].sum()),
+    ]
+    print(json.dumps(results, indent=2))
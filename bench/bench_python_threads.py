@@ -0,0 +1,68 @@
+#!/usr/bin/env python3
+# Measures how reading and writing trace files through the Python bindings
+# scales with the number of Python threads. The bindings release the GIL
+# during I/O and decoding, so the throughput should grow with the thread
+# count until the storage saturates.
+import argparse
+import json
+import os
+import tempfile
+import time
+from concurrent.futures import ThreadPoolExecutor
+
+import numpy as np
+import tracefile as tf
+
+
+def make_buffer(events: int) -> tf.EventVectorBuffer:
+    buffer = tf.EventVectorBuffer()
+    buffer.extend_from_arrays(np.arange(events, dtype=np.uint64),
+                              np.arange(events, dtype=np.uint64) * 64,
+                              np.full(events, 0x400000, dtype=np.uint64),
+                              np.full(events, int(tf.AccessType.LOAD), dtype=np.uint32),
+                              np.full(events, int(tf.MemoryLevel.MEM_LVL_L1), dtype=np.uint32))
+    return buffer
+
+
+def write_file(path: str, buffer: tf.EventVectorBuffer, encoding: tf.TraceEncoding):
+    with tf.TraceFile(path, tf.TraceFileMode.WRITE) as file:
+        file.write(buffer, tf.TraceMetaData(buffer, 0), encoding)
+
+
+def read_file(path: str) -> int:
+    with tf.TraceFile(path, tf.TraceFileMode.READ) as file:
+        buffer, _ = file.read()
+    return len(buffer)
+
+
+def run(threads: int, function, paths: list) -> float:
+    start = time.perf_counter()
+    with ThreadPoolExecutor(max_workers=threads) as pool:
+        list(pool.map(function, paths))
+    return time.perf_counter() - start
+
+
+if __name__ == "__main__":
+    parser = argparse.ArgumentParser()
+    parser.add_argument("--files", help="Number of trace files", type=int, default=16)
+    parser.add_argument("--events", help="Events per trace file", type=int, default=1 << 22)
+    parser.add_argument("--threads", help="Thread counts to measure", type=int, nargs="+", default=[1, 2, 4, 8])
+    parser.add_argument("--encoding", help="Trace encoding", choices=tf.TraceEncoding.__members__.keys(), default="DELTA")
+    args = parser.parse_args()
+
+    encoding = tf.TraceEncoding.__members__[args.encoding]
+    buffer = make_buffer(args.events)
+    results = []
+    with tempfile.TemporaryDirectory() as directory:
+        paths = [os.path.join(directory, "trace_{}".format(i)) for i in range(args.files)]
+        for threads in args.threads:
+            for name, function in (("write", lambda path: write_file(path, buffer, encoding)), ("read", read_file)):
+                seconds = run(threads, function, paths)
+                results.append({ "benchmark": "python_" + name, "threads": threads, "encoding": args.encoding,
+                                 "events": args.files * args.events, "seconds": seconds,
+                                 "events_per_second": args.files * args.events / seconds })
+
+    for result in results:
+        baseline = next(r for r in results if r["benchmark"] == result["benchmark"])
+        result["speedup"] = baseline["seconds"] / result["seconds"]
+    print(json.dumps(results, indent=2))
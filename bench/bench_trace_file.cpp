@@ -0,0 +1,287 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <boost/filesystem.hpp>
+
+#include <cache_simulator.h>
+#include <perf_decode.h>
+#include <trace_events.h>
+#include <trace_file.h>
+
+// Measures the throughput of the event buffers, of writing and reading trace
+// files in every encoding, of the perf data source decoder and of the cache
+// simulator. The results are printed as a JSON array, one object per
+// measurement, so they can be compared across releases. Throughput in GB/s
+// counts the in-memory size of the events.
+
+namespace
+{
+struct Result
+{
+    std::string benchmark;
+    std::string variant;
+    uint64_t events;
+    double seconds;
+};
+
+std::vector<Result> results;
+
+// Runs f repeat times and records the fastest run.
+template <class F>
+void
+measure (const std::string& benchmark, const std::string& variant, uint64_t events, unsigned int repeat, F&& f)
+{
+    double best = 0;
+    for (unsigned int i = 0; i < repeat; i++)
+    {
+        auto start = std::chrono::steady_clock::now ();
+        f ();
+        std::chrono::duration<double> seconds = std::chrono::steady_clock::now () - start;
+        best = i == 0 ? seconds.count () : std::min (best, seconds.count ());
+    }
+    results.push_back ({ benchmark, variant, events, best });
+}
+
+// Synthetic events with increasing timestamps, strided addresses and a small
+// set of IPs, which is roughly what a sampled loop nest produces.
+AccessEvent
+event (uint64_t i)
+{
+    static const MemoryLevel levels[] = { MemoryLevel::MEM_LVL_L1, MemoryLevel::MEM_LVL_L1, MemoryLevel::MEM_LVL_L2,
+                                          MemoryLevel::MEM_LVL_L3 };
+    return AccessEvent (1000 + i * 3, 0x7f0000000000 + i * 64, 0x400000 + (i % 97) * 4,
+                        i % 5 == 0 ? AccessType::STORE : AccessType::LOAD, levels[i % 4]);
+}
+
+template <class T>
+void
+fill (EventBuffer<T>& buffer, uint64_t events)
+{
+    for (uint64_t i = 0; i < events; i++)
+    {
+        buffer.append (event (i));
+    }
+}
+
+void
+bench_append (uint64_t events, unsigned int repeat)
+{
+    measure ("append", "vector", events, repeat,
+             [&] ()
+             {
+                 EventVectorBuffer buffer;
+                 fill (buffer, events);
+             });
+    measure ("append", "vector_reserved", events, repeat,
+             [&] ()
+             {
+                 EventVectorBuffer buffer;
+                 buffer.reserve (events);
+                 fill (buffer, events);
+             });
+    measure ("append", "ring", events, repeat,
+             [&] ()
+             {
+                 EventRingBuffer buffer (events);
+                 fill (buffer, events);
+             });
+}
+
+void
+bench_trace_file (const FilePath& path, uint64_t events, unsigned int repeat)
+{
+    EventVectorBuffer buffer;
+    buffer.reserve (events);
+    fill (buffer, events);
+    TraceMetaData md (buffer, 0);
+
+    const std::pair<const char*, TraceEncoding> encodings[] = { { "raw", TraceEncoding::RAW },
+                                                                { "packed", TraceEncoding::PACKED },
+                                                                { "delta", TraceEncoding::DELTA },
+                                                                { "columnar", TraceEncoding::COLUMNAR } };
+    for (auto [name, encoding] : encodings)
+    {
+        measure ("write", name, events, repeat,
+                 [&] ()
+                 {
+                     TraceFile file (path, TraceFileMode::WRITE);
+                     file.write (buffer, md, encoding);
+                 });
+        measure ("write", std::string (name) + "_posix", events, repeat,
+                 [&] ()
+                 {
+                     TraceFile file (path, TraceFileMode::WRITE, TraceIoBackend::POSIX);
+                     file.write (buffer, md, encoding);
+                 });
+        measure ("write", std::string (name) + "_direct", events, repeat,
+                 [&] ()
+                 {
+                     TraceFile file (path, TraceFileMode::WRITE, TraceIoBackend::DIRECT);
+                     file.write (buffer, md, encoding);
+                 });
+        measure ("read", name, events, repeat,
+                 [&] ()
+                 {
+                     TraceFile file (path, TraceFileMode::READ);
+                     auto [read_buffer, read_md] = file.read<std::vector<AccessEvent>> ();
+                     if (read_buffer.size () != events)
+                     {
+                         throw std::runtime_error ("Read a different number of events than written.");
+                     }
+                 });
+    }
+
+    // A wrapped ring has two segments
+    EventRingBuffer ring (events);
+    fill (ring, events + events / 2);
+    TraceMetaData ring_md (ring, 0);
+    measure ("write", "raw_ring", events, repeat,
+             [&] ()
+             {
+                 TraceFile file (path, TraceFileMode::WRITE);
+                 file.write (ring, ring_md);
+             });
+    measure ("write", "raw_ring_posix", events, repeat,
+             [&] ()
+             {
+                 TraceFile file (path, TraceFileMode::WRITE, TraceIoBackend::POSIX);
+                 file.write (ring, ring_md);
+             });
+    boost::filesystem::remove (path);
+}
+
+void
+bench_perf_decode (uint64_t events, unsigned int repeat)
+{
+    std::vector<uint64_t> data_src (events);
+    uint64_t state = 0x9e3779b97f4a7c15ull;
+    for (uint64_t& value : data_src)
+    {
+        state ^= state << 13;
+        state ^= state >> 7;
+        state ^= state << 17;
+        value = state;
+    }
+    std::vector<AccessType> types (events);
+    std::vector<MemoryLevel> levels (events);
+
+    measure ("perf_decode", "batch", events, repeat,
+             [&] () { decodePerfDataSources (data_src.data (), events, types.data (), levels.data ()); });
+    measure ("perf_decode", "scalar", events, repeat,
+             [&] ()
+             {
+                 for (uint64_t i = 0; i < events; i++)
+                 {
+                     perf_mem_data_src src;
+                     src.val = data_src[i];
+                     types[i] = accessTypeFromPerf (src.mem_op);
+                     levels[i] = memoryLevelFromPerf (src.mem_lvl);
+                 }
+             });
+}
+
+// A loop walking a 32 KiB block with every 32nd access going somewhere into
+// 4 MiB, simulated on a three level hierarchy with each replacement policy.
+void
+bench_cache_simulator (uint64_t events, unsigned int repeat)
+{
+    EventVectorBuffer buffer;
+    buffer.reserve (events);
+    uint64_t state = 0x9e3779b97f4a7c15ull;
+    for (uint64_t i = 0; i < events; i++)
+    {
+        state ^= state << 13;
+        state ^= state >> 7;
+        state ^= state << 17;
+        uint64_t offset = i % 32 == 0 ? state & ((4 << 20) - 1) : (i * 8) & ((32 << 10) - 1);
+        buffer.append (AccessEvent (i, 0x7f0000000000 + offset, 0x400000, AccessType::LOAD, MemoryLevel::MEM_LVL_L1));
+    }
+
+    const std::pair<const char*, ReplacementPolicy> policies[] = { { "lru", ReplacementPolicy::LRU },
+                                                                   { "plru", ReplacementPolicy::PLRU },
+                                                                   { "random", ReplacementPolicy::RANDOM } };
+    for (auto [name, policy] : policies)
+    {
+        std::vector<CacheConfig> hierarchy = { CacheConfig{ 32 << 10, 8, 64, policy },
+                                               CacheConfig{ 1 << 20, 16, 64, policy },
+                                               CacheConfig{ 32 << 20, 16, 64, policy } };
+        // Every run starts cold, without the allocation in the measurement
+        std::vector<CacheSimulator> simulators (repeat, CacheSimulator (hierarchy));
+        unsigned int run = 0;
+        measure ("cache_simulator", name, events, repeat, [&] () { simulators[run++].simulate (buffer); });
+    }
+}
+
+void
+print_results ()
+{
+    std::cout << "[" << std::endl;
+    for (size_t i = 0; i < results.size (); i++)
+    {
+        const Result& r = results[i];
+        double bytes = double (r.events) * sizeof (AccessEvent);
+        std::cout << "  { \"benchmark\": \"" << r.benchmark << "\", \"variant\": \"" << r.variant
+                  << "\", \"events\": " << r.events << ", \"seconds\": " << r.seconds
+                  << ", \"events_per_second\": " << r.events / r.seconds
+                  << ", \"gb_per_second\": " << bytes / r.seconds / 1e9 << " }"
+                  << (i + 1 < results.size () ? "," : "") << std::endl;
+    }
+    std::cout << "]" << std::endl;
+}
+} // namespace
+
+int
+main (int argc, char** argv)
+{
+    // 10^9 events take 32 GB per buffer, so the largest size is opt-in
+    uint64_t max_events = 10000000;
+    unsigned int repeat = 3;
+    FilePath directory = boost::filesystem::temp_directory_path ();
+
+    for (int i = 1; i < argc; i++)
+    {
+        std::string arg = argv[i];
+        if (arg == "--max-events" && i + 1 < argc)
+        {
+            max_events = std::strtoull (argv[++i], nullptr, 10);
+        }
+        else if (arg == "--repeat" && i + 1 < argc)
+        {
+            repeat = std::max (1ul, std::strtoul (argv[++i], nullptr, 10));
+        }
+        else if (arg == "--directory" && i + 1 < argc)
+        {
+            directory = argv[++i];
+        }
+        else
+        {
+            std::cerr << "Usage: " << argv[0] << " [--max-events N] [--repeat N] [--directory DIR]" << std::endl;
+            return 1;
+        }
+    }
+
+    FilePath path = directory / boost::filesystem::unique_path ("bench_trace_file_%%%%%%%%");
+    try
+    {
+        for (uint64_t events = 1000; events <= max_events; events *= 10)
+        {
+            bench_append (events, repeat);
+            bench_trace_file (path, events, repeat);
+            bench_perf_decode (events, repeat);
+            bench_cache_simulator (events, repeat);
+        }
+    }
+    catch (const std::exception& e)
+    {
+        boost::filesystem::remove (path);
+        std::cerr << e.what () << std::endl;
+        return 1;
+    }
+
+    print_results ();
+    return 0;
+}
@@ -0,0 +1,206 @@
+#pragma once
+#include <algorithm>
+#include <cstdint>
+#include <thread>
+#include <tuple>
+#include <vector>
+
+#include <trace_events.h>
+
+/*****************************************************************************
+ * Access histograms per instruction pointer.
+ *
+ * Counts the accesses of a buffer per pair of IP and memory level, or IP and
+ * access type. Every thread counts a contiguous slice of the buffer into its
+ * own open-addressing table; the partial tables are merged at the end, so the
+ * threads never share a cache line while counting.
+ *****************************************************************************/
+
+enum class HistogramKey
+{
+    MEMORY_LEVEL,
+    ACCESS_TYPE,
+};
+
+// Histogram as three columns of equal length, sorted by IP and key. key holds
+// the raw MemoryLevel or AccessType value.
+struct AccessHistogram
+{
+    std::vector<uint64_t> ips;
+    std::vector<uint32_t> keys;
+    std::vector<uint64_t> counts;
+};
+
+class AccessCountTable
+{
+    public:
+    explicit AccessCountTable (size_t capacity = 1024)
+    {
+        size_t size = 16;
+        while (size < 2 * capacity)
+        {
+            size *= 2;
+        }
+        slots_.resize (size);
+    }
+
+    inline void
+    add (uint64_t ip, uint32_t key, uint64_t count = 1)
+    {
+        size_t mask = slots_.size () - 1;
+        for (size_t i = hash (ip, key) & mask;; i = (i + 1) & mask)
+        {
+            Slot& slot = slots_[i];
+            if (slot.count == 0)
+            {
+                slot = Slot{ ip, key, count };
+                if (++used_ * 2 > slots_.size ())
+                {
+                    grow ();
+                }
+                return;
+            }
+            if (slot.ip == ip && slot.key == key)
+            {
+                slot.count += count;
+                return;
+            }
+        }
+    }
+
+    inline void
+    merge (const AccessCountTable& other)
+    {
+        for (const Slot& slot : other.slots_)
+        {
+            if (slot.count != 0)
+            {
+                add (slot.ip, slot.key, slot.count);
+            }
+        }
+    }
+
+    inline size_t
+    size () const
+    {
+        return used_;
+    }
+
+    inline AccessHistogram
+    histogram () const
+    {
+        std::vector<std::tuple<uint64_t, uint32_t, uint64_t>> entries;
+        entries.reserve (used_);
+        for (const Slot& slot : slots_)
+        {
+            if (slot.count != 0)
+            {
+                entries.emplace_back (slot.ip, slot.key, slot.count);
+            }
+        }
+        std::sort (entries.begin (), entries.end ());
+
+        AccessHistogram histogram;
+        histogram.ips.reserve (entries.size ());
+        histogram.keys.reserve (entries.size ());
+        histogram.counts.reserve (entries.size ());
+        for (auto [ip, key, count] : entries)
+        {
+            histogram.ips.push_back (ip);
+            histogram.keys.push_back (key);
+            histogram.counts.push_back (count);
+        }
+        return histogram;
+    }
+
+    private:
+    // A count of zero marks an empty slot.
+    struct Slot
+    {
+        uint64_t ip = 0;
+        uint32_t key = 0;
+        uint64_t count = 0;
+    };
+
+    static inline uint64_t
+    hash (uint64_t ip, uint32_t key)
+    {
+        uint64_t h = (ip ^ (uint64_t (key) << 48)) * 0x9e3779b97f4a7c15ull;
+        return h ^ (h >> 32);
+    }
+
+    inline void
+    grow ()
+    {
+        std::vector<Slot> slots (slots_.size () * 2);
+        slots.swap (slots_);
+        used_ = 0;
+        for (const Slot& slot : slots)
+        {
+            if (slot.count != 0)
+            {
+                add (slot.ip, slot.key, slot.count);
+            }
+        }
+    }
+
+    private:
+    std::vector<Slot> slots_;
+    size_t used_ = 0;
+};
+
+// Counts the accesses of the buffer per IP and key. A thread count of zero
+// uses one thread per hardware thread.
+template <class T>
+AccessHistogram
+accessHistogram (const EventBuffer<T>& event_buffer, HistogramKey key = HistogramKey::MEMORY_LEVEL, unsigned int threads = 0)
+{
+    // Slices smaller than this are not worth a thread
+    constexpr uint64_t min_slice = 1 << 16;
+
+    if (threads == 0)
+    {
+        threads = std::max (1u, std::thread::hardware_concurrency ());
+    }
+    uint64_t size = event_buffer.size ();
+    threads = static_cast<unsigned int> (std::max<uint64_t> (1, std::min<uint64_t> (threads, size / min_slice)));
+
+    std::vector<AccessCountTable> tables (threads);
+    auto worker = [&] (unsigned int index)
+    {
+        AccessCountTable& table = tables[index];
+        auto it = event_buffer.begin () + size * index / threads;
+        auto end = event_buffer.begin () + size * (index + 1) / threads;
+        if (key == HistogramKey::MEMORY_LEVEL)
+        {
+            for (; it != end; ++it)
+            {
+                table.add (it->ip, static_cast<uint32_t> (it->memory_level));
+            }
+        }
+        else
+        {
+            for (; it != end; ++it)
+            {
+                table.add (it->ip, static_cast<uint32_t> (it->access_type));
+            }
+        }
+    };
+
+    std::vector<std::thread> pool;
+    for (unsigned int i = 1; i < threads; i++)
+    {
+        pool.emplace_back (worker, i);
+    }
+    worker (0);
+    for (std::thread& thread : pool)
+    {
+        thread.join ();
+    }
+
+    for (unsigned int i = 1; i < threads; i++)
+    {
+        tables[0].merge (tables[i]);
+    }
+    return tables[0].histogram ();
+}
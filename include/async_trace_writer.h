@@ -0,0 +1,457 @@
+#pragma once
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include <io_uring.h>
+#include <trace_events.h>
+#include <trace_file.h>
+
+/*****************************************************************************
+ * Back-pressure statistics of an AsyncTraceWriter.
+ *****************************************************************************/
+
+struct AsyncWriterStats
+{
+    uint64_t buffers_written = 0; // Buffers written by the I/O thread
+    uint64_t events_written = 0; // Events written by the I/O thread
+    uint64_t pending_buffers = 0; // Buffers currently waiting for the I/O thread
+    uint64_t max_pending_buffers = 0; // Highest number of waiting buffers so far
+    uint64_t stalls = 0; // Swaps that had to wait for a free buffer
+    uint64_t stall_time_ns = 0; // Time producers spent waiting for a free buffer
+};
+
+/*****************************************************************************
+ * Asynchronous chunked trace writer.
+ *
+ * Every producer owns a small pool of EventVectorBuffers. The producer only
+ * appends to its current buffer; a full buffer is handed to a dedicated I/O
+ * thread and replaced by a free one from the pool. The I/O thread writes the
+ * buffer as a chunk of the producer's TraceStreamWriter and returns it to the
+ * pool. A producer only blocks if all of its buffers are in flight, which is
+ * counted as a stall.
+ *
+ * With the IO_URING backend the I/O thread does not wait for a write before
+ * it takes the next buffer. It reserves the chunk's file range, submits the
+ * header and the events as separate writes and returns the buffer once both
+ * have completed, so buffers of several producers are written concurrently.
+ * The buffers are registered with the ring, which saves the kernel mapping
+ * their pages on every write.
+ *****************************************************************************/
+
+class AsyncTraceWriter
+{
+    public:
+    class Producer
+    {
+        friend class AsyncTraceWriter;
+
+        public:
+        Producer (const Producer&) = delete;
+        Producer& operator= (const Producer&) = delete;
+
+        inline void
+        append (const AccessEvent& event)
+        {
+            current_->append (event);
+            if (current_->size () == capacity_)
+            {
+                writer_->swap (*this);
+            }
+        }
+
+        // Hands a partially filled buffer to the I/O thread.
+        inline void
+        flush ()
+        {
+            if (current_->size () > 0)
+            {
+                writer_->swap (*this);
+            }
+        }
+
+        inline uint64_t
+        thread_id () const
+        {
+            return tid_;
+        }
+
+        private:
+        Producer (AsyncTraceWriter* writer,
+                  const FilePath& file,
+                  uint64_t tid,
+                  size_t capacity,
+                  size_t buffer_count,
+                  TraceIoBackend io_backend)
+        : writer_ (writer), stream_ (file, tid, TraceEncoding::RAW, io_backend), tid_ (tid), capacity_ (capacity),
+          buffers_ (buffer_count)
+        {
+            for (EventVectorBuffer& buffer : buffers_)
+            {
+                buffer.reserve (capacity_);
+                free_.push_back (&buffer);
+            }
+            current_ = free_.back ();
+            free_.pop_back ();
+        }
+
+        private:
+        AsyncTraceWriter* writer_;
+        TraceStreamWriter stream_;
+        uint64_t tid_;
+        size_t capacity_;
+        EventVectorBuffer* current_ = nullptr;
+        std::vector<EventVectorBuffer> buffers_;
+        std::vector<EventVectorBuffer*> free_; // Guarded by the writer's mutex
+    };
+
+    // Falls back to the BLOCKING backend if io_uring is not available; see
+    // backend () for the one in use.
+    explicit AsyncTraceWriter (size_t buffer_size = 1 << 16,
+                               size_t buffer_count = 2,
+                               AsyncIoBackend backend = AsyncIoBackend::BLOCKING)
+    : buffer_size_ (buffer_size), buffer_count_ (buffer_count), backend_ (backend)
+    {
+        if (buffer_size_ == 0 || buffer_count_ < 2)
+        {
+            throw std::invalid_argument ("An async writer needs at least two non-empty buffers.");
+        }
+        if (backend_ == AsyncIoBackend::IO_URING)
+        {
+            try
+            {
+                ring_ = std::make_unique<IoUring> (ring_entries);
+            }
+            catch (const std::runtime_error&)
+            {
+                backend_ = AsyncIoBackend::BLOCKING;
+            }
+        }
+        if (backend_ == AsyncIoBackend::IO_URING)
+        {
+            io_thread_ = std::thread (&AsyncTraceWriter::run_io_uring, this);
+        }
+        else
+        {
+            io_thread_ = std::thread (&AsyncTraceWriter::run, this);
+        }
+    }
+
+    AsyncTraceWriter (const AsyncTraceWriter&) = delete;
+    AsyncTraceWriter& operator= (const AsyncTraceWriter&) = delete;
+
+    // Producers must have stopped appending before the writer is destroyed.
+    ~AsyncTraceWriter ()
+    {
+        close ();
+    }
+
+    // Creates a producer writing to its own chunked trace. The returned
+    // reference stays valid for the lifetime of the writer.
+    Producer&
+    add_producer (const FilePath& file, uint64_t tid)
+    {
+        std::lock_guard<std::mutex> lock (mutex_);
+        TraceIoBackend io_backend = backend_ == AsyncIoBackend::IO_URING ? TraceIoBackend::POSIX : TraceIoBackend::FSTREAM;
+        producers_.emplace_back (new Producer (this, file, tid, buffer_size_, buffer_count_, io_backend));
+        return *producers_.back ();
+    }
+
+    Producer&
+    add_producer (const FilePath& file, const std::thread::id& tid)
+    {
+        return add_producer (file, convert_thread_id (tid));
+    }
+
+    inline AsyncIoBackend
+    backend () const
+    {
+        return backend_;
+    }
+
+    AsyncWriterStats
+    stats () const
+    {
+        std::lock_guard<std::mutex> lock (mutex_);
+        AsyncWriterStats stats = stats_;
+        stats.pending_buffers = queue_.size ();
+        return stats;
+    }
+
+    // Flushes all producers and waits until everything is written.
+    void
+    close ()
+    {
+        if (!io_thread_.joinable ())
+        {
+            return;
+        }
+        for (auto& producer : producers_)
+        {
+            producer->flush ();
+        }
+        {
+            std::lock_guard<std::mutex> lock (mutex_);
+            stop_ = true;
+        }
+        queue_cv_.notify_one ();
+        io_thread_.join ();
+        if (ring_)
+        {
+            ring_->unregister_buffers ();
+        }
+    }
+
+    private:
+    using Job = std::tuple<Producer*, EventVectorBuffer*>;
+
+    void
+    swap (Producer& producer)
+    {
+        std::unique_lock<std::mutex> lock (mutex_);
+        queue_.emplace_back (&producer, producer.current_);
+        stats_.max_pending_buffers = std::max<uint64_t> (stats_.max_pending_buffers, queue_.size ());
+        queue_cv_.notify_one ();
+
+        if (producer.free_.empty ())
+        {
+            auto start = std::chrono::steady_clock::now ();
+            free_cv_.wait (lock, [&producer] { return !producer.free_.empty (); });
+            stats_.stalls++;
+            stats_.stall_time_ns += std::chrono::duration_cast<std::chrono::nanoseconds> (
+                                    std::chrono::steady_clock::now () - start)
+                                    .count ();
+        }
+        producer.current_ = producer.free_.back ();
+        producer.free_.pop_back ();
+    }
+
+    void
+    run ()
+    {
+        std::unique_lock<std::mutex> lock (mutex_);
+        while (true)
+        {
+            queue_cv_.wait (lock, [this] { return stop_ || !queue_.empty (); });
+            if (queue_.empty ())
+            {
+                return;
+            }
+
+            auto [producer, buffer] = queue_.front ();
+            queue_.pop_front ();
+            lock.unlock ();
+
+            uint64_t size = buffer->size ();
+            producer->stream_.flush (*buffer);
+
+            lock.lock ();
+            stats_.buffers_written++;
+            stats_.events_written += size;
+            producer->free_.push_back (buffer);
+            free_cv_.notify_all ();
+        }
+    }
+
+    // A chunk whose header and events are being written by the ring. Slots
+    // are indexed like the registered buffers.
+    struct RingWrite
+    {
+        Producer* producer = nullptr;
+        EventVectorBuffer* buffer = nullptr;
+        ChunkHeader header;
+        uint64_t offset = 0; // File offset of the header
+        unsigned int pending = 0; // Submitted parts not yet completed
+    };
+
+    // Submission queue entries of the ring; a chunk takes one for the header
+    // and one per max_write_size bytes of events.
+    static constexpr unsigned int ring_entries = 64;
+    static constexpr uint64_t max_write_size = 1ull << 30;
+
+    void
+    run_io_uring ()
+    {
+        std::unique_lock<std::mutex> lock (mutex_);
+        while (true)
+        {
+            if (queue_.empty ())
+            {
+                if (ring_->in_flight () > 0)
+                {
+                    lock.unlock ();
+                    complete (ring_->wait ());
+                    lock.lock ();
+                    continue;
+                }
+                queue_cv_.wait (lock, [this] { return stop_ || !queue_.empty (); });
+                if (queue_.empty ())
+                {
+                    return;
+                }
+            }
+
+            auto [producer, buffer] = queue_.front ();
+            queue_.pop_front ();
+            lock.unlock ();
+
+            submit (producer, buffer);
+            IoUring::Completion completion;
+            while (ring_->peek (&completion))
+            {
+                complete (completion);
+            }
+
+            lock.lock ();
+        }
+    }
+
+    // Reserves the chunk of the buffer and queues its writes. Waits for
+    // completions while the ring is full.
+    void
+    submit (Producer* producer, EventVectorBuffer* buffer)
+    {
+        auto slot = slots_.find (buffer);
+        if (slot == slots_.end ())
+        {
+            register_buffers ();
+            slot = slots_.find (buffer);
+        }
+        size_t index = slot->second;
+        RingWrite& write = writes_[index];
+
+        std::tie (write.header, write.offset) = producer->stream_.reserve (*buffer);
+        if (write.header.event_count == 0)
+        {
+            release (producer, buffer, 0);
+            return;
+        }
+        write.producer = producer;
+        write.buffer = buffer;
+        write.pending = 1 + static_cast<unsigned int> ((write.header.payload_size + max_write_size - 1) / max_write_size);
+        for (unsigned int part = 0; part < write.pending; part++)
+        {
+            auto [data, size, offset] = write_part (write, part);
+            int buffer_index = part > 0 && registered_ ? static_cast<int> (index) : -1;
+            while (!ring_->prep_write (producer->stream_.fd (), data, static_cast<uint32_t> (size), offset,
+                                       (uint64_t (index) << 32) | part, buffer_index))
+            {
+                complete (ring_->wait ());
+            }
+        }
+        ring_->submit ();
+    }
+
+    // Part zero is the chunk header, the others max_write_size slices of
+    // the events.
+    static inline std::tuple<const char*, uint64_t, uint64_t>
+    write_part (const RingWrite& write, unsigned int part)
+    {
+        if (part == 0)
+        {
+            return { reinterpret_cast<const char*> (&write.header), sizeof (ChunkHeader), write.offset };
+        }
+        uint64_t begin = (part - 1) * max_write_size;
+        const char* events = static_cast<const char*> (std::get<0> (write.buffer->data ().front ()));
+        return { events + begin, std::min (max_write_size, write.header.payload_size - begin),
+                 write.offset + sizeof (ChunkHeader) + begin };
+    }
+
+    void
+    complete (const IoUring::Completion& completion)
+    {
+        RingWrite& write = writes_[completion.user_data >> 32];
+        auto [data, size, offset] = write_part (write, static_cast<unsigned int> (completion.user_data));
+
+        // Errors and short writes are finished with blocking writes, which
+        // throw like the blocking backend if the data cannot be written.
+        uint64_t done = completion.result > 0 ? static_cast<uint64_t> (completion.result) : 0;
+        while (done < size)
+        {
+            ssize_t written = ::pwrite (write.producer->stream_.fd (), data + done, size - done, offset + done);
+            if (written < 0 && errno != EINTR)
+            {
+                throw std::runtime_error ("Could not write trace: " + std::string (std::strerror (errno)) + ".");
+            }
+            done += written > 0 ? static_cast<uint64_t> (written) : 0;
+        }
+
+        if (--write.pending == 0)
+        {
+            release (write.producer, write.buffer, write.header.event_count);
+        }
+    }
+
+    // Returns a written buffer to its producer.
+    void
+    release (Producer* producer, EventVectorBuffer* buffer, uint64_t size)
+    {
+        buffer->consume (size);
+        std::lock_guard<std::mutex> lock (mutex_);
+        if (size > 0)
+        {
+            stats_.buffers_written++;
+            stats_.events_written += size;
+        }
+        producer->free_.push_back (buffer);
+        free_cv_.notify_all ();
+    }
+
+    // Assigns every buffer of every producer a slot and registers all of them
+    // with the ring. Called whenever producers were added, after the writes in
+    // flight have completed, as registration cannot change under them. If the
+    // kernel refuses, e.g. because of RLIMIT_MEMLOCK, plain writes are used.
+    void
+    register_buffers ()
+    {
+        while (ring_->in_flight () > 0)
+        {
+            complete (ring_->wait ());
+        }
+
+        std::vector<struct iovec> iovecs;
+        slots_.clear ();
+        {
+            std::lock_guard<std::mutex> lock (mutex_);
+            for (auto& producer : producers_)
+            {
+                for (EventVectorBuffer& buffer : producer->buffers_)
+                {
+                    slots_.emplace (&buffer, iovecs.size ());
+                    iovecs.push_back ({ std::get<0> (buffer.data ().front ()), producer->capacity_ * sizeof (AccessEvent) });
+                }
+            }
+        }
+        writes_.assign (iovecs.size (), RingWrite ());
+        registered_ = ring_->register_buffers (iovecs);
+    }
+
+    private:
+    size_t buffer_size_;
+    size_t buffer_count_;
+    AsyncIoBackend backend_;
+    std::list<std::unique_ptr<Producer>> producers_;
+
+    mutable std::mutex mutex_;
+    std::condition_variable queue_cv_;
+    std::condition_variable free_cv_;
+    std::deque<Job> queue_;
+    AsyncWriterStats stats_;
+    bool stop_ = false;
+
+    // Only used by the I/O thread of the IO_URING backend
+    std::unique_ptr<IoUring> ring_;
+    std::unordered_map<EventVectorBuffer*, size_t> slots_;
+    std::vector<RingWrite> writes_;
+    bool registered_ = false;
+
+    std::thread io_thread_;
+};
@@ -0,0 +1,464 @@
+#pragma once
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <exception>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+#include <trace_events.h>
+
+/*****************************************************************************
+ * Trace-driven set-associative cache simulation.
+ *
+ * Each level stores the line addresses of a set next to each other, so a
+ * lookup scans one or two cache lines of the host. LRU keeps the ways of a
+ * set in recency order and moves a hit to the front; tree PLRU keeps one bit
+ * per inner tree node and set; RANDOM picks victims with a xorshift
+ * generator. Levels are non-inclusive: a miss fills the line into every level
+ * it missed in. Writes allocate like reads.
+ *****************************************************************************/
+
+enum class ReplacementPolicy
+{
+    LRU,
+    PLRU,
+    RANDOM,
+};
+
+struct CacheConfig
+{
+    uint64_t size = 32 * 1024;
+    uint32_t associativity = 8;
+    uint32_t line_size = 64;
+    ReplacementPolicy policy = ReplacementPolicy::LRU;
+};
+
+class CacheLevel
+{
+    public:
+    explicit CacheLevel (const CacheConfig& config) : ways_ (config.associativity), policy_ (config.policy)
+    {
+        if (config.line_size == 0 || (config.line_size & (config.line_size - 1)) != 0)
+        {
+            throw std::invalid_argument ("The cache line size must be a power of two.");
+        }
+        if (ways_ == 0 || config.size % (uint64_t (config.line_size) * ways_) != 0)
+        {
+            throw std::invalid_argument ("The cache size must be a multiple of line size and associativity.");
+        }
+        uint64_t sets = config.size / (uint64_t (config.line_size) * ways_);
+        if (sets == 0 || (sets & (sets - 1)) != 0)
+        {
+            throw std::invalid_argument ("The number of cache sets must be a power of two.");
+        }
+        if (policy_ == ReplacementPolicy::PLRU && (ways_ > 64 || (ways_ & (ways_ - 1)) != 0))
+        {
+            throw std::invalid_argument ("Tree PLRU needs a power of two associativity of at most 64.");
+        }
+
+        while ((uint64_t (1) << line_shift_) < config.line_size)
+        {
+            line_shift_++;
+        }
+        while ((uint64_t (1) << way_bits_) < ways_)
+        {
+            way_bits_++;
+        }
+        set_mask_ = sets - 1;
+        lines_.assign (sets * ways_, invalid_line);
+        if (policy_ == ReplacementPolicy::PLRU)
+        {
+            plru_.assign (sets, 0);
+            for (uint32_t way = 0; way < ways_; way++)
+            {
+                uint64_t mask = 0;
+                uint64_t bits = 0;
+                uint32_t node = 1;
+                for (unsigned int level = way_bits_; level > 0; level--)
+                {
+                    uint32_t direction = (way >> (level - 1)) & 1;
+                    mask |= uint64_t (1) << node;
+                    bits |= uint64_t (direction ^ 1) << node;
+                    node = 2 * node + direction;
+                }
+                touch_masks_.push_back (mask);
+                touch_bits_.push_back (bits);
+            }
+        }
+    }
+
+    inline unsigned int
+    line_shift () const
+    {
+        return line_shift_;
+    }
+
+    inline ReplacementPolicy
+    policy () const
+    {
+        return policy_;
+    }
+
+    // Looks up the line of the address and fills it on a miss. Returns true
+    // on a hit.
+    inline bool
+    access (uint64_t address)
+    {
+        switch (policy_)
+        {
+        case ReplacementPolicy::LRU:
+            return access<ReplacementPolicy::LRU> (address);
+
+        case ReplacementPolicy::PLRU:
+            return access<ReplacementPolicy::PLRU> (address);
+
+        case ReplacementPolicy::RANDOM:
+            return access<ReplacementPolicy::RANDOM> (address);
+        }
+        return false;
+    }
+
+    // Same for a level known to use Policy, so that simulation loops do not
+    // branch on the policy per access.
+    template <ReplacementPolicy Policy>
+    inline bool
+    access (uint64_t address)
+    {
+        uint64_t line = address >> line_shift_;
+        uint64_t set = line & set_mask_;
+        uint64_t* ways = lines_.data () + set * ways_;
+
+        if constexpr (Policy == ReplacementPolicy::LRU)
+        {
+            if (ways[0] == line)
+            {
+                return true;
+            }
+            for (uint32_t way = 1; way < ways_; way++)
+            {
+                if (ways[way] == line)
+                {
+                    move_to_front (ways, way);
+                    return true;
+                }
+            }
+            move_to_front (ways, ways_ - 1);
+            ways[0] = line;
+            return false;
+        }
+        else if constexpr (Policy == ReplacementPolicy::PLRU)
+        {
+            for (uint32_t way = 0; way < ways_; way++)
+            {
+                if (ways[way] == line)
+                {
+                    touch (set, way);
+                    return true;
+                }
+            }
+            uint32_t victim = plru_victim (set);
+            ways[victim] = line;
+            touch (set, victim);
+            return false;
+        }
+        else
+        {
+            for (uint32_t way = 0; way < ways_; way++)
+            {
+                if (ways[way] == line)
+                {
+                    return true;
+                }
+            }
+            ways[random_way ()] = line;
+            return false;
+        }
+    }
+
+    private:
+    static constexpr uint64_t invalid_line = ~uint64_t (0);
+
+    // A plain loop instead of memmove, which is a library call for sizes
+    // unknown at compile time.
+    static inline void
+    move_to_front (uint64_t* ways, uint32_t way)
+    {
+        uint64_t line = ways[way];
+        for (; way > 0; way--)
+        {
+            ways[way] = ways[way - 1];
+        }
+        ways[0] = line;
+    }
+
+    // Points the tree nodes on the path to the way away from it.
+    inline void
+    touch (uint64_t set, uint32_t way)
+    {
+        plru_[set] = (plru_[set] & ~touch_masks_[way]) | touch_bits_[way];
+    }
+
+    inline uint32_t
+    plru_victim (uint64_t set) const
+    {
+        uint64_t bits = plru_[set];
+        uint32_t node = 1;
+        for (unsigned int level = 0; level < way_bits_; level++)
+        {
+            node = 2 * node + ((bits >> node) & 1);
+        }
+        return node - ways_;
+    }
+
+    inline uint32_t
+    random_way ()
+    {
+        random_ ^= random_ << 13;
+        random_ ^= random_ >> 7;
+        random_ ^= random_ << 17;
+        return static_cast<uint32_t> (((random_ >> 32) * ways_) >> 32);
+    }
+
+    private:
+    uint32_t ways_;
+    ReplacementPolicy policy_;
+    unsigned int line_shift_ = 0;
+    unsigned int way_bits_ = 0;
+    uint64_t set_mask_ = 0;
+    std::vector<uint64_t> lines_; // Line addresses, ways of a set are adjacent
+    std::vector<uint64_t> plru_; // Tree bits per set, node n at bit n
+    std::vector<uint64_t> touch_masks_; // Tree nodes on the path to a way
+    std::vector<uint64_t> touch_bits_; // Their values after touching the way
+    uint64_t random_ = 0x9e3779b97f4a7c15ull;
+};
+
+/*****************************************************************************
+ * Statistics of a simulation.
+ *
+ * The first two simulated levels correspond to MEM_LVL_L1 and MEM_LVL_L2,
+ * all further ones to MEM_LVL_L3; misses in all levels count as
+ * MEM_LVL_LOC_RAM.
+ *****************************************************************************/
+
+struct CacheStats
+{
+    explicit CacheStats (size_t levels = 0) : hits (levels + 1, 0), confusion ((levels + 1) * memory_level_count, 0)
+    {
+    }
+
+    // Accesses served per level; the last entry counts memory accesses.
+    std::vector<uint64_t> hits;
+    // Accesses per simulated level and recorded MemoryLevel bit position.
+    // Recorded values that are not a single known bit count as MEM_LVL_NA.
+    std::vector<uint64_t> confusion;
+    uint64_t accesses = 0;
+    uint64_t matches = 0; // Recorded and simulated level agree
+
+    inline uint64_t
+    count (size_t level, MemoryLevel recorded) const
+    {
+        return confusion[level * memory_level_count + memoryLevelIndex (recorded)];
+    }
+
+    inline double
+    match_ratio () const
+    {
+        return accesses == 0 ? 0.0 : static_cast<double> (matches) / static_cast<double> (accesses);
+    }
+};
+
+class CacheSimulator
+{
+    public:
+    explicit CacheSimulator (const std::vector<CacheConfig>& configs)
+    : confusion_ ((configs.size () + 1) * memory_level_count, 0)
+    {
+        if (configs.empty ())
+        {
+            throw std::invalid_argument ("A cache hierarchy needs at least one level.");
+        }
+        for (const CacheConfig& config : configs)
+        {
+            levels_.emplace_back (config);
+        }
+        for (size_t level = 0; level < levels_.size (); level++)
+        {
+            simulated_levels_.push_back (simulatedLevel (level));
+        }
+        simulated_levels_.push_back (MemoryLevel::MEM_LVL_LOC_RAM);
+    }
+
+    // Returns the index of the level that served the access, or the number
+    // of levels if it went to memory.
+    inline size_t
+    access (uint64_t address)
+    {
+        size_t level = 0;
+        while (level < levels_.size () && !levels_[level].access (address))
+        {
+            level++;
+        }
+        return level;
+    }
+
+    // Only the confusion matrix is counted per access, all other statistics
+    // are derived from it.
+    inline size_t
+    access (const AccessEvent& event)
+    {
+        size_t level = access (event.address);
+        confusion_[level * memory_level_count + memoryLevelIndex (event.memory_level)]++;
+        return level;
+    }
+
+    // Hierarchies that use one policy in every level, the usual case, are
+    // simulated by a loop specialized for it.
+    template <class T>
+    void
+    simulate (const EventBuffer<T>& event_buffer)
+    {
+        ReplacementPolicy policy = levels_.front ().policy ();
+        bool uniform = std::all_of (levels_.begin (), levels_.end (),
+                                    [policy] (const CacheLevel& level) { return level.policy () == policy; });
+        if (!uniform)
+        {
+            simulate (event_buffer, [this] (uint64_t address) { return access (address); });
+            return;
+        }
+
+        switch (policy)
+        {
+        case ReplacementPolicy::LRU:
+            simulate (event_buffer, [this] (uint64_t address) { return access<ReplacementPolicy::LRU> (address); });
+            break;
+
+        case ReplacementPolicy::PLRU:
+            simulate (event_buffer, [this] (uint64_t address) { return access<ReplacementPolicy::PLRU> (address); });
+            break;
+
+        case ReplacementPolicy::RANDOM:
+            simulate (event_buffer,
+                      [this] (uint64_t address) { return access<ReplacementPolicy::RANDOM> (address); });
+            break;
+        }
+    }
+
+    inline CacheStats
+    stats () const
+    {
+        CacheStats stats (levels_.size ());
+        stats.confusion = confusion_;
+        for (size_t level = 0; level <= levels_.size (); level++)
+        {
+            for (unsigned int recorded = 0; recorded < memory_level_count; recorded++)
+            {
+                stats.hits[level] += confusion_[level * memory_level_count + recorded];
+            }
+            stats.accesses += stats.hits[level];
+            stats.matches += stats.count (level, simulated_levels_[level]);
+        }
+        return stats;
+    }
+
+    // Recorded MemoryLevel a hit in the given cache level corresponds to.
+    static constexpr MemoryLevel
+    simulatedLevel (size_t level)
+    {
+        constexpr std::array<MemoryLevel, 2> caches = { MemoryLevel::MEM_LVL_L1, MemoryLevel::MEM_LVL_L2 };
+        return level < caches.size () ? caches[level] : MemoryLevel::MEM_LVL_L3;
+    }
+
+    private:
+    template <ReplacementPolicy Policy>
+    inline size_t
+    access (uint64_t address)
+    {
+        size_t level = 0;
+        while (level < levels_.size () && !levels_[level].template access<Policy> (address))
+        {
+            level++;
+        }
+        return level;
+    }
+
+    template <class T, class Lookup>
+    void
+    simulate (const EventBuffer<T>& event_buffer, Lookup&& lookup)
+    {
+        for (auto [pointer, size] : event_buffer.data ())
+        {
+            const AccessEvent* events = reinterpret_cast<const AccessEvent*> (pointer);
+            for (uint64_t i = 0; i < size / sizeof (AccessEvent); i++)
+            {
+                size_t level = lookup (events[i].address);
+                confusion_[level * memory_level_count + memoryLevelIndex (events[i].memory_level)]++;
+            }
+        }
+    }
+
+    private:
+    std::vector<CacheLevel> levels_;
+    std::vector<MemoryLevel> simulated_levels_;
+    std::vector<uint64_t> confusion_;
+};
+
+// Simulates every hierarchy over the same buffer on a pool of threads and
+// returns the statistics in the order of the hierarchies. A thread count of
+// zero uses one thread per hardware thread.
+template <class T>
+std::vector<CacheStats>
+simulateCacheConfigs (const EventBuffer<T>& event_buffer,
+                      const std::vector<std::vector<CacheConfig>>& hierarchies,
+                      unsigned int threads = 0)
+{
+    std::vector<CacheStats> results (hierarchies.size ());
+    std::atomic<size_t> next{ 0 };
+    std::exception_ptr error;
+    std::mutex mutex;
+
+    auto worker = [&] ()
+    {
+        for (size_t i = next++; i < hierarchies.size (); i = next++)
+        {
+            try
+            {
+                CacheSimulator simulator (hierarchies[i]);
+                simulator.simulate (event_buffer);
+                results[i] = simulator.stats ();
+            }
+            catch (...)
+            {
+                std::lock_guard<std::mutex> lock (mutex);
+                if (!error)
+                {
+                    error = std::current_exception ();
+                }
+            }
+        }
+    };
+
+    if (threads == 0)
+    {
+        threads = std::max (1u, std::thread::hardware_concurrency ());
+    }
+    std::vector<std::thread> pool;
+    for (unsigned int i = 1; i < std::min<size_t> (threads, hierarchies.size ()); i++)
+    {
+        pool.emplace_back (worker);
+    }
+    worker ();
+    for (std::thread& thread : pool)
+    {
+        thread.join ();
+    }
+
+    if (error)
+    {
+        std::rethrow_exception (error);
+    }
+    return results;
+}
@@ -0,0 +1,662 @@
+#pragma once
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <tuple>
+#include <unordered_map>
+#include <vector>
+
+#include <access_histogram.h>
+#include <trace_events.h>
+#include <trace_file.h>
+
+extern "C"
+{
+#include <elf.h>
+}
+
+/*****************************************************************************
+ * Source locations of instruction pointers.
+ *
+ * The symbolizer reads the .debug_line section of an ELF64 binary once and
+ * runs the line number programs (DWARF 2 to 5) of all compile units into one
+ * table of rows sorted by address. A row covers the addresses up to the next
+ * row; rows that end a sequence cover nothing. A lookup is a binary search,
+ * and a batch of sorted IPs is resolved in a single pass over the table.
+ *****************************************************************************/
+
+struct SourceLocation
+{
+    uint32_t file = 0; // Index into DwarfSymbolizer::files()
+    uint32_t line = 0;
+};
+
+class DwarfSymbolizer
+{
+    public:
+    explicit DwarfSymbolizer (const FilePath& binary)
+    {
+        std::ifstream file (binary.string (), std::ios::binary);
+        if (!file)
+        {
+            throw std::runtime_error ("Could not open binary " + binary.string () + ".");
+        }
+
+        Elf64_Ehdr header;
+        read_at (file, 0, &header, sizeof (Elf64_Ehdr));
+        if (std::memcmp (header.e_ident, ELFMAG, SELFMAG) != 0 || header.e_ident[EI_CLASS] != ELFCLASS64 ||
+            header.e_ident[EI_DATA] != ELFDATA2LSB)
+        {
+            throw std::runtime_error ("Only little endian ELF64 binaries are supported.");
+        }
+        if (header.e_shentsize != sizeof (Elf64_Shdr) || header.e_shstrndx >= header.e_shnum)
+        {
+            throw std::runtime_error ("Binary contains an invalid section header table.");
+        }
+
+        std::vector<Elf64_Shdr> sections (header.e_shnum);
+        read_at (file, header.e_shoff, sections.data (), sections.size () * sizeof (Elf64_Shdr));
+        std::vector<char> names = read_section (file, sections[header.e_shstrndx]);
+
+        std::vector<char> debug_line;
+        for (const Elf64_Shdr& section : sections)
+        {
+            if (section.sh_name >= names.size ())
+            {
+                continue;
+            }
+            std::string name (names.data () + section.sh_name, strnlen (names.data () + section.sh_name, names.size () - section.sh_name));
+            if (name == ".debug_line")
+            {
+                debug_line = read_section (file, section);
+            }
+            else if (name == ".debug_line_str")
+            {
+                line_strings_ = read_section (file, section);
+            }
+            else if (name == ".debug_str")
+            {
+                strings_ = read_section (file, section);
+            }
+        }
+        if (debug_line.empty ())
+        {
+            throw std::runtime_error ("Binary contains no .debug_line section.");
+        }
+
+        Reader reader{ debug_line.data (), debug_line.data () + debug_line.size () };
+        while (reader.pos < reader.end)
+        {
+            parse_unit (reader);
+        }
+
+        // End rows sort before rows starting at the same address, so a
+        // sequence starting where another one ends wins.
+        std::stable_sort (rows_.begin (), rows_.end (),
+                          [] (const Row& a, const Row& b)
+                          { return a.address < b.address || (a.address == b.address && a.end && !b.end); });
+    }
+
+    // Names of all files referenced by the line tables.
+    inline const std::vector<std::string>&
+    files () const
+    {
+        return files_;
+    }
+
+    inline uint64_t
+    row_count () const
+    {
+        return rows_.size ();
+    }
+
+    inline std::optional<SourceLocation>
+    lookup (uint64_t ip) const
+    {
+        auto next = std::upper_bound (rows_.begin (), rows_.end (), ip,
+                                      [] (uint64_t address, const Row& row) { return address < row.address; });
+        if (next == rows_.begin ())
+        {
+            return std::nullopt;
+        }
+        const Row& row = *(next - 1);
+        if (row.end)
+        {
+            return std::nullopt;
+        }
+        return SourceLocation{ row.file, row.line };
+    }
+
+    // Resolves the unique IPs of the buffer. IPs without line information
+    // are left out.
+    template <class T>
+    std::unordered_map<uint64_t, SourceLocation>
+    lookup (const EventBuffer<T>& event_buffer) const
+    {
+        std::vector<uint64_t> ips;
+        ips.reserve (event_buffer.size ());
+        for (auto [pointer, size] : event_buffer.data ())
+        {
+            const AccessEvent* events = reinterpret_cast<const AccessEvent*> (pointer);
+            for (uint64_t i = 0; i < size / sizeof (AccessEvent); i++)
+            {
+                ips.push_back (events[i].ip);
+            }
+        }
+        return lookup (std::move (ips));
+    }
+
+    inline std::unordered_map<uint64_t, SourceLocation>
+    lookup (std::vector<uint64_t> ips) const
+    {
+        std::sort (ips.begin (), ips.end ());
+        ips.erase (std::unique (ips.begin (), ips.end ()), ips.end ());
+
+        std::unordered_map<uint64_t, SourceLocation> locations;
+        auto row = rows_.begin ();
+        for (uint64_t ip : ips)
+        {
+            while (row != rows_.end () && row->address <= ip)
+            {
+                ++row;
+            }
+            if (row != rows_.begin () && !(row - 1)->end)
+            {
+                locations.emplace (ip, SourceLocation{ (row - 1)->file, (row - 1)->line });
+            }
+        }
+        return locations;
+    }
+
+    inline std::string
+    to_string (const SourceLocation& location) const
+    {
+        return files_[location.file] + ":" + std::to_string (location.line);
+    }
+
+    private:
+    struct Row
+    {
+        uint64_t address;
+        uint32_t file;
+        uint32_t line;
+        bool end;
+    };
+
+    struct Reader
+    {
+        const char* pos;
+        const char* end;
+
+        inline void
+        require (uint64_t size) const
+        {
+            if (size > static_cast<uint64_t> (end - pos))
+            {
+                throw std::runtime_error ("Binary contains a truncated line table.");
+            }
+        }
+
+        template <class T>
+        inline T
+        read ()
+        {
+            require (sizeof (T));
+            T value;
+            std::memcpy (&value, pos, sizeof (T));
+            pos += sizeof (T);
+            return value;
+        }
+
+        inline uint64_t
+        read_size (unsigned int size)
+        {
+            switch (size)
+            {
+            case 1:
+                return read<uint8_t> ();
+            case 2:
+                return read<uint16_t> ();
+            case 4:
+                return read<uint32_t> ();
+            case 8:
+                return read<uint64_t> ();
+            }
+            throw std::runtime_error ("Binary contains an unsupported address size.");
+        }
+
+        inline uint64_t
+        uleb ()
+        {
+            uint64_t value = 0;
+            unsigned int shift = 0;
+            uint8_t byte;
+            do
+            {
+                byte = read<uint8_t> ();
+                if (shift < 64)
+                {
+                    value |= uint64_t (byte & 0x7f) << shift;
+                }
+                shift += 7;
+            } while (byte & 0x80);
+            return value;
+        }
+
+        inline int64_t
+        sleb ()
+        {
+            int64_t value = 0;
+            unsigned int shift = 0;
+            uint8_t byte;
+            do
+            {
+                byte = read<uint8_t> ();
+                if (shift < 64)
+                {
+                    value |= int64_t (byte & 0x7f) << shift;
+                }
+                shift += 7;
+            } while (byte & 0x80);
+            if (shift < 64 && (byte & 0x40))
+            {
+                value |= -(int64_t (1) << shift);
+            }
+            return value;
+        }
+
+        inline std::string
+        string ()
+        {
+            const char* terminator = static_cast<const char*> (std::memchr (pos, 0, end - pos));
+            if (terminator == nullptr)
+            {
+                throw std::runtime_error ("Binary contains an unterminated string.");
+            }
+            std::string value (pos, terminator);
+            pos = terminator + 1;
+            return value;
+        }
+
+        inline void
+        skip (uint64_t size)
+        {
+            require (size);
+            pos += size;
+        }
+    };
+
+    static inline void
+    read_at (std::ifstream& file, uint64_t offset, void* data, uint64_t size)
+    {
+        file.seekg (offset);
+        file.read (static_cast<char*> (data), size);
+        if (!file)
+        {
+            throw std::runtime_error ("Binary is shorter than its headers announce.");
+        }
+    }
+
+    static inline std::vector<char>
+    read_section (std::ifstream& file, const Elf64_Shdr& section)
+    {
+        if (section.sh_flags & SHF_COMPRESSED)
+        {
+            throw std::runtime_error ("Compressed debug sections are not supported.");
+        }
+        if (section.sh_type == SHT_NOBITS)
+        {
+            return {};
+        }
+        std::vector<char> data (section.sh_size);
+        read_at (file, section.sh_offset, data.data (), data.size ());
+        return data;
+    }
+
+    static inline std::string
+    string_at (const std::vector<char>& strings, uint64_t offset)
+    {
+        if (offset >= strings.size ())
+        {
+            throw std::runtime_error ("Binary contains an invalid string offset.");
+        }
+        return std::string (strings.data () + offset, strnlen (strings.data () + offset, strings.size () - offset));
+    }
+
+    inline uint32_t
+    file_index (const std::string& name)
+    {
+        auto [it, inserted] = file_indices_.try_emplace (name, static_cast<uint32_t> (files_.size ()));
+        if (inserted)
+        {
+            files_.push_back (name);
+        }
+        return it->second;
+    }
+
+    // Reads a DWARF 5 entry format description and returns pairs of content
+    // type and form.
+    static inline std::vector<std::pair<uint64_t, uint64_t>>
+    read_entry_format (Reader& reader)
+    {
+        std::vector<std::pair<uint64_t, uint64_t>> format (reader.read<uint8_t> ());
+        for (auto& [content, form] : format)
+        {
+            content = reader.uleb ();
+            form = reader.uleb ();
+        }
+        return format;
+    }
+
+    // Reads one attribute of a DWARF 5 directory or file entry. Only paths
+    // are kept.
+    inline std::optional<std::string>
+    read_form (Reader& reader, uint64_t form, unsigned int offset_size)
+    {
+        switch (form)
+        {
+        case 0x08: // DW_FORM_string
+            return reader.string ();
+        case 0x1f: // DW_FORM_line_strp
+            return string_at (line_strings_, reader.read_size (offset_size));
+        case 0x0e: // DW_FORM_strp
+            return string_at (strings_, reader.read_size (offset_size));
+        case 0x0b: // DW_FORM_data1
+            reader.skip (1);
+            return std::nullopt;
+        case 0x05: // DW_FORM_data2
+            reader.skip (2);
+            return std::nullopt;
+        case 0x06: // DW_FORM_data4
+            reader.skip (4);
+            return std::nullopt;
+        case 0x07: // DW_FORM_data8
+            reader.skip (8);
+            return std::nullopt;
+        case 0x1e: // DW_FORM_data16
+            reader.skip (16);
+            return std::nullopt;
+        case 0x0f: // DW_FORM_udata
+            reader.uleb ();
+            return std::nullopt;
+        case 0x09: // DW_FORM_block
+            reader.skip (reader.uleb ());
+            return std::nullopt;
+        }
+        throw std::runtime_error ("Binary contains an unsupported form in a line table header.");
+    }
+
+    inline void
+    parse_unit (Reader& reader)
+    {
+        unsigned int offset_size = 4;
+        uint64_t length = reader.read<uint32_t> ();
+        if (length == 0xffffffff)
+        {
+            offset_size = 8;
+            length = reader.read<uint64_t> ();
+        }
+        reader.require (length);
+        Reader unit{ reader.pos, reader.pos + length };
+        reader.pos += length;
+
+        uint16_t version = unit.read<uint16_t> ();
+        if (version < 2 || version > 5)
+        {
+            throw std::runtime_error ("Binary contains an unsupported line table version.");
+        }
+        unsigned int address_size = 8;
+        if (version >= 5)
+        {
+            address_size = unit.read<uint8_t> ();
+            unit.read<uint8_t> (); // segment_selector_size
+        }
+        uint64_t header_length = unit.read_size (offset_size);
+        unit.require (header_length);
+        const char* program = unit.pos + header_length;
+
+        uint8_t minimum_instruction_length = unit.read<uint8_t> ();
+        if (version >= 4)
+        {
+            unit.read<uint8_t> (); // maximum_operations_per_instruction
+        }
+        unit.read<uint8_t> (); // default_is_stmt
+        int8_t line_base = unit.read<int8_t> ();
+        uint8_t line_range = unit.read<uint8_t> ();
+        uint8_t opcode_base = unit.read<uint8_t> ();
+        if (line_range == 0 || opcode_base == 0)
+        {
+            throw std::runtime_error ("Binary contains an invalid line table header.");
+        }
+        std::vector<uint8_t> opcode_lengths (opcode_base - 1);
+        for (uint8_t& opcode_length : opcode_lengths)
+        {
+            opcode_length = unit.read<uint8_t> ();
+        }
+
+        // Indices of the unit's files in files_, in the unit's numbering
+        std::vector<uint32_t> unit_files;
+        if (version >= 5)
+        {
+            auto directory_format = read_entry_format (unit);
+            uint64_t directory_count = unit.uleb ();
+            for (uint64_t i = 0; i < directory_count; i++)
+            {
+                for (auto [content, form] : directory_format)
+                {
+                    read_form (unit, form, offset_size);
+                }
+            }
+            auto file_format = read_entry_format (unit);
+            uint64_t file_count = unit.uleb ();
+            for (uint64_t i = 0; i < file_count; i++)
+            {
+                std::string name;
+                for (auto [content, form] : file_format)
+                {
+                    auto value = read_form (unit, form, offset_size);
+                    if (content == 1 && value) // DW_LNCT_path
+                    {
+                        name = *value;
+                    }
+                }
+                unit_files.push_back (file_index (name));
+            }
+        }
+        else
+        {
+            while (!unit.string ().empty ())
+            {
+                // include_directories
+            }
+            unit_files.push_back (file_index ("")); // Files are numbered from one
+            for (std::string name = unit.string (); !name.empty (); name = unit.string ())
+            {
+                unit.uleb (); // directory
+                unit.uleb (); // modification time
+                unit.uleb (); // length
+                unit_files.push_back (file_index (name));
+            }
+        }
+
+        unit.pos = program;
+        run_program (unit, version, address_size, minimum_instruction_length, line_base, line_range,
+                     opcode_base, opcode_lengths, unit_files);
+    }
+
+    inline void
+    run_program (Reader& unit,
+                 uint16_t version,
+                 unsigned int address_size,
+                 uint8_t minimum_instruction_length,
+                 int8_t line_base,
+                 uint8_t line_range,
+                 uint8_t opcode_base,
+                 const std::vector<uint8_t>& opcode_lengths,
+                 std::vector<uint32_t>& unit_files)
+    {
+        const uint64_t initial_file = version >= 5 ? 0 : 1;
+        uint64_t address = 0;
+        uint64_t file = initial_file;
+        int64_t line = 1;
+
+        auto emit = [&] (bool end)
+        {
+            uint32_t index = file < unit_files.size () ? unit_files[file] : file_index ("");
+            rows_.push_back (Row{ address, index, static_cast<uint32_t> (line), end });
+        };
+
+        while (unit.pos < unit.end)
+        {
+            uint8_t opcode = unit.read<uint8_t> ();
+            if (opcode >= opcode_base)
+            {
+                uint8_t adjusted = opcode - opcode_base;
+                address += (adjusted / line_range) * minimum_instruction_length;
+                line += line_base + adjusted % line_range;
+                emit (false);
+                continue;
+            }
+
+            switch (opcode)
+            {
+            case 0: // Extended opcodes
+            {
+                uint64_t length = unit.uleb ();
+                unit.require (length);
+                if (length == 0)
+                {
+                    break;
+                }
+                const char* next = unit.pos + length;
+                uint8_t extended = unit.read<uint8_t> ();
+                if (extended == 1) // DW_LNE_end_sequence
+                {
+                    emit (true);
+                    address = 0;
+                    file = initial_file;
+                    line = 1;
+                }
+                else if (extended == 2) // DW_LNE_set_address
+                {
+                    address = unit.read_size (std::min<uint64_t> (length - 1, address_size));
+                }
+                else if (extended == 3) // DW_LNE_define_file
+                {
+                    unit_files.push_back (file_index (unit.string ()));
+                }
+                unit.pos = next;
+                break;
+            }
+            case 1: // DW_LNS_copy
+                emit (false);
+                break;
+            case 2: // DW_LNS_advance_pc
+                address += unit.uleb () * minimum_instruction_length;
+                break;
+            case 3: // DW_LNS_advance_line
+                line += unit.sleb ();
+                break;
+            case 4: // DW_LNS_set_file
+                file = unit.uleb ();
+                break;
+            case 8: // DW_LNS_const_add_pc
+                address += ((255 - opcode_base) / line_range) * minimum_instruction_length;
+                break;
+            case 9: // DW_LNS_fixed_advance_pc
+                address += unit.read<uint16_t> ();
+                break;
+            default: // Opcodes without effect on address, file and line
+                for (uint8_t i = 0; i < opcode_lengths[opcode - 1]; i++)
+                {
+                    unit.uleb ();
+                }
+                break;
+            }
+        }
+    }
+
+    private:
+    std::vector<char> line_strings_; // .debug_line_str
+    std::vector<char> strings_; // .debug_str
+    std::vector<std::string> files_;
+    std::unordered_map<std::string, uint32_t> file_indices_;
+    std::vector<Row> rows_;
+};
+
+/*****************************************************************************
+ * Accesses per source line and recorded memory level.
+ *
+ * Every IP is symbolized once; the result is kept in an IP cache shared by all
+ * buffers analyzed with the same instance, so the traces of many threads of
+ * one binary only pay for the IPs they add.
+ *****************************************************************************/
+
+class SourceCodeLocation
+{
+    public:
+    explicit SourceCodeLocation (const FilePath& binary) : symbolizer_ (binary)
+    {
+    }
+
+    inline const DwarfSymbolizer&
+    symbolizer () const
+    {
+        return symbolizer_;
+    }
+
+    // Returns the number of accesses per "file:line" and recorded memory
+    // level. Accesses without line information are left out. A thread count
+    // of zero uses one thread per hardware thread.
+    template <class T>
+    std::map<std::string, std::map<MemoryLevel, uint64_t>>
+    access_statistics (const EventBuffer<T>& event_buffer, unsigned int threads = 0)
+    {
+        AccessHistogram histogram = accessHistogram (event_buffer, HistogramKey::MEMORY_LEVEL, threads);
+
+        std::vector<uint64_t> new_ips;
+        for (uint64_t ip : histogram.ips)
+        {
+            if (ip_cache_.try_emplace (ip, unknown_location).second)
+            {
+                new_ips.push_back (ip);
+            }
+        }
+        for (auto [ip, location] : symbolizer_.lookup (std::move (new_ips)))
+        {
+            uint64_t key = (uint64_t (location.file) << 32) | location.line;
+            auto [it, inserted] = location_ids_.try_emplace (key, static_cast<uint32_t> (locations_.size ()));
+            if (inserted)
+            {
+                locations_.push_back (location);
+            }
+            ip_cache_[ip] = it->second;
+        }
+
+        std::map<std::string, std::map<MemoryLevel, uint64_t>> statistics;
+        for (size_t i = 0; i < histogram.ips.size (); i++)
+        {
+            uint32_t id = ip_cache_.find (histogram.ips[i])->second;
+            if (id != unknown_location)
+            {
+                statistics[symbolizer_.to_string (locations_[id])][static_cast<MemoryLevel> (histogram.keys[i])] +=
+                histogram.counts[i];
+            }
+        }
+        return statistics;
+    }
+
+    private:
+    static constexpr uint32_t unknown_location = ~uint32_t (0);
+
+    private:
+    DwarfSymbolizer symbolizer_;
+    std::unordered_map<uint64_t, uint32_t> ip_cache_; // Location id per IP
+    std::unordered_map<uint64_t, uint32_t> location_ids_; // Location id per file and line
+    std::vector<SourceLocation> locations_;
+};
@@ -0,0 +1,201 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+
+#include <trace_events.h>
+
+/*****************************************************************************
+ * Columns of an access event.
+ *****************************************************************************/
+
+enum class EventColumn : uint32_t
+{
+    TIME = 1 << 0,
+    ADDRESS = 1 << 1,
+    IP = 1 << 2,
+    ACCESS_TYPE = 1 << 3,
+    MEMORY_LEVEL = 1 << 4,
+};
+
+constexpr uint32_t all_event_columns = 0x1f;
+
+constexpr uint32_t
+operator| (EventColumn a, EventColumn b)
+{
+    return static_cast<uint32_t> (a) | static_cast<uint32_t> (b);
+}
+
+constexpr uint32_t
+operator| (uint32_t a, EventColumn b)
+{
+    return a | static_cast<uint32_t> (b);
+}
+
+constexpr bool
+hasColumn (uint32_t columns, EventColumn column)
+{
+    return (columns & static_cast<uint32_t> (column)) != 0;
+}
+
+/*****************************************************************************
+ * Struct-of-arrays event buffer.
+ *
+ * Every field of AccessEvent lives in its own contiguous array, so scans over
+ * one or two fields only touch the memory of these fields. A buffer read with
+ * a subset of columns leaves the other columns empty.
+ *****************************************************************************/
+
+class EventColumnBuffer
+{
+    public:
+    EventColumnBuffer () = default;
+    explicit EventColumnBuffer (std::size_t size, uint32_t columns = all_event_columns)
+    : columns_ (columns)
+    {
+        resize (size);
+    }
+
+    template <class T>
+    explicit EventColumnBuffer (const EventBuffer<T>& event_buffer)
+    {
+        reserve (event_buffer.size ());
+        for (const AccessEvent& event : event_buffer)
+        {
+            append (event);
+        }
+    }
+
+    inline uint64_t
+    size () const
+    {
+        return size_;
+    }
+
+    // Bit mask of the EventColumns held by the buffer.
+    inline uint32_t
+    columns () const
+    {
+        return columns_;
+    }
+
+    inline void
+    append (const AccessEvent& event)
+    {
+        if (hasColumn (columns_, EventColumn::TIME)) time_.push_back (event.time);
+        if (hasColumn (columns_, EventColumn::ADDRESS)) address_.push_back (event.address);
+        if (hasColumn (columns_, EventColumn::IP)) ip_.push_back (event.ip);
+        if (hasColumn (columns_, EventColumn::ACCESS_TYPE)) access_type_.push_back (event.access_type);
+        if (hasColumn (columns_, EventColumn::MEMORY_LEVEL)) memory_level_.push_back (event.memory_level);
+        size_++;
+    }
+
+    inline void
+    reserve (std::size_t size)
+    {
+        if (hasColumn (columns_, EventColumn::TIME)) time_.reserve (size);
+        if (hasColumn (columns_, EventColumn::ADDRESS)) address_.reserve (size);
+        if (hasColumn (columns_, EventColumn::IP)) ip_.reserve (size);
+        if (hasColumn (columns_, EventColumn::ACCESS_TYPE)) access_type_.reserve (size);
+        if (hasColumn (columns_, EventColumn::MEMORY_LEVEL)) memory_level_.reserve (size);
+    }
+
+    inline void
+    resize (std::size_t size)
+    {
+        if (hasColumn (columns_, EventColumn::TIME)) time_.resize (size);
+        if (hasColumn (columns_, EventColumn::ADDRESS)) address_.resize (size);
+        if (hasColumn (columns_, EventColumn::IP)) ip_.resize (size);
+        if (hasColumn (columns_, EventColumn::ACCESS_TYPE)) access_type_.resize (size, AccessType::NA);
+        if (hasColumn (columns_, EventColumn::MEMORY_LEVEL))
+            memory_level_.resize (size, MemoryLevel::MEM_LVL_NA);
+        size_ = size;
+    }
+
+    inline void
+    clear ()
+    {
+        resize (0);
+    }
+
+    // Assembles an event; missing columns keep their default values.
+    inline AccessEvent
+    operator[] (size_t pos) const
+    {
+        AccessEvent event;
+        if (hasColumn (columns_, EventColumn::TIME)) event.time = time_[pos];
+        if (hasColumn (columns_, EventColumn::ADDRESS)) event.address = address_[pos];
+        if (hasColumn (columns_, EventColumn::IP)) event.ip = ip_[pos];
+        if (hasColumn (columns_, EventColumn::ACCESS_TYPE)) event.access_type = access_type_[pos];
+        if (hasColumn (columns_, EventColumn::MEMORY_LEVEL)) event.memory_level = memory_level_[pos];
+        return event;
+    }
+
+    inline const std::vector<uint64_t>&
+    time () const
+    {
+        return time_;
+    }
+
+    inline const std::vector<uint64_t>&
+    address () const
+    {
+        return address_;
+    }
+
+    inline const std::vector<uint64_t>&
+    ip () const
+    {
+        return ip_;
+    }
+
+    inline const std::vector<AccessType>&
+    access_type () const
+    {
+        return access_type_;
+    }
+
+    inline const std::vector<MemoryLevel>&
+    memory_level () const
+    {
+        return memory_level_;
+    }
+
+    inline std::vector<uint64_t>&
+    time ()
+    {
+        return time_;
+    }
+
+    inline std::vector<uint64_t>&
+    address ()
+    {
+        return address_;
+    }
+
+    inline std::vector<uint64_t>&
+    ip ()
+    {
+        return ip_;
+    }
+
+    inline std::vector<AccessType>&
+    access_type ()
+    {
+        return access_type_;
+    }
+
+    inline std::vector<MemoryLevel>&
+    memory_level ()
+    {
+        return memory_level_;
+    }
+
+    private:
+    uint32_t columns_ = all_event_columns;
+    uint64_t size_ = 0;
+    std::vector<uint64_t> time_;
+    std::vector<uint64_t> address_;
+    std::vector<uint64_t> ip_;
+    std::vector<AccessType> access_type_;
+    std::vector<MemoryLevel> memory_level_;
+};
@@ -0,0 +1,324 @@
+#pragma once
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+extern "C"
+{
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+}
+
+/*****************************************************************************
+ * Minimal io_uring submission and completion queue.
+ *
+ * Talks to the kernel through the raw system calls, so neither liburing nor
+ * a particular kernel version is needed at build time. Only what the trace
+ * writer and reader use is supported: plain and fixed-buffer reads and
+ * writes at explicit file offsets. The ring is meant to be driven by a
+ * single thread. supported() tells whether the running kernel, container
+ * runtime or seccomp policy allows io_uring at all, so callers can fall back
+ * to blocking I/O.
+ *****************************************************************************/
+
+// How the asynchronous writer and the trace set reader issue their I/O.
+// IO_URING keeps several reads or writes in flight from a single thread and
+// falls back to BLOCKING where io_uring is unavailable.
+enum class AsyncIoBackend
+{
+    BLOCKING,
+    IO_URING,
+};
+
+class IoUring
+{
+    public:
+    struct Completion
+    {
+        uint64_t user_data = 0;
+        int32_t result = 0; // Bytes transferred or -errno
+    };
+
+    explicit IoUring (unsigned int entries)
+    {
+        io_uring_params params;
+        std::memset (&params, 0, sizeof (params));
+        fd_ = static_cast<int> (::syscall (__NR_io_uring_setup, entries, &params));
+        if (fd_ < 0)
+        {
+            throw std::runtime_error ("Could not set up io_uring: " + std::string (std::strerror (errno)) + ".");
+        }
+
+        try
+        {
+            map_rings (params);
+        }
+        catch (...)
+        {
+            unmap_rings ();
+            ::close (fd_);
+            throw;
+        }
+    }
+
+    IoUring (const IoUring&) = delete;
+    IoUring& operator= (const IoUring&) = delete;
+
+    ~IoUring ()
+    {
+        unmap_rings ();
+        ::close (fd_);
+    }
+
+    static inline bool
+    supported ()
+    {
+        try
+        {
+            IoUring ring (1);
+            return true;
+        }
+        catch (const std::runtime_error&)
+        {
+            return false;
+        }
+    }
+
+    inline unsigned int
+    entries () const
+    {
+        return sq_entries_;
+    }
+
+    // Operations submitted whose completion has not been reaped yet.
+    inline unsigned int
+    in_flight () const
+    {
+        return in_flight_;
+    }
+
+    // Registers buffers for fixed reads and writes, replacing earlier ones.
+    // Must not be called with fixed operations in flight. Returns false if
+    // the kernel refuses, e.g. because of RLIMIT_MEMLOCK.
+    inline bool
+    register_buffers (const std::vector<struct iovec>& buffers)
+    {
+        unregister_buffers ();
+        if (buffers.empty ())
+        {
+            return false;
+        }
+        registered_ = ::syscall (__NR_io_uring_register, fd_, IORING_REGISTER_BUFFERS, buffers.data (),
+                                 static_cast<unsigned int> (buffers.size ())) == 0;
+        return registered_;
+    }
+
+    inline void
+    unregister_buffers ()
+    {
+        if (registered_)
+        {
+            ::syscall (__NR_io_uring_register, fd_, IORING_UNREGISTER_BUFFERS, nullptr, 0);
+            registered_ = false;
+        }
+    }
+
+    // Queues a write of len bytes at offset. A buffer index of zero or more
+    // writes from that registered buffer, which data has to lie in. Returns
+    // false if the submission queue is full.
+    inline bool
+    prep_write (int fd, const void* data, uint32_t len, uint64_t offset, uint64_t user_data, int buffer_index = -1)
+    {
+        return prep (buffer_index >= 0 ? IORING_OP_WRITE_FIXED : IORING_OP_WRITE, fd, const_cast<void*> (data), len,
+                     offset, user_data, buffer_index);
+    }
+
+    inline bool
+    prep_read (int fd, void* data, uint32_t len, uint64_t offset, uint64_t user_data)
+    {
+        return prep (IORING_OP_READ, fd, data, len, offset, user_data, -1);
+    }
+
+    // Hands all queued operations to the kernel.
+    inline void
+    submit ()
+    {
+        enter (0);
+    }
+
+    // Submits queued operations and waits for the next completion.
+    inline Completion
+    wait ()
+    {
+        Completion completion;
+        while (!peek (&completion))
+        {
+            enter (1);
+        }
+        return completion;
+    }
+
+    // Takes the next completion if there is one.
+    inline bool
+    peek (Completion* completion)
+    {
+        unsigned int head = *cq_head_;
+        if (head == __atomic_load_n (cq_tail_, __ATOMIC_ACQUIRE))
+        {
+            return false;
+        }
+        const io_uring_cqe& cqe = cqes_[head & *cq_mask_];
+        completion->user_data = cqe.user_data;
+        completion->result = cqe.res;
+        __atomic_store_n (cq_head_, head + 1, __ATOMIC_RELEASE);
+        in_flight_--;
+        return true;
+    }
+
+    private:
+    inline void
+    map_rings (const io_uring_params& params)
+    {
+        sq_entries_ = params.sq_entries;
+        sq_ring_size_ = params.sq_off.array + params.sq_entries * sizeof (uint32_t);
+        cq_ring_size_ = params.cq_off.cqes + params.cq_entries * sizeof (io_uring_cqe);
+        bool single_mmap = params.features & IORING_FEAT_SINGLE_MMAP;
+        if (single_mmap)
+        {
+            sq_ring_size_ = cq_ring_size_ = std::max (sq_ring_size_, cq_ring_size_);
+        }
+
+        sq_ring_ = map (sq_ring_size_, IORING_OFF_SQ_RING);
+        cq_ring_ = single_mmap ? sq_ring_ : map (cq_ring_size_, IORING_OFF_CQ_RING);
+        sqes_size_ = params.sq_entries * sizeof (io_uring_sqe);
+        sqes_ = static_cast<io_uring_sqe*> (map (sqes_size_, IORING_OFF_SQES));
+
+        char* sq = static_cast<char*> (sq_ring_);
+        sq_tail_ = reinterpret_cast<unsigned int*> (sq + params.sq_off.tail);
+        sq_mask_ = reinterpret_cast<unsigned int*> (sq + params.sq_off.ring_mask);
+        unsigned int* array = reinterpret_cast<unsigned int*> (sq + params.sq_off.array);
+        for (unsigned int i = 0; i < params.sq_entries; i++)
+        {
+            array[i] = i; // SQEs are used in ring order
+        }
+
+        char* cq = static_cast<char*> (cq_ring_);
+        cq_head_ = reinterpret_cast<unsigned int*> (cq + params.cq_off.head);
+        cq_tail_ = reinterpret_cast<unsigned int*> (cq + params.cq_off.tail);
+        cq_mask_ = reinterpret_cast<unsigned int*> (cq + params.cq_off.ring_mask);
+        cqes_ = reinterpret_cast<io_uring_cqe*> (cq + params.cq_off.cqes);
+    }
+
+    inline void*
+    map (size_t size, off_t offset)
+    {
+        void* addr = ::mmap (nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd_, offset);
+        if (addr == MAP_FAILED)
+        {
+            throw std::runtime_error ("Could not map the io_uring queues.");
+        }
+        return addr;
+    }
+
+    inline void
+    unmap_rings ()
+    {
+        if (sqes_ != nullptr)
+        {
+            ::munmap (sqes_, sqes_size_);
+        }
+        if (cq_ring_ != nullptr && cq_ring_ != sq_ring_)
+        {
+            ::munmap (cq_ring_, cq_ring_size_);
+        }
+        if (sq_ring_ != nullptr)
+        {
+            ::munmap (sq_ring_, sq_ring_size_);
+        }
+    }
+
+    inline bool
+    prep (uint8_t opcode, int fd, void* data, uint32_t len, uint64_t offset, uint64_t user_data, int buffer_index)
+    {
+        // Every queued or submitted operation holds a completion queue slot
+        if (in_flight_ + queued_ == sq_entries_)
+        {
+            return false;
+        }
+        io_uring_sqe& sqe = sqes_[(*sq_tail_ + queued_) & *sq_mask_];
+        std::memset (&sqe, 0, sizeof (sqe));
+        sqe.opcode = opcode;
+        sqe.fd = fd;
+        sqe.off = offset;
+        sqe.addr = reinterpret_cast<uint64_t> (data);
+        sqe.len = len;
+        sqe.user_data = user_data;
+        if (buffer_index >= 0)
+        {
+            sqe.buf_index = static_cast<uint16_t> (buffer_index);
+        }
+        queued_++;
+        return true;
+    }
+
+    inline void
+    enter (unsigned int min_complete)
+    {
+        __atomic_store_n (sq_tail_, *sq_tail_ + queued_, __ATOMIC_RELEASE);
+        unsigned int to_submit = queued_;
+        in_flight_ += queued_;
+        queued_ = 0;
+
+        while (true)
+        {
+            long submitted = ::syscall (__NR_io_uring_enter, fd_, to_submit, min_complete,
+                                        min_complete > 0 ? IORING_ENTER_GETEVENTS : 0, nullptr, 0);
+            if (submitted >= 0)
+            {
+                to_submit -= static_cast<unsigned int> (submitted);
+                if (to_submit == 0)
+                {
+                    return;
+                }
+                continue;
+            }
+            if (errno != EINTR && errno != EAGAIN && errno != EBUSY)
+            {
+                throw std::runtime_error ("Could not submit to io_uring: " + std::string (std::strerror (errno)) + ".");
+            }
+            if (errno != EINTR && min_complete == 0)
+            {
+                // The kernel is out of resources; completions free them
+                min_complete = 1;
+            }
+        }
+    }
+
+    private:
+    int fd_ = -1;
+    unsigned int sq_entries_ = 0;
+    unsigned int queued_ = 0; // Prepared, not yet submitted
+    unsigned int in_flight_ = 0;
+    bool registered_ = false;
+
+    void* sq_ring_ = nullptr;
+    void* cq_ring_ = nullptr;
+    size_t sq_ring_size_ = 0;
+    size_t cq_ring_size_ = 0;
+    io_uring_sqe* sqes_ = nullptr;
+    size_t sqes_size_ = 0;
+
+    unsigned int* sq_tail_ = nullptr;
+    unsigned int* sq_mask_ = nullptr;
+    unsigned int* cq_head_ = nullptr;
+    unsigned int* cq_tail_ = nullptr;
+    unsigned int* cq_mask_ = nullptr;
+    io_uring_cqe* cqes_ = nullptr;
+};
@@ -0,0 +1,335 @@
+#pragma once
+#include <cstring>
+#include <iterator>
+#include <stdexcept>
+#include <string>
+#include <utility>
+
+#include <trace_events.h>
+#include <trace_file.h>
+
+extern "C"
+{
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+}
+
+/*****************************************************************************
+ * Read-only view on access events stored in raw memory.
+ *
+ * The events inside a trace file start right after the tag and the meta data
+ * and are therefore not aligned to alignof(AccessEvent). Elements are copied
+ * out on access, which compiles to plain loads, instead of handing out
+ * misaligned references.
+ *****************************************************************************/
+
+class EventView
+{
+    public:
+    class const_iterator
+    {
+        public:
+        using iterator_category = std::random_access_iterator_tag;
+        using value_type = AccessEvent;
+        using difference_type = std::ptrdiff_t;
+        using pointer = void;
+        using reference = AccessEvent;
+
+        const_iterator () = default;
+        explicit const_iterator (const char* pos) : pos_ (pos)
+        {
+        }
+
+        inline AccessEvent
+        operator* () const
+        {
+            AccessEvent event;
+            std::memcpy (&event, pos_, sizeof (AccessEvent));
+            return event;
+        }
+
+        inline AccessEvent
+        operator[] (difference_type n) const
+        {
+            return *(*this + n);
+        }
+
+        inline const_iterator&
+        operator++ ()
+        {
+            pos_ += sizeof (AccessEvent);
+            return *this;
+        }
+
+        inline const_iterator
+        operator++ (int)
+        {
+            const_iterator tmp = *this;
+            ++*this;
+            return tmp;
+        }
+
+        inline const_iterator&
+        operator-- ()
+        {
+            pos_ -= sizeof (AccessEvent);
+            return *this;
+        }
+
+        inline const_iterator
+        operator-- (int)
+        {
+            const_iterator tmp = *this;
+            --*this;
+            return tmp;
+        }
+
+        inline const_iterator&
+        operator+= (difference_type n)
+        {
+            pos_ += n * static_cast<difference_type> (sizeof (AccessEvent));
+            return *this;
+        }
+
+        inline const_iterator&
+        operator-= (difference_type n)
+        {
+            return *this += -n;
+        }
+
+        inline const_iterator
+        operator+ (difference_type n) const
+        {
+            const_iterator tmp = *this;
+            return tmp += n;
+        }
+
+        inline const_iterator
+        operator- (difference_type n) const
+        {
+            const_iterator tmp = *this;
+            return tmp -= n;
+        }
+
+        inline difference_type
+        operator- (const const_iterator& other) const
+        {
+            return (pos_ - other.pos_) / static_cast<difference_type> (sizeof (AccessEvent));
+        }
+
+        inline bool
+        operator== (const const_iterator& other) const
+        {
+            return pos_ == other.pos_;
+        }
+
+        inline bool
+        operator!= (const const_iterator& other) const
+        {
+            return pos_ != other.pos_;
+        }
+
+        inline bool
+        operator< (const const_iterator& other) const
+        {
+            return pos_ < other.pos_;
+        }
+
+        private:
+        const char* pos_ = nullptr;
+    };
+
+    EventView () = default;
+    EventView (const char* data, uint64_t size) : data_ (data), size_ (size)
+    {
+    }
+
+    inline uint64_t
+    size () const
+    {
+        return size_;
+    }
+
+    inline bool
+    empty () const
+    {
+        return size_ == 0;
+    }
+
+    inline const char*
+    data () const
+    {
+        return data_;
+    }
+
+    inline uint64_t
+    nbytes () const
+    {
+        return size_ * sizeof (AccessEvent);
+    }
+
+    inline AccessEvent
+    operator[] (size_t pos) const
+    {
+        return begin ()[pos];
+    }
+
+    inline const_iterator
+    begin () const
+    {
+        return const_iterator (data_);
+    }
+
+    inline const_iterator
+    end () const
+    {
+        return const_iterator (data_ + nbytes ());
+    }
+
+    inline EventView
+    subview (uint64_t offset, uint64_t count) const
+    {
+        if (offset > size_ || count > size_ - offset)
+        {
+            throw std::out_of_range ("Subview exceeds the event view.");
+        }
+        return EventView (data_ + offset * sizeof (AccessEvent), count);
+    }
+
+    private:
+    const char* data_ = nullptr;
+    uint64_t size_ = 0;
+};
+
+/*****************************************************************************
+ * Memory-mapped, read-only trace file.
+ *
+ * The file is mapped as a whole and the events are exposed without copying
+ * them into an EventBuffer.
+ *****************************************************************************/
+
+class MappedTraceFile
+{
+    public:
+    explicit MappedTraceFile (const FilePath& file)
+    {
+        int fd = ::open (file.c_str (), O_RDONLY | O_CLOEXEC);
+        if (fd == -1)
+        {
+            throw std::runtime_error ("Could not open trace file " + file.string () + ".");
+        }
+
+        struct stat st;
+        if (::fstat (fd, &st) == -1)
+        {
+            ::close (fd);
+            throw std::runtime_error ("Could not stat trace file " + file.string () + ".");
+        }
+        length_ = static_cast<size_t> (st.st_size);
+
+        if (length_ < header_size ())
+        {
+            ::close (fd);
+            throw std::runtime_error ("Trace does not contain the correct tag at the beginning.");
+        }
+
+        void* addr = ::mmap (nullptr, length_, PROT_READ, MAP_PRIVATE, fd, 0);
+        ::close (fd);
+        if (addr == MAP_FAILED)
+        {
+            throw std::runtime_error ("Could not map trace file " + file.string () + ".");
+        }
+        base_ = static_cast<const char*> (addr);
+        ::madvise (addr, length_, MADV_SEQUENTIAL);
+
+        try
+        {
+            validate ();
+        }
+        catch (...)
+        {
+            unmap ();
+            throw;
+        }
+    }
+
+    MappedTraceFile (const MappedTraceFile&) = delete;
+    MappedTraceFile& operator= (const MappedTraceFile&) = delete;
+
+    MappedTraceFile (MappedTraceFile&& other) noexcept
+    {
+        *this = std::move (other);
+    }
+
+    MappedTraceFile&
+    operator= (MappedTraceFile&& other) noexcept
+    {
+        if (this != &other)
+        {
+            unmap ();
+            base_ = std::exchange (other.base_, nullptr);
+            length_ = std::exchange (other.length_, 0);
+            md_ = other.md_;
+            events_ = std::exchange (other.events_, EventView ());
+        }
+        return *this;
+    }
+
+    ~MappedTraceFile ()
+    {
+        unmap ();
+    }
+
+    inline const TraceMetaData&
+    meta_data () const
+    {
+        return md_;
+    }
+
+    inline const EventView&
+    events () const
+    {
+        return events_;
+    }
+
+    private:
+    static constexpr size_t
+    header_size ()
+    {
+        return TraceFile::tag_.size () + sizeof (TraceMetaData);
+    }
+
+    inline void
+    validate ()
+    {
+        if (TraceFile::tag_.compare (0, TraceFile::tag_.size (), base_, TraceFile::tag_.size ()) != 0)
+        {
+            throw std::runtime_error ("Trace does not contain the correct tag at the beginning.");
+        }
+        std::memcpy (&md_, base_ + TraceFile::tag_.size (), sizeof (TraceMetaData));
+
+        if (md_.size () > (length_ - header_size ()) / sizeof (AccessEvent))
+        {
+            throw std::runtime_error ("Trace is shorter than announced by its meta data.");
+        }
+        events_ = EventView (base_ + header_size (), md_.size ());
+    }
+
+    inline void
+    unmap ()
+    {
+        if (base_ != nullptr)
+        {
+            ::munmap (const_cast<char*> (base_), length_);
+            base_ = nullptr;
+        }
+    }
+
+    private:
+    const char* base_ = nullptr;
+    size_t length_ = 0;
+    TraceMetaData md_;
+    EventView events_;
+};
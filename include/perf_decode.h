@@ -0,0 +1,103 @@
+#pragma once
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+#include <trace_events.h>
+
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
+/*****************************************************************************
+ * Table-driven decoding of perf_mem_data_src values.
+ *
+ * The tables are generated at compile time from accessTypeFromPerf and
+ * memoryLevelFromPerf, so they pick the same bit as the if/else chains. As
+ * both enums only use single-bit values, the tables store the bit position,
+ * which keeps the memory level table at 16 KiB.
+ *****************************************************************************/
+
+constexpr unsigned perf_mem_op_bits = 5;
+constexpr unsigned perf_mem_lvl_bits = 14;
+
+struct PerfDecodeTables
+{
+    // Both tables are padded by three bytes for 32-bit gathers.
+    std::array<uint8_t, (1u << perf_mem_op_bits) + 3> access_type{};
+    std::array<uint8_t, (1u << perf_mem_lvl_bits) + 3> memory_level{};
+};
+
+constexpr uint8_t
+bitPosition (uint32_t value)
+{
+    uint8_t position = 0;
+    while (value >>= 1)
+    {
+        position++;
+    }
+    return position;
+}
+
+constexpr PerfDecodeTables
+makePerfDecodeTables ()
+{
+    PerfDecodeTables tables;
+    for (uint32_t op = 0; op < (1u << perf_mem_op_bits); op++)
+    {
+        tables.access_type[op] = bitPosition (static_cast<uint32_t> (accessTypeFromPerf (op)));
+    }
+    for (uint32_t lvl = 0; lvl < (1u << perf_mem_lvl_bits); lvl++)
+    {
+        tables.memory_level[lvl] = bitPosition (static_cast<uint32_t> (memoryLevelFromPerf (lvl)));
+    }
+    return tables;
+}
+
+inline constexpr PerfDecodeTables perf_decode_tables = makePerfDecodeTables ();
+
+inline AccessType
+accessTypeFromDataSource (uint64_t data_src)
+{
+    uint64_t op = (data_src >> PERF_MEM_OP_SHIFT) & ((1u << perf_mem_op_bits) - 1);
+    return static_cast<AccessType> (1u << perf_decode_tables.access_type[op]);
+}
+
+inline MemoryLevel
+memoryLevelFromDataSource (uint64_t data_src)
+{
+    uint64_t lvl = (data_src >> PERF_MEM_LVL_SHIFT) & ((1u << perf_mem_lvl_bits) - 1);
+    return static_cast<MemoryLevel> (1u << perf_decode_tables.memory_level[lvl]);
+}
+
+// Decodes count raw data_src values. Uses AVX2 gathers if the translation
+// unit is compiled with AVX2 support.
+inline void
+decodePerfDataSources (const uint64_t* data_src, size_t count, AccessType* access_types, MemoryLevel* memory_levels)
+{
+    size_t i = 0;
+#ifdef __AVX2__
+    const __m256i op_mask = _mm256_set1_epi64x ((1u << perf_mem_op_bits) - 1);
+    const __m256i lvl_mask = _mm256_set1_epi64x ((1u << perf_mem_lvl_bits) - 1);
+    const __m128i byte_mask = _mm_set1_epi32 (0xff);
+    const __m128i one = _mm_set1_epi32 (1);
+    const int* op_table = reinterpret_cast<const int*> (perf_decode_tables.access_type.data ());
+    const int* lvl_table = reinterpret_cast<const int*> (perf_decode_tables.memory_level.data ());
+
+    for (; i + 4 <= count; i += 4)
+    {
+        __m256i src = _mm256_loadu_si256 (reinterpret_cast<const __m256i*> (data_src + i));
+        __m256i op = _mm256_and_si256 (_mm256_srli_epi64 (src, PERF_MEM_OP_SHIFT), op_mask);
+        __m256i lvl = _mm256_and_si256 (_mm256_srli_epi64 (src, PERF_MEM_LVL_SHIFT), lvl_mask);
+        __m128i op_bit = _mm_and_si128 (_mm256_i64gather_epi32 (op_table, op, 1), byte_mask);
+        __m128i lvl_bit = _mm_and_si128 (_mm256_i64gather_epi32 (lvl_table, lvl, 1), byte_mask);
+        _mm_storeu_si128 (reinterpret_cast<__m128i*> (access_types + i), _mm_sllv_epi32 (one, op_bit));
+        _mm_storeu_si128 (reinterpret_cast<__m128i*> (memory_levels + i), _mm_sllv_epi32 (one, lvl_bit));
+    }
+#endif
+    for (; i < count; i++)
+    {
+        access_types[i] = accessTypeFromDataSource (data_src[i]);
+        memory_levels[i] = memoryLevelFromDataSource (data_src[i]);
+    }
+}
@@ -0,0 +1,327 @@
+#pragma once
+#include <cerrno>
+#include <cstring>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <perf_decode.h>
+#include <trace_events.h>
+
+extern "C"
+{
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+}
+
+/*****************************************************************************
+ * Sample layout.
+ *
+ * The reader decodes PERF_RECORD_SAMPLE records of events opened with
+ * exactly these sample types. The fields appear in the record in the order
+ * of their bits: ip, time, addr, data_src.
+ *****************************************************************************/
+
+constexpr uint64_t perf_sample_type =
+PERF_SAMPLE_IP | PERF_SAMPLE_TIME | PERF_SAMPLE_ADDR | PERF_SAMPLE_DATA_SRC;
+
+struct PerfSample
+{
+    perf_event_header header;
+    uint64_t ip;
+    uint64_t time;
+    uint64_t addr;
+    uint64_t data_src;
+};
+
+inline AccessEvent
+accessEventFromPerf (uint64_t ip, uint64_t time, uint64_t addr, uint64_t data_src)
+{
+    return AccessEvent (time, addr, ip, accessTypeFromDataSource (data_src), memoryLevelFromDataSource (data_src));
+}
+
+// Attributes for a precise memory sampling event, e.g. the raw encoding of
+// mem-loads or mem-stores found in /sys/bus/event_source/devices/cpu/events.
+inline perf_event_attr
+perfMemoryEventAttr (uint32_t type, uint64_t config, uint64_t config1, uint64_t period)
+{
+    perf_event_attr attr;
+    std::memset (&attr, 0, sizeof (perf_event_attr));
+    attr.size = sizeof (perf_event_attr);
+    attr.type = type;
+    attr.config = config;
+    attr.config1 = config1; // Load latency threshold for mem-loads
+    attr.sample_period = period;
+    attr.sample_type = perf_sample_type;
+    attr.precise_ip = 2;
+    attr.disabled = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    return attr;
+}
+
+// Software event with the same sample layout. Addresses and data sources are
+// zero, but it works on every machine and in virtualized environments.
+inline perf_event_attr
+perfSoftwareEventAttr (uint64_t period)
+{
+    perf_event_attr attr = perfMemoryEventAttr (PERF_TYPE_SOFTWARE, PERF_COUNT_SW_TASK_CLOCK, 0, period);
+    attr.precise_ip = 0;
+    return attr;
+}
+
+/*****************************************************************************
+ * Consumer side of a perf mmap data ring.
+ *****************************************************************************/
+
+class PerfRing
+{
+    public:
+    PerfRing () = default;
+    PerfRing (perf_event_mmap_page* meta, char* data, uint64_t data_size)
+    : meta_ (meta), data_ (data), data_size_ (data_size)
+    {
+        if (data_size_ == 0 || (data_size_ & (data_size_ - 1)) != 0)
+        {
+            throw std::invalid_argument ("The size of a perf data ring must be a power of two.");
+        }
+    }
+
+    // Calls handle(const perf_event_header*) for every complete record and
+    // releases the consumed space to the kernel afterwards. Records that wrap
+    // around the end of the ring are reassembled in a scratch buffer.
+    template <class Handler>
+    uint64_t
+    drain (Handler&& handle)
+    {
+        uint64_t head = __atomic_load_n (&meta_->data_head, __ATOMIC_ACQUIRE);
+        uint64_t tail = meta_->data_tail;
+        uint64_t records = 0;
+
+        while (tail + sizeof (perf_event_header) <= head)
+        {
+            uint64_t offset = tail & (data_size_ - 1);
+            perf_event_header header;
+            copy (&header, offset, sizeof (perf_event_header));
+            if (header.size < sizeof (perf_event_header) || tail + header.size > head)
+            {
+                break;
+            }
+
+            if (offset + header.size <= data_size_)
+            {
+                handle (reinterpret_cast<const perf_event_header*> (data_ + offset));
+            }
+            else
+            {
+                scratch_.resize ((header.size + 7) / 8);
+                copy (scratch_.data (), offset, header.size);
+                handle (reinterpret_cast<const perf_event_header*> (scratch_.data ()));
+            }
+            tail += header.size;
+            records++;
+        }
+
+        __atomic_store_n (&meta_->data_tail, tail, __ATOMIC_RELEASE);
+        return records;
+    }
+
+    private:
+    inline void
+    copy (void* dst, uint64_t offset, uint64_t size) const
+    {
+        uint64_t first = std::min (size, data_size_ - offset);
+        std::memcpy (dst, data_ + offset, first);
+        std::memcpy (static_cast<char*> (dst) + first, data_, size - first);
+    }
+
+    private:
+    perf_event_mmap_page* meta_ = nullptr;
+    char* data_ = nullptr;
+    uint64_t data_size_ = 0;
+    std::vector<uint64_t> scratch_;
+};
+
+/*****************************************************************************
+ * In-memory ring with the layout of a perf mmap buffer.
+ *
+ * Plays the kernel's part, so PerfSampleReader can be fed with recorded or
+ * synthetic samples on machines without precise memory sampling.
+ *****************************************************************************/
+
+class SyntheticPerfRing
+{
+    public:
+    explicit SyntheticPerfRing (uint64_t data_size)
+    : meta_ (std::make_unique<perf_event_mmap_page> ()), data_ (std::make_unique<uint64_t[]> (data_size / 8)),
+      data_size_ (data_size)
+    {
+        std::memset (meta_.get (), 0, sizeof (perf_event_mmap_page));
+        meta_->data_size = data_size_;
+    }
+
+    PerfRing
+    ring ()
+    {
+        return PerfRing (meta_.get (), reinterpret_cast<char*> (data_.get ()), data_size_);
+    }
+
+    // Appends a raw record. Returns false if there is not enough space left.
+    bool
+    push (const perf_event_header* record)
+    {
+        uint64_t head = meta_->data_head;
+        uint64_t tail = __atomic_load_n (&meta_->data_tail, __ATOMIC_ACQUIRE);
+        if (head + record->size - tail > data_size_)
+        {
+            return false;
+        }
+
+        char* data = reinterpret_cast<char*> (data_.get ());
+        uint64_t offset = head & (data_size_ - 1);
+        uint64_t first = std::min<uint64_t> (record->size, data_size_ - offset);
+        std::memcpy (data + offset, record, first);
+        std::memcpy (data, reinterpret_cast<const char*> (record) + first, record->size - first);
+        __atomic_store_n (&meta_->data_head, head + record->size, __ATOMIC_RELEASE);
+        return true;
+    }
+
+    bool
+    push_sample (uint64_t ip, uint64_t time, uint64_t addr, uint64_t data_src)
+    {
+        PerfSample sample;
+        sample.header.type = PERF_RECORD_SAMPLE;
+        sample.header.misc = PERF_RECORD_MISC_USER;
+        sample.header.size = sizeof (PerfSample);
+        sample.ip = ip;
+        sample.time = time;
+        sample.addr = addr;
+        sample.data_src = data_src;
+        return push (&sample.header);
+    }
+
+    private:
+    std::unique_ptr<perf_event_mmap_page> meta_;
+    std::unique_ptr<uint64_t[]> data_;
+    uint64_t data_size_;
+};
+
+/*****************************************************************************
+ * Reads memory access samples from a perf_event ring into an EventBuffer.
+ *****************************************************************************/
+
+class PerfSampleReader
+{
+    public:
+    // Opens the event for the given pid/cpu pair (see perf_event_open(2))
+    // with a data ring of 2^n pages.
+    explicit PerfSampleReader (const perf_event_attr& attr, pid_t pid = 0, int cpu = -1, unsigned int n = 6)
+    {
+        if (attr.sample_type != perf_sample_type)
+        {
+            throw std::invalid_argument ("Unsupported perf sample type.");
+        }
+
+        perf_event_attr event_attr = attr;
+        fd_ = static_cast<int> (::syscall (__NR_perf_event_open, &event_attr, pid, cpu, -1, PERF_FLAG_FD_CLOEXEC));
+        if (fd_ == -1)
+        {
+            throw std::runtime_error (std::string ("perf_event_open failed: ") + std::strerror (errno));
+        }
+
+        uint64_t page_size = static_cast<uint64_t> (::sysconf (_SC_PAGESIZE));
+        map_size_ = page_size * ((1ull << n) + 1);
+        map_ = ::mmap (nullptr, map_size_, PROT_READ | PROT_WRITE, MAP_SHARED, fd_, 0);
+        if (map_ == MAP_FAILED)
+        {
+            ::close (fd_);
+            throw std::runtime_error (std::string ("Could not map perf ring: ") + std::strerror (errno));
+        }
+
+        auto* meta = static_cast<perf_event_mmap_page*> (map_);
+        uint64_t data_offset = meta->data_offset != 0 ? meta->data_offset : page_size;
+        uint64_t data_size = meta->data_size != 0 ? meta->data_size : map_size_ - page_size;
+        ring_ = PerfRing (meta, static_cast<char*> (map_) + data_offset, data_size);
+    }
+
+    // Reads from an externally owned ring, e.g. a SyntheticPerfRing.
+    explicit PerfSampleReader (PerfRing ring) : ring_ (ring)
+    {
+    }
+
+    PerfSampleReader (const PerfSampleReader&) = delete;
+    PerfSampleReader& operator= (const PerfSampleReader&) = delete;
+
+    ~PerfSampleReader ()
+    {
+        if (map_ != nullptr)
+        {
+            ::munmap (map_, map_size_);
+        }
+        if (fd_ != -1)
+        {
+            ::close (fd_);
+        }
+    }
+
+    void
+    enable ()
+    {
+        if (fd_ != -1)
+        {
+            ::ioctl (fd_, PERF_EVENT_IOC_ENABLE, 0);
+        }
+    }
+
+    void
+    disable ()
+    {
+        if (fd_ != -1)
+        {
+            ::ioctl (fd_, PERF_EVENT_IOC_DISABLE, 0);
+        }
+    }
+
+    // Decodes all samples currently in the ring into the buffer and returns
+    // the number of appended events.
+    template <class T>
+    uint64_t
+    read (EventBuffer<T>& buffer)
+    {
+        uint64_t samples = 0;
+        ring_.drain ([&] (const perf_event_header* record)
+                     {
+                         if (record->type == PERF_RECORD_SAMPLE && record->size >= sizeof (PerfSample))
+                         {
+                             const PerfSample* s = reinterpret_cast<const PerfSample*> (record);
+                             buffer.append (accessEventFromPerf (s->ip, s->time, s->addr, s->data_src));
+                             samples++;
+                         }
+                         else if (record->type == PERF_RECORD_LOST)
+                         {
+                             // struct { header; u64 id; u64 lost; }
+                             const uint64_t* body = reinterpret_cast<const uint64_t*> (record + 1);
+                             lost_ += body[1];
+                         }
+                     });
+        return samples;
+    }
+
+    // Number of samples the kernel dropped because the ring was full.
+    uint64_t
+    lost () const
+    {
+        return lost_;
+    }
+
+    private:
+    int fd_ = -1;
+    void* map_ = nullptr;
+    uint64_t map_size_ = 0;
+    PerfRing ring_;
+    uint64_t lost_ = 0;
+};
@@ -0,0 +1,221 @@
+#pragma once
+#include <algorithm>
+#include <cstdint>
+#include <stdexcept>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include <trace_events.h>
+
+/*****************************************************************************
+ * LRU stack distance analysis.
+ *
+ * The stack distance of an access is the number of distinct cache lines
+ * touched since the previous access to the same line, i.e. a fully
+ * associative LRU cache of more than that many lines hits. Every line marks
+ * the position of its latest access in a Fenwick tree; the distance is the
+ * number of marks after the previous position of the line. The positions are
+ * compacted whenever they run out, so the tree stays at most twice as large
+ * as the number of distinct lines and an access costs O(log M) amortized.
+ *
+ * With a sample shift s > 0 only lines whose hash is a multiple of 2^s are
+ * tracked (fixed-rate SHARDS). Distances and counts of the sampled lines are
+ * scaled by 2^s, which estimates the full histogram with 2^-s of the work
+ * and memory.
+ *****************************************************************************/
+
+class ReuseDistanceAnalyzer
+{
+    public:
+    explicit ReuseDistanceAnalyzer (uint64_t line_size = 64, unsigned int sample_shift = 0)
+    : sample_shift_ (sample_shift), sample_mask_ ((uint64_t (1) << sample_shift) - 1)
+    {
+        if (line_size == 0 || (line_size & (line_size - 1)) != 0)
+        {
+            throw std::invalid_argument ("The line size must be a power of two.");
+        }
+        if (sample_shift >= 32)
+        {
+            throw std::invalid_argument ("The sample shift must be smaller than 32.");
+        }
+        while ((uint64_t (1) << line_shift_) < line_size)
+        {
+            line_shift_++;
+        }
+        resize_tree (1024);
+    }
+
+    inline void
+    access (uint64_t address)
+    {
+        accesses_++;
+        uint64_t line = address >> line_shift_;
+        if ((hash (line) & sample_mask_) != 0)
+        {
+            return;
+        }
+
+        if (position_ == tree_.size () - 1)
+        {
+            compact ();
+        }
+        uint64_t position = ++position_;
+
+        auto [it, inserted] = last_.try_emplace (line, position);
+        if (inserted)
+        {
+            cold_misses_ += uint64_t (1) << sample_shift_;
+        }
+        else
+        {
+            // Every line has exactly one mark and none is behind the
+            // current position yet
+            uint64_t previous = it->second;
+            uint64_t distance = (last_.size () - prefix_sum (previous)) << sample_shift_;
+            if (distance >= histogram_.size ())
+            {
+                histogram_.resize (distance + 1);
+            }
+            histogram_[distance] += uint64_t (1) << sample_shift_;
+            update (previous, -1);
+            it->second = position;
+        }
+        update (position, 1);
+    }
+
+    template <class T>
+    void
+    analyze (const EventBuffer<T>& event_buffer)
+    {
+        for (auto [pointer, size] : event_buffer.data ())
+        {
+            const AccessEvent* events = reinterpret_cast<const AccessEvent*> (pointer);
+            for (uint64_t i = 0; i < size / sizeof (AccessEvent); i++)
+            {
+                access (events[i].address);
+            }
+        }
+    }
+
+    // Number of reuses per stack distance in cache lines.
+    inline const std::vector<uint64_t>&
+    histogram () const
+    {
+        return histogram_;
+    }
+
+    // First accesses to a line, which miss at any cache size.
+    inline uint64_t
+    cold_misses () const
+    {
+        return cold_misses_;
+    }
+
+    inline uint64_t
+    accesses () const
+    {
+        return accesses_;
+    }
+
+    // Miss ratio of a fully associative LRU cache with the given number of
+    // lines.
+    inline double
+    miss_ratio (uint64_t cache_lines) const
+    {
+        uint64_t total = cold_misses_;
+        uint64_t misses = cold_misses_;
+        for (uint64_t distance = 0; distance < histogram_.size (); distance++)
+        {
+            total += histogram_[distance];
+            if (distance >= cache_lines)
+            {
+                misses += histogram_[distance];
+            }
+        }
+        return total == 0 ? 0.0 : static_cast<double> (misses) / static_cast<double> (total);
+    }
+
+    private:
+    static inline uint64_t
+    hash (uint64_t line)
+    {
+        // Finalizer of MurmurHash3
+        line ^= line >> 33;
+        line *= 0xff51afd7ed558ccdull;
+        line ^= line >> 33;
+        line *= 0xc4ceb9fe1a85ec53ull;
+        line ^= line >> 33;
+        return line;
+    }
+
+    // Fenwick tree over access positions, which start at 1.
+    inline void
+    update (uint64_t position, int32_t delta)
+    {
+        for (; position < tree_.size (); position += position & (~position + 1))
+        {
+            tree_[position] += delta;
+        }
+    }
+
+    inline uint64_t
+    prefix_sum (uint64_t position) const
+    {
+        uint64_t sum = 0;
+        for (; position > 0; position -= position & (~position + 1))
+        {
+            sum += static_cast<uint32_t> (tree_[position]);
+        }
+        return sum;
+    }
+
+    inline void
+    resize_tree (uint64_t size)
+    {
+        tree_.assign (size + 1, 0);
+    }
+
+    // Renumbers the latest positions of all lines to 1..M in their order and
+    // rebuilds the tree with room for at least as many further accesses.
+    inline void
+    compact ()
+    {
+        std::vector<std::pair<uint64_t, uint64_t*>> positions;
+        positions.reserve (last_.size ());
+        for (auto& [line, position] : last_)
+        {
+            positions.emplace_back (position, &position);
+        }
+        std::sort (positions.begin (), positions.end ());
+
+        resize_tree (std::max<uint64_t> (tree_.size () - 1, 2 * positions.size ()));
+        position_ = 0;
+        for (auto& [position, slot] : positions)
+        {
+            *slot = ++position_;
+            tree_[position_] = 1;
+        }
+
+        // Builds the tree in linear time by pushing every node to its parent
+        for (uint64_t position = 1; position < tree_.size (); position++)
+        {
+            uint64_t parent = position + (position & (~position + 1));
+            if (parent < tree_.size ())
+            {
+                tree_[parent] += tree_[position];
+            }
+        }
+    }
+
+    private:
+    unsigned int line_shift_ = 0;
+    unsigned int sample_shift_;
+    uint64_t sample_mask_;
+    uint64_t position_ = 0; // Position of the latest tracked access
+    std::vector<int32_t> tree_; // Node sums never exceed the number of lines
+    std::unordered_map<uint64_t, uint64_t> last_; // Latest position per line
+    std::vector<uint64_t> histogram_;
+    uint64_t cold_misses_ = 0;
+    uint64_t accesses_ = 0;
+};
@@ -0,0 +1,244 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <stdexcept>
+#include <tuple>
+
+#include <trace_events.h>
+
+template <class T> class SpscRing;
+
+using EventSpscBuffer = EventBuffer<SpscRing<AccessEvent>>;
+
+/*****************************************************************************
+ * Lock-free single-producer/single-consumer ring.
+ *
+ * head_ and tail_ are monotonic counters, each written by exactly one side
+ * and living on its own cache line. The producer keeps a private copy of the
+ * tail and only reloads the shared one when the ring looks full, so the
+ * consumer's cache line is not touched on every push.
+ *****************************************************************************/
+
+template <class T> class SpscRing
+{
+    public:
+    static constexpr std::size_t cache_line_size = 64;
+
+    // The capacity is rounded up to the next power of two.
+    explicit SpscRing (std::size_t capacity)
+    {
+        if (capacity == 0)
+        {
+            throw std::invalid_argument ("A ring needs a capacity of at least one.");
+        }
+        capacity_ = 1;
+        while (capacity_ < capacity)
+        {
+            capacity_ <<= 1;
+        }
+        mask_ = capacity_ - 1;
+        slots_ = std::make_unique<T[]> (capacity_);
+    }
+
+    SpscRing (const SpscRing&) = delete;
+    SpscRing& operator= (const SpscRing&) = delete;
+
+    inline std::size_t
+    capacity () const
+    {
+        return capacity_;
+    }
+
+    // Producer side. Returns false and counts the value as dropped if the
+    // ring is full.
+    inline bool
+    push (const T& value)
+    {
+        uint64_t head = head_.load (std::memory_order_relaxed);
+        if (head - cached_tail_ == capacity_)
+        {
+            cached_tail_ = tail_.load (std::memory_order_acquire);
+            if (head - cached_tail_ == capacity_)
+            {
+                dropped_.fetch_add (1, std::memory_order_relaxed);
+                return false;
+            }
+        }
+        slots_[head & mask_] = value;
+        head_.store (head + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Consumer side: number of readable elements.
+    inline uint64_t
+    size () const
+    {
+        return head_.load (std::memory_order_acquire) - tail_.load (std::memory_order_relaxed);
+    }
+
+    // Consumer side: the readable elements as at most two contiguous ranges.
+    inline std::tuple<T*, uint64_t, T*, uint64_t>
+    readable () const
+    {
+        uint64_t tail = tail_.load (std::memory_order_relaxed);
+        uint64_t count = head_.load (std::memory_order_acquire) - tail;
+        uint64_t first = tail & mask_;
+        uint64_t first_count = std::min<uint64_t> (count, capacity_ - first);
+        return { slots_.get () + first, first_count, slots_.get (), count - first_count };
+    }
+
+    // Consumer side: the pos-th readable element.
+    inline T&
+    operator[] (std::size_t pos) const
+    {
+        return slots_[(tail_.load (std::memory_order_relaxed) + pos) & mask_];
+    }
+
+    // Consumer side: releases the oldest count elements to the producer.
+    inline void
+    consume (uint64_t count)
+    {
+        tail_.store (tail_.load (std::memory_order_relaxed) + count, std::memory_order_release);
+    }
+
+    inline uint64_t
+    dropped () const
+    {
+        return dropped_.load (std::memory_order_relaxed);
+    }
+
+    private:
+    alignas (cache_line_size) std::atomic<uint64_t> head_{ 0 };
+    uint64_t cached_tail_ = 0;
+    alignas (cache_line_size) std::atomic<uint64_t> tail_{ 0 };
+    alignas (cache_line_size) std::atomic<uint64_t> dropped_{ 0 };
+    std::size_t capacity_ = 0;
+    std::size_t mask_ = 0;
+    std::unique_ptr<T[]> slots_;
+};
+
+/*****************************************************************************
+ * Specialization for SpscRing.
+ *
+ * append() may only be called by one producer thread. All other members
+ * belong to one consumer thread, which typically writes a snapshot() out
+ * and then commits the written events with consume (count, snapshot).
+ * Events appended while the ring is full are dropped and only show up in
+ * access_count(). The snapshot pins the drop counter, so drops that happen
+ * while the producer keeps running are reported with exactly one chunk.
+ *****************************************************************************/
+
+template <> class EventBuffer<SpscRing<AccessEvent>>
+{
+    public:
+    explicit EventBuffer (std::size_t size) : data_ (size)
+    {
+    }
+
+    inline uint64_t
+    size () const
+    {
+        return data_.size ();
+    }
+
+    inline std::size_t
+    capacity () const
+    {
+        return data_.capacity ();
+    }
+
+    // Readable events plus the events dropped since the last consume().
+    inline uint64_t
+    access_count () const
+    {
+        return data_.size () + data_.dropped () - reported_drops_;
+    }
+
+    inline uint64_t
+    dropped () const
+    {
+        return data_.dropped ();
+    }
+
+    inline void
+    append (const AccessEvent& event)
+    {
+        data_.push (event);
+    }
+
+    // Removes the oldest count events and reports all drops so far. Only
+    // safe while the producer is stopped; drains use the snapshot overload.
+    inline void
+    consume (uint64_t count)
+    {
+        reported_drops_ = data_.dropped ();
+        data_.consume (std::min (count, data_.size ()));
+    }
+
+    // The drop counter is read before the events, so a drop racing the
+    // snapshot is left for the next one instead of being counted twice or
+    // not at all.
+    inline EventSnapshot
+    snapshot () const
+    {
+        uint64_t dropped = data_.dropped ();
+        ConstSegments segments = data ();
+        return { segments, segments.bytes () / sizeof (AccessEvent) + dropped - reported_drops_, dropped };
+    }
+
+    // Removes the oldest count events of the snapshot and marks its drops as
+    // reported. Nothing was written without events, so the drops stay
+    // pending then.
+    inline void
+    consume (uint64_t count, const EventSnapshot& snapshot)
+    {
+        if (count == 0)
+        {
+            return;
+        }
+        reported_drops_ = snapshot.dropped;
+        data_.consume (std::min (count, data_.size ()));
+    }
+
+    inline void
+    clear ()
+    {
+        consume (data_.size ());
+    }
+
+    inline Segments
+    data ()
+    {
+        auto [first, first_count, second, second_count] = data_.readable ();
+        Segments segments (first, first_count * sizeof (AccessEvent));
+        if (second_count > 0)
+        {
+            segments.push_back (second, second_count * sizeof (AccessEvent));
+        }
+        return segments;
+    }
+
+    inline ConstSegments
+    data () const
+    {
+        auto [first, first_count, second, second_count] = data_.readable ();
+        ConstSegments segments (first, first_count * sizeof (AccessEvent));
+        if (second_count > 0)
+        {
+            segments.push_back (second, second_count * sizeof (AccessEvent));
+        }
+        return segments;
+    }
+
+    inline const AccessEvent&
+    operator[] (size_t pos) const
+    {
+        return data_[pos];
+    }
+
+    private:
+    SpscRing<AccessEvent> data_;
+    uint64_t reported_drops_ = 0;
+};
@@ -0,0 +1,369 @@
+#pragma once
+#include <algorithm>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <tuple>
+#include <vector>
+
+#include <trace_events.h>
+#include <trace_file.h>
+
+/*****************************************************************************
+ * Trace containers.
+ *
+ * A container stores the traces of many threads in one file. It starts with
+ * its own tag and a ContainerHeader, followed by chunks in the format of
+ * chunked traces. Chunks of different threads may be interleaved. Closing the
+ * writer appends an index with one entry per chunk and a trailer pointing to
+ * it, so a reader only needs the trailer and the index to locate every
+ * thread. Containers without index, e.g. of a crashed writer, are indexed by
+ * walking the chunk headers instead.
+ *****************************************************************************/
+
+struct ContainerHeader
+{
+    uint64_t version = 1;
+    uint64_t reserved = 0;
+};
+
+struct IndexEntry
+{
+    uint64_t thread_id = 0;
+    uint64_t offset = 0; // File offset of the chunk header
+    uint64_t size = 0;   // Chunk header and payload in bytes
+    uint64_t event_count = 0;
+    uint64_t access_count = 0;
+    uint64_t first_time = 0;
+    uint64_t last_time = 0;
+};
+
+struct ContainerTrailer
+{
+    static constexpr char magic[8] = "ATRIDX";
+
+    uint64_t index_offset = 0;
+    uint64_t entry_count = 0;
+    char tag[8] = "ATRIDX";
+};
+
+/*****************************************************************************
+ * Writer for trace containers.
+ *
+ * write() may be called from several threads; chunks are appended one at a
+ * time.
+ *****************************************************************************/
+
+class TraceContainerWriter
+{
+    public:
+    explicit TraceContainerWriter (const FilePath& file, TraceEncoding encoding = TraceEncoding::RAW)
+    : file_ (file, TraceFileMode::WRITE), encoding_ (encoding)
+    {
+        ContainerHeader header;
+        file_.file_ << TraceFile::container_tag_;
+        file_.file_.write ((char*)&header, sizeof (ContainerHeader));
+    }
+
+    TraceContainerWriter (const TraceContainerWriter&) = delete;
+    TraceContainerWriter& operator= (const TraceContainerWriter&) = delete;
+
+    ~TraceContainerWriter ()
+    {
+        close ();
+    }
+
+    // Appends the content of the buffer as a new chunk of the thread and
+    // returns the number of events written.
+    template <class T>
+    uint64_t
+    write (const EventBuffer<T>& event_buffer, uint64_t tid)
+    {
+        return write_chunk (event_buffer.snapshot (), tid);
+    }
+
+    template <class T>
+    uint64_t
+    write (const EventBuffer<T>& event_buffer, const TraceMetaData& md)
+    {
+        return write_chunk ({ event_buffer.data (), md.access_count (), 0 }, md.thread_id ());
+    }
+
+    // Appends the content of the buffer as a new chunk of the thread and
+    // removes the written events from it.
+    template <class T>
+    void
+    flush (EventBuffer<T>& event_buffer, uint64_t tid)
+    {
+        EventSnapshot snapshot = event_buffer.snapshot ();
+        event_buffer.consume (write_chunk (snapshot, tid), snapshot);
+    }
+
+    // Writes the index and the trailer. No chunks can be added afterwards.
+    inline void
+    close ()
+    {
+        std::lock_guard<std::mutex> lock (mutex_);
+        if (closed_)
+        {
+            return;
+        }
+
+        ContainerTrailer trailer;
+        trailer.index_offset = static_cast<uint64_t> (file_.file_.tellp ());
+        trailer.entry_count = index_.size ();
+        file_.write_raw_data ((const char*)index_.data (), index_.size () * sizeof (IndexEntry));
+        file_.write_raw_data ((const char*)&trailer, sizeof (ContainerTrailer));
+        file_.file_.flush ();
+        closed_ = true;
+    }
+
+    inline const std::vector<IndexEntry>&
+    index () const
+    {
+        return index_;
+    }
+
+    private:
+    inline uint64_t
+    write_chunk (const EventSnapshot& snapshot, uint64_t tid)
+    {
+        std::lock_guard<std::mutex> lock (mutex_);
+        if (closed_)
+        {
+            throw std::runtime_error ("The trace container has already been closed.");
+        }
+
+        IndexEntry entry;
+        entry.offset = static_cast<uint64_t> (file_.file_.tellp ());
+        ChunkHeader ch = file_.write_chunk (snapshot.segments, tid, snapshot.access_count, encoding_);
+        if (ch.event_count == 0)
+        {
+            return 0;
+        }
+
+        entry.thread_id = tid;
+        entry.size = sizeof (ChunkHeader) + ch.payload_size;
+        entry.event_count = ch.event_count;
+        entry.access_count = ch.access_count;
+        entry.first_time = ch.first_time;
+        entry.last_time = ch.last_time;
+        index_.push_back (entry);
+        return ch.event_count;
+    }
+
+    private:
+    TraceFile file_;
+    TraceEncoding encoding_ = TraceEncoding::RAW;
+    std::vector<IndexEntry> index_;
+    bool closed_ = false;
+    std::mutex mutex_;
+};
+
+/*****************************************************************************
+ * Reader for trace containers.
+ *****************************************************************************/
+
+class TraceContainer
+{
+    public:
+    explicit TraceContainer (const FilePath& file) : file_ (file, TraceFileMode::READ)
+    {
+        if (file_.read_format () != TraceFormat::CONTAINER)
+        {
+            throw std::runtime_error ("Trace is not a trace container.");
+        }
+
+        ContainerHeader header;
+        file_.read_raw_data ((char*)&header, sizeof (ContainerHeader));
+        if (!file_.file_ || header.version != 1)
+        {
+            throw std::runtime_error ("Trace container has an unsupported version.");
+        }
+
+        uint64_t data_begin = static_cast<uint64_t> (file_.file_.tellg ());
+        file_.file_.seekg (0, std::ios::end);
+        uint64_t file_size = static_cast<uint64_t> (file_.file_.tellg ());
+        if (!read_index (data_begin, file_size))
+        {
+            build_index (data_begin);
+        }
+        file_.format_ = TraceFormat::CHUNKED;
+    }
+
+    // One entry per chunk in file order.
+    inline const std::vector<IndexEntry>&
+    index () const
+    {
+        return index_;
+    }
+
+    // Ids of all threads in the container in ascending order.
+    inline std::vector<uint64_t>
+    thread_ids () const
+    {
+        std::vector<uint64_t> tids;
+        for (const IndexEntry& entry : index_)
+        {
+            tids.push_back (entry.thread_id);
+        }
+        std::sort (tids.begin (), tids.end ());
+        tids.erase (std::unique (tids.begin (), tids.end ()), tids.end ());
+        return tids;
+    }
+
+    inline TraceMetaData
+    meta_data (uint64_t tid) const
+    {
+        uint64_t size = 0;
+        uint64_t access_count = 0;
+        bool found = false;
+        for (const IndexEntry& entry : index_)
+        {
+            if (entry.thread_id == tid)
+            {
+                size += entry.event_count;
+                access_count += entry.access_count;
+                found = true;
+            }
+        }
+        if (!found)
+        {
+            throw std::invalid_argument ("Trace container does not contain the thread.");
+        }
+        return TraceMetaData (size, tid, access_count);
+    }
+
+    // Reads all events of one thread. Only the chunks of the thread are read.
+    template <class T>
+    std::tuple<EventBuffer<T>, TraceMetaData>
+    read (uint64_t tid)
+    {
+        TraceMetaData md = meta_data (tid);
+        EventBuffer<T> buffer (md.size ());
+        auto segments = buffer.data ();
+        read_thread (tid, reinterpret_cast<AccessEvent*> (std::get<0> (segments.front ())));
+        return { buffer, md };
+    }
+
+    private:
+    inline bool
+    read_index (uint64_t data_begin, uint64_t file_size);
+
+    inline void
+    build_index (uint64_t data_begin);
+
+    inline void
+    read_thread (uint64_t tid, AccessEvent* events);
+
+    private:
+    TraceFile file_;
+    std::vector<IndexEntry> index_;
+};
+
+template <>
+inline std::tuple<EventBuffer<boost::circular_buffer<AccessEvent>>, TraceMetaData>
+TraceContainer::read (uint64_t tid)
+{
+    TraceMetaData md = meta_data (tid);
+    std::unique_ptr<AccessEvent[]> data = std::make_unique<AccessEvent[]> (md.size ());
+    read_thread (tid, data.get ());
+
+    EventBuffer<boost::circular_buffer<AccessEvent>> buffer (md.size ());
+    for (uint64_t i = 0; i < md.size (); i++)
+    {
+        buffer.append (data.get ()[i]);
+    }
+
+    return { buffer, md };
+}
+
+bool
+TraceContainer::read_index (uint64_t data_begin, uint64_t file_size)
+{
+    if (file_size < data_begin + sizeof (ContainerTrailer))
+    {
+        return false;
+    }
+
+    ContainerTrailer trailer;
+    file_.file_.seekg (file_size - sizeof (ContainerTrailer));
+    file_.read_raw_data ((char*)&trailer, sizeof (ContainerTrailer));
+    uint64_t index_end = file_size - sizeof (ContainerTrailer);
+    if (!file_.file_ || std::memcmp (trailer.tag, ContainerTrailer::magic, sizeof (trailer.tag)) != 0 ||
+        trailer.index_offset < data_begin || trailer.index_offset > index_end ||
+        (index_end - trailer.index_offset) != trailer.entry_count * sizeof (IndexEntry))
+    {
+        file_.file_.clear ();
+        return false;
+    }
+
+    index_.resize (trailer.entry_count);
+    file_.file_.seekg (trailer.index_offset);
+    file_.read_raw_data ((char*)index_.data (), index_.size () * sizeof (IndexEntry));
+    if (!file_.file_)
+    {
+        throw std::runtime_error ("Trace container contains an incomplete index.");
+    }
+    return true;
+}
+
+void
+TraceContainer::build_index (uint64_t data_begin)
+{
+    // Only complete chunks are indexed, a torn chunk at the end is ignored
+    file_.file_.clear ();
+    file_.file_.seekg (0, std::ios::end);
+    uint64_t file_size = static_cast<uint64_t> (file_.file_.tellg ());
+    file_.file_.seekg (data_begin);
+
+    index_.clear ();
+    uint64_t offset = data_begin;
+    ChunkHeader ch;
+    while (offset + sizeof (ChunkHeader) <= file_size)
+    {
+        file_.read_raw_data ((char*)&ch, sizeof (ChunkHeader));
+        uint64_t size = sizeof (ChunkHeader) + ch.payload_size;
+        if (!file_.file_ || ch.payload_size > file_size - offset - sizeof (ChunkHeader) || ch.event_count == 0 ||
+            ch.encoding > TraceEncoding::COLUMNAR || ch.reserved != 0)
+        {
+            break;
+        }
+
+        IndexEntry entry;
+        entry.thread_id = ch.thread_id;
+        entry.offset = offset;
+        entry.size = size;
+        entry.event_count = ch.event_count;
+        entry.access_count = ch.access_count;
+        entry.first_time = ch.first_time;
+        entry.last_time = ch.last_time;
+        index_.push_back (entry);
+
+        offset += size;
+        file_.file_.seekg (offset);
+    }
+    file_.file_.clear ();
+}
+
+void
+TraceContainer::read_thread (uint64_t tid, AccessEvent* events)
+{
+    for (const IndexEntry& entry : index_)
+    {
+        if (entry.thread_id != tid)
+        {
+            continue;
+        }
+
+        file_.file_.seekg (entry.offset);
+        file_.chunk_remaining_ = 0;
+        file_.read_events (events, entry.event_count);
+        if (file_.chunk_.thread_id != tid || file_.chunk_remaining_ != 0)
+        {
+            throw std::runtime_error ("Trace container index does not match its chunks.");
+        }
+        events += entry.event_count;
+    }
+}
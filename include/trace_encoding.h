@@ -0,0 +1,428 @@
+#pragma once
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <unordered_map>
+#include <vector>
+
+#include <event_column_buffer.h>
+#include <perf_decode.h>
+#include <trace_events.h>
+
+/*****************************************************************************
+ * Encodings of the events inside a chunk.
+ *****************************************************************************/
+
+enum class TraceEncoding : uint32_t
+{
+    RAW = 0, // Events are stored as an array of AccessEvent
+    PACKED = 1, // 64 bit time, 48 bit address and ip, 8 bit type and level
+    DELTA = 2, // Delta and dictionary coded varints
+    COLUMNAR = 3, // One contiguous array per field
+};
+
+/*****************************************************************************
+ * Packed encoding.
+ *
+ * A record takes 21 instead of 32 bytes. Addresses and instruction pointers
+ * keep their lower 48 bits and are sign-extended on decode, which covers
+ * user and kernel space addresses on x86-64 and AArch64. Access type and
+ * memory level are single-bit enums and are stored as the bit position in
+ * the lower three and upper four bits of a byte. Chunks with any other
+ * type or level value are written RAW.
+ *****************************************************************************/
+
+constexpr size_t packed_event_size = 21;
+
+inline bool
+fitsPacked (uint64_t value)
+{
+    return static_cast<uint64_t> (static_cast<int64_t> (value << 16) >> 16) == value;
+}
+
+// Number of access type bits, PERF_MEM_OP_NA up to PERF_MEM_OP_EXEC.
+constexpr unsigned int access_type_count = 5;
+
+// True if value is a single bit below 1 << count.
+inline bool
+isSingleBit (uint32_t value, unsigned int count)
+{
+    return value != 0 && (value & (value - 1)) == 0 && value < (1u << count);
+}
+
+// Only single-bit types and levels survive the type/level byte, anything
+// else has to be stored RAW.
+inline bool
+canPackTypeLevel (const AccessEvent& event)
+{
+    return isSingleBit (static_cast<uint32_t> (event.access_type), access_type_count) &&
+           isSingleBit (static_cast<uint32_t> (event.memory_level), memory_level_count);
+}
+
+inline bool
+canPackTypeLevels (const AccessEvent* events, uint64_t count)
+{
+    for (uint64_t i = 0; i < count; i++)
+    {
+        if (!canPackTypeLevel (events[i]))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+inline bool
+canPack (const AccessEvent* events, uint64_t count)
+{
+    for (uint64_t i = 0; i < count; i++)
+    {
+        if (!fitsPacked (events[i].address) || !fitsPacked (events[i].ip) || !canPackTypeLevel (events[i]))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+inline uint8_t
+packTypeLevel (AccessType access_type, MemoryLevel memory_level)
+{
+    return bitPosition (static_cast<uint32_t> (access_type)) |
+           (bitPosition (static_cast<uint32_t> (memory_level)) << 3);
+}
+
+// Returns false if the byte holds a bit position that no encoder writes.
+inline bool
+unpackTypeLevel (uint8_t type_level, AccessEvent& event)
+{
+    if ((type_level & 0x7) >= access_type_count || (type_level >> 3) >= memory_level_count)
+    {
+        return false;
+    }
+    event.access_type = static_cast<AccessType> (1u << (type_level & 0x7));
+    event.memory_level = static_cast<MemoryLevel> (1u << (type_level >> 3));
+    return true;
+}
+
+inline void
+encodePacked (const AccessEvent* events, uint64_t count, std::vector<char>& out)
+{
+    size_t offset = out.size ();
+    out.resize (offset + count * packed_event_size);
+    char* pos = out.data () + offset;
+    for (uint64_t i = 0; i < count; i++)
+    {
+        std::memcpy (pos, &events[i].time, 8);
+        std::memcpy (pos + 8, &events[i].address, 6);
+        std::memcpy (pos + 14, &events[i].ip, 6);
+        pos[20] = static_cast<char> (packTypeLevel (events[i].access_type, events[i].memory_level));
+        pos += packed_event_size;
+    }
+}
+
+inline void
+decodePacked (const char* in, uint64_t count, AccessEvent* events)
+{
+    for (uint64_t i = 0; i < count; i++)
+    {
+        uint64_t address = 0;
+        uint64_t ip = 0;
+        std::memcpy (&events[i].time, in, 8);
+        std::memcpy (&address, in + 8, 6);
+        std::memcpy (&ip, in + 14, 6);
+        events[i].address = static_cast<uint64_t> (static_cast<int64_t> (address << 16) >> 16);
+        events[i].ip = static_cast<uint64_t> (static_cast<int64_t> (ip << 16) >> 16);
+        if (!unpackTypeLevel (static_cast<uint8_t> (in[20]), events[i]))
+        {
+            throw std::runtime_error ("Trace contains a corrupted packed chunk.");
+        }
+        in += packed_event_size;
+    }
+}
+
+/*****************************************************************************
+ * Delta encoding.
+ *
+ * Payload layout, all integers as LEB128 varints:
+ *
+ *   ip_count, ip_count zigzag deltas between consecutive dictionary entries
+ *   per event: zigzag time delta, dictionary index of the ip,
+ *              zigzag address delta, type/level byte as in PACKED
+ *
+ * Dictionary entries are in order of first appearance. The address delta is
+ * taken against the previous address of the same ip, so strided accesses of
+ * one instruction stay small even if several loops are interleaved.
+ *****************************************************************************/
+
+inline uint64_t
+zigzagEncode (uint64_t value)
+{
+    return (value << 1) ^ static_cast<uint64_t> (static_cast<int64_t> (value) >> 63);
+}
+
+inline uint64_t
+zigzagDecode (uint64_t value)
+{
+    return (value >> 1) ^ (~(value & 1) + 1);
+}
+
+inline void
+putVarint (std::vector<char>& out, uint64_t value)
+{
+    while (value >= 0x80)
+    {
+        out.push_back (static_cast<char> (value | 0x80));
+        value >>= 7;
+    }
+    out.push_back (static_cast<char> (value));
+}
+
+inline uint64_t
+getVarint (const char*& in, const char* end)
+{
+    uint64_t value = 0;
+    for (unsigned shift = 0; shift < 64 && in < end; shift += 7)
+    {
+        uint8_t byte = static_cast<uint8_t> (*in++);
+        value |= static_cast<uint64_t> (byte & 0x7f) << shift;
+        if (byte < 0x80)
+        {
+            return value;
+        }
+    }
+    throw std::runtime_error ("Trace contains a corrupted delta encoded chunk.");
+}
+
+inline void
+encodeDelta (const AccessEvent* events, uint64_t count, std::vector<char>& out)
+{
+    std::unordered_map<uint64_t, uint32_t> index;
+    std::vector<uint64_t> dictionary;
+    std::vector<uint32_t> ip_index (count);
+    for (uint64_t i = 0; i < count; i++)
+    {
+        auto [it, inserted] = index.emplace (events[i].ip, static_cast<uint32_t> (dictionary.size ()));
+        if (inserted)
+        {
+            dictionary.push_back (events[i].ip);
+        }
+        ip_index[i] = it->second;
+    }
+
+    out.reserve (out.size () + 10 * dictionary.size () + 8 * count);
+    putVarint (out, dictionary.size ());
+    uint64_t previous_ip = 0;
+    for (uint64_t ip : dictionary)
+    {
+        putVarint (out, zigzagEncode (ip - previous_ip));
+        previous_ip = ip;
+    }
+
+    std::vector<uint64_t> previous_address (dictionary.size (), 0);
+    uint64_t previous_time = 0;
+    for (uint64_t i = 0; i < count; i++)
+    {
+        const AccessEvent& e = events[i];
+        putVarint (out, zigzagEncode (e.time - previous_time));
+        putVarint (out, ip_index[i]);
+        putVarint (out, zigzagEncode (e.address - previous_address[ip_index[i]]));
+        out.push_back (static_cast<char> (packTypeLevel (e.access_type, e.memory_level)));
+        previous_time = e.time;
+        previous_address[ip_index[i]] = e.address;
+    }
+}
+
+inline void
+decodeDelta (const char* in, uint64_t payload_size, uint64_t count, AccessEvent* events)
+{
+    const char* end = in + payload_size;
+    uint64_t dictionary_size = getVarint (in, end);
+    if (dictionary_size > payload_size)
+    {
+        throw std::runtime_error ("Trace contains a corrupted delta encoded chunk.");
+    }
+
+    std::vector<uint64_t> dictionary (dictionary_size);
+    uint64_t ip = 0;
+    for (uint64_t& entry : dictionary)
+    {
+        ip += zigzagDecode (getVarint (in, end));
+        entry = ip;
+    }
+
+    std::vector<uint64_t> previous_address (dictionary_size, 0);
+    uint64_t time = 0;
+    for (uint64_t i = 0; i < count; i++)
+    {
+        time += zigzagDecode (getVarint (in, end));
+        uint64_t index = getVarint (in, end);
+        if (index >= dictionary_size || in >= end)
+        {
+            throw std::runtime_error ("Trace contains a corrupted delta encoded chunk.");
+        }
+        uint64_t address = previous_address[index] + zigzagDecode (getVarint (in, end));
+        if (in >= end)
+        {
+            throw std::runtime_error ("Trace contains a corrupted delta encoded chunk.");
+        }
+        uint8_t type_level = static_cast<uint8_t> (*in++);
+
+        events[i].time = time;
+        events[i].address = address;
+        events[i].ip = dictionary[index];
+        if (!unpackTypeLevel (type_level, events[i]))
+        {
+            throw std::runtime_error ("Trace contains a corrupted delta encoded chunk.");
+        }
+        previous_address[index] = address;
+    }
+    if (in != end)
+    {
+        throw std::runtime_error ("Trace contains a corrupted delta encoded chunk.");
+    }
+}
+
+/*****************************************************************************
+ * Columnar encoding.
+ *
+ * The payload holds the arrays time[n], address[n], ip[n], access_type[n]
+ * and memory_level[n] back to back, so a reader can seek to the columns it
+ * needs and skip the others.
+ *****************************************************************************/
+
+// Byte offsets of the columns inside a columnar payload of count events.
+inline uint64_t
+columnOffset (EventColumn column, uint64_t count)
+{
+    switch (column)
+    {
+    case EventColumn::TIME:
+        return 0;
+    case EventColumn::ADDRESS:
+        return count * sizeof (uint64_t);
+    case EventColumn::IP:
+        return 2 * count * sizeof (uint64_t);
+    case EventColumn::ACCESS_TYPE:
+        return 3 * count * sizeof (uint64_t);
+    case EventColumn::MEMORY_LEVEL:
+        return 3 * count * sizeof (uint64_t) + count * sizeof (AccessType);
+    }
+    return 0;
+}
+
+inline void
+encodeColumnar (const AccessEvent* events, uint64_t count, std::vector<char>& out)
+{
+    size_t offset = out.size ();
+    out.resize (offset + count * sizeof (AccessEvent));
+    char* base = out.data () + offset;
+    uint64_t* time = reinterpret_cast<uint64_t*> (base + columnOffset (EventColumn::TIME, count));
+    uint64_t* address = reinterpret_cast<uint64_t*> (base + columnOffset (EventColumn::ADDRESS, count));
+    uint64_t* ip = reinterpret_cast<uint64_t*> (base + columnOffset (EventColumn::IP, count));
+    AccessType* type = reinterpret_cast<AccessType*> (base + columnOffset (EventColumn::ACCESS_TYPE, count));
+    MemoryLevel* level = reinterpret_cast<MemoryLevel*> (base + columnOffset (EventColumn::MEMORY_LEVEL, count));
+    for (uint64_t i = 0; i < count; i++)
+    {
+        time[i] = events[i].time;
+        address[i] = events[i].address;
+        ip[i] = events[i].ip;
+        type[i] = events[i].access_type;
+        level[i] = events[i].memory_level;
+    }
+}
+
+inline void
+decodeColumnar (const char* in, uint64_t count, AccessEvent* events)
+{
+    const uint64_t* time = reinterpret_cast<const uint64_t*> (in + columnOffset (EventColumn::TIME, count));
+    const uint64_t* address = reinterpret_cast<const uint64_t*> (in + columnOffset (EventColumn::ADDRESS, count));
+    const uint64_t* ip = reinterpret_cast<const uint64_t*> (in + columnOffset (EventColumn::IP, count));
+    const AccessType* type =
+    reinterpret_cast<const AccessType*> (in + columnOffset (EventColumn::ACCESS_TYPE, count));
+    const MemoryLevel* level =
+    reinterpret_cast<const MemoryLevel*> (in + columnOffset (EventColumn::MEMORY_LEVEL, count));
+    for (uint64_t i = 0; i < count; i++)
+    {
+        events[i] = AccessEvent (time[i], address[i], ip[i], type[i], level[i]);
+    }
+}
+
+/*****************************************************************************
+ * Dispatch over all encodings.
+ *****************************************************************************/
+
+// Returns false if the events cannot be represented in the encoding.
+inline bool
+canEncode (TraceEncoding encoding, const AccessEvent* events, uint64_t count)
+{
+    switch (encoding)
+    {
+    case TraceEncoding::RAW:
+        return true;
+    case TraceEncoding::PACKED:
+        return canPack (events, count);
+    case TraceEncoding::DELTA:
+        return canPackTypeLevels (events, count);
+    case TraceEncoding::COLUMNAR:
+        return true;
+    }
+    return false;
+}
+
+// Appends the encoded events to out. Encodings with state across events
+// (DELTA) have to get all events of a chunk in one call.
+inline void
+encodeEvents (TraceEncoding encoding, const AccessEvent* events, uint64_t count, std::vector<char>& out)
+{
+    switch (encoding)
+    {
+    case TraceEncoding::RAW:
+        out.insert (out.end (), reinterpret_cast<const char*> (events),
+                    reinterpret_cast<const char*> (events + count));
+        return;
+    case TraceEncoding::PACKED:
+        encodePacked (events, count, out);
+        return;
+    case TraceEncoding::DELTA:
+        encodeDelta (events, count, out);
+        return;
+    case TraceEncoding::COLUMNAR:
+        encodeColumnar (events, count, out);
+        return;
+    }
+    throw std::invalid_argument ("Unsupported trace encoding.");
+}
+
+inline void
+decodeEvents (TraceEncoding encoding, const char* payload, uint64_t payload_size, uint64_t count, AccessEvent* events)
+{
+    switch (encoding)
+    {
+    case TraceEncoding::RAW:
+        if (payload_size != count * sizeof (AccessEvent))
+        {
+            break;
+        }
+        std::memcpy (events, payload, payload_size);
+        return;
+    case TraceEncoding::PACKED:
+        if (payload_size != count * packed_event_size)
+        {
+            break;
+        }
+        decodePacked (payload, count, events);
+        return;
+    case TraceEncoding::DELTA:
+        decodeDelta (payload, payload_size, count, events);
+        return;
+    case TraceEncoding::COLUMNAR:
+        if (payload_size != count * sizeof (AccessEvent))
+        {
+            break;
+        }
+        decodeColumnar (payload, count, events);
+        return;
+    }
+    throw std::runtime_error ("Trace contains a chunk with an unsupported encoding.");
+}
@@ -1,7 +1,12 @@
 #pragma once
 
+#include <algorithm>
+#include <array>
 #include <boost/circular_buffer.hpp>
-#include <forward_list>
+#include <cassert>
+#include <cstdlib>
+#include <limits>
+#include <new>
 #include <vector>
 
 #include <thread>
@@ -10,6 +15,7 @@ extern "C"
 {
 #include <linux/perf_event.h>
 #include <sys/mman.h>
+#include <sys/uio.h>
 #include <unistd.h>
 }
 
@@ -17,18 +23,27 @@ enum class AccessType : uint32_t;
 enum class MemoryLevel : uint32_t;
 struct AccessEvent;
 template <class Container> class EventBuffer;
+template <class T, std::size_t Alignment> class AlignedAllocator;
+
+constexpr std::size_t page_alignment = 4096;
+constexpr std::size_t huge_page_alignment = 2 << 20;
 
 using PointerSizePair = std::tuple<char*, uint64_t>;
 using ConstPointerSizePair = std::tuple<const char*, uint64_t>;
+template <class Pair> class SegmentView;
+using Segments = SegmentView<PointerSizePair>;
+using ConstSegments = SegmentView<ConstPointerSizePair>;
 using EventVectorBuffer = EventBuffer<std::vector<AccessEvent>>;
 using EventRingBuffer = EventBuffer<boost::circular_buffer<AccessEvent>>;
+using EventAlignedBuffer = EventBuffer<std::vector<AccessEvent, AlignedAllocator<AccessEvent, page_alignment>>>;
+using EventHugePageBuffer = EventBuffer<std::vector<AccessEvent, AlignedAllocator<AccessEvent, huge_page_alignment>>>;
 
 inline std::string toString (AccessType access_type);
 inline AccessType accessTypeFromString (const std::string& type);
-inline AccessType accessTypeFromPerf (uint64_t mem_op);
+constexpr AccessType accessTypeFromPerf (uint64_t mem_op);
 
 inline std::string toString (MemoryLevel memory_level);
-inline MemoryLevel memoryLevelFromPerf (uint64_t mem_lvl);
+constexpr MemoryLevel memoryLevelFromPerf (uint64_t mem_lvl);
 
 std::ostream& operator<< (std::ostream& os, const AccessEvent& access_event);
 
@@ -87,7 +102,7 @@ accessTypeFromString (const std::string& type)
     return AccessType::NA;
 }
 
-inline AccessType
+constexpr AccessType
 accessTypeFromPerf (uint64_t mem_op)
 {
     if(mem_op & PERF_MEM_OP_LOAD)
@@ -168,7 +183,7 @@ toString (MemoryLevel memory_level)
     return "Unsupported memory level";
 }
 
-inline MemoryLevel
+constexpr MemoryLevel
 memoryLevelFromPerf (uint64_t mem_lvl)
 {
     if(mem_lvl & PERF_MEM_LVL_L1)
@@ -222,6 +237,19 @@ memoryLevelFromPerf (uint64_t mem_lvl)
     return MemoryLevel::MEM_LVL_NA;
 }
 
+constexpr unsigned int memory_level_count = 14;
+
+// Bit position of the single-bit MemoryLevel value, always below
+// memory_level_count. Values that are not a single known bit, e.g. from a
+// corrupt trace, map to the position of MEM_LVL_NA.
+inline unsigned int
+memoryLevelIndex (MemoryLevel level)
+{
+    uint32_t value = static_cast<uint32_t> (level);
+    unsigned int index = static_cast<unsigned int> (__builtin_ctz (value | (1u << memory_level_count)));
+    return (value & (value - 1)) == 0 && index < memory_level_count ? index : 0;
+}
+
 /*****************************************************************************
  * Access Events
  *****************************************************************************/
@@ -251,6 +279,185 @@ operator<< (std::ostream& os, const AccessEvent& access_event)
     return os;
 }
 
+/*****************************************************************************
+ * Segments of an Event Buffer
+ *
+ * The storage of an event buffer consists of at most two contiguous segments,
+ * the second one only if a ring wraps around. The view holds them inline, so
+ * taking it does not allocate.
+ *****************************************************************************/
+
+template <class Pair> class SegmentView
+{
+    public:
+    static constexpr size_t capacity = 2;
+
+    using const_iterator = typename std::array<Pair, capacity>::const_iterator;
+
+    SegmentView () = default;
+
+    template <class Pointer>
+    SegmentView (Pointer pointer, uint64_t size)
+    {
+        push_back (pointer, size);
+    }
+
+    template <class Pointer>
+    inline void
+    push_back (Pointer pointer, uint64_t size)
+    {
+        assert (size_ < capacity);
+        segments_[size_++] = Pair (reinterpret_cast<std::tuple_element_t<0, Pair>> (pointer), size);
+    }
+
+    inline size_t
+    size () const
+    {
+        return size_;
+    }
+
+    inline bool
+    empty () const
+    {
+        return size_ == 0;
+    }
+
+    inline const Pair&
+    front () const
+    {
+        return segments_[0];
+    }
+
+    inline const Pair&
+    operator[] (size_t pos) const
+    {
+        return segments_[pos];
+    }
+
+    inline const_iterator
+    begin () const
+    {
+        return segments_.begin ();
+    }
+
+    inline const_iterator
+    end () const
+    {
+        return segments_.begin () + size_;
+    }
+
+    // Total size in bytes
+    inline uint64_t
+    bytes () const
+    {
+        uint64_t bytes = 0;
+        for (const Pair& segment : *this)
+        {
+            bytes += std::get<1> (segment);
+        }
+        return bytes;
+    }
+
+    // Fills iov with the non-empty segments and returns their number, so a
+    // flush can hand all of them to a single writev/readv call.
+    inline int
+    to_iovec (struct iovec* iov) const
+    {
+        int count = 0;
+        for (auto [pointer, size] : *this)
+        {
+            if (size > 0)
+            {
+                iov[count].iov_base = const_cast<char*> (pointer);
+                iov[count].iov_len = size;
+                count++;
+            }
+        }
+        return count;
+    }
+
+    private:
+    std::array<Pair, capacity> segments_;
+    size_t size_ = 0;
+};
+
+// One data() snapshot of a buffer and the accesses its events stand for,
+// taken together so that a writer draining a buffer that keeps filling
+// commits exactly what it wrote with consume (count, snapshot).
+struct EventSnapshot
+{
+    ConstSegments segments;
+    uint64_t access_count = 0;
+    uint64_t dropped = 0; // Drop counter of an SPSC buffer when taken
+};
+
+/*****************************************************************************
+ * Aligned storage.
+ *
+ * Allocates page or huge page aligned memory, rounded up to whole pages, as
+ * needed for O_DIRECT transfers. Allocations aligned to huge pages are
+ * advised to be backed by transparent huge pages, which keeps large trace
+ * buffers from taking TLB entries of the measured application. The advice
+ * is ignored where transparent huge pages are disabled.
+ *****************************************************************************/
+
+template <class T, std::size_t Alignment> class AlignedAllocator
+{
+    public:
+    using value_type = T;
+
+    template <class U> struct rebind
+    {
+        using other = AlignedAllocator<U, Alignment>;
+    };
+
+    AlignedAllocator () = default;
+
+    template <class U> AlignedAllocator (const AlignedAllocator<U, Alignment>&)
+    {
+    }
+
+    inline T*
+    allocate (std::size_t n)
+    {
+        if (n > (std::numeric_limits<std::size_t>::max () - Alignment) / sizeof (T))
+        {
+            throw std::bad_alloc ();
+        }
+        std::size_t bytes = (n * sizeof (T) + Alignment - 1) / Alignment * Alignment;
+        void* pointer = std::aligned_alloc (Alignment, bytes);
+        if (pointer == nullptr)
+        {
+            throw std::bad_alloc ();
+        }
+        if constexpr (Alignment >= huge_page_alignment)
+        {
+            ::madvise (pointer, bytes, MADV_HUGEPAGE);
+        }
+        return static_cast<T*> (pointer);
+    }
+
+    inline void
+    deallocate (T* pointer, std::size_t)
+    {
+        std::free (pointer);
+    }
+
+    template <class U>
+    inline bool
+    operator== (const AlignedAllocator<U, Alignment>&) const
+    {
+        return true;
+    }
+
+    template <class U>
+    inline bool
+    operator!= (const AlignedAllocator<U, Alignment>&) const
+    {
+        return false;
+    }
+};
+
 /*****************************************************************************
  * Event Buffer Interface
  *****************************************************************************/
@@ -285,10 +492,46 @@ template <class Container> class EventBuffer
         data_.push_back (event);
     }
 
-    std::forward_list<PointerSizePair>
+    inline void
+    reserve (std::size_t size);
+
+    inline void
+    clear ()
+    {
+        access_count_ = 0;
+        data_.clear ();
+    }
+
+    // Removes the oldest count events, i.e. the ones already written out.
+    inline void
+    consume (uint64_t count)
+    {
+        if (count >= data_.size ())
+        {
+            clear ();
+            return;
+        }
+        data_.erase (data_.begin (), data_.begin () + count);
+        access_count_ -= std::min (access_count_, count);
+    }
+
+    inline EventSnapshot
+    snapshot () const
+    {
+        return { data (), access_count (), 0 };
+    }
+
+    // Removes the oldest count events of the snapshot once they are written.
+    inline void
+    consume (uint64_t count, const EventSnapshot&)
+    {
+        consume (count);
+    }
+
+    Segments
     data ();
 
-    std::forward_list<ConstPointerSizePair>
+    ConstSegments
     data () const;
 
     inline const_iterator
@@ -332,21 +575,46 @@ template <class Container> class EventBuffer
     uint64_t access_count_ = 0;
 };
 
+/*****************************************************************************
+ * Contiguous containers, e.g. vectors with aligned storage.
+ *****************************************************************************/
+
+template <class Container>
+inline Segments
+EventBuffer<Container>::data ()
+{
+    return Segments (data_.data (), data_.size () * sizeof (AccessEvent));
+}
+
+template <class Container>
+inline ConstSegments
+EventBuffer<Container>::data () const
+{
+    return ConstSegments (data_.data (), data_.size () * sizeof (AccessEvent));
+}
+
+template <class Container>
+inline void
+EventBuffer<Container>::reserve (std::size_t size)
+{
+    data_.reserve (size);
+}
+
 /*****************************************************************************
  * Specialization for std::vector.
  *****************************************************************************/
 template <>
-inline std::forward_list<PointerSizePair>
+inline Segments
 EventVectorBuffer::data ()
 {
-    return { { reinterpret_cast<char*> (data_.data ()), data_.size () * sizeof (AccessEvent) } };
+    return Segments (data_.data (), data_.size () * sizeof (AccessEvent));
 }
 
 template <>
-inline std::forward_list<ConstPointerSizePair>
+inline ConstSegments
 EventVectorBuffer::data () const
 {
-    return { { reinterpret_cast<const char*> (data_.data ()), data_.size () * sizeof (AccessEvent) } };
+    return ConstSegments (data_.data (), data_.size () * sizeof (AccessEvent));
 }
 
 template <>
@@ -356,38 +624,39 @@ EventVectorBuffer::size () const
     return data_.size();
 }
 
+template <>
+inline void
+EventVectorBuffer::reserve (std::size_t size)
+{
+    data_.reserve (size);
+}
+
 /*****************************************************************************
  * Specialization for boost::circular_buffer.
  *****************************************************************************/
 
 template <>
-inline std::forward_list<PointerSizePair>
+inline Segments
 EventBuffer<boost::circular_buffer<AccessEvent>>::data ()
 {
-    std::forward_list<PointerSizePair> list;
+    Segments segments (data_.array_one ().first, data_.array_one ().second * sizeof (AccessEvent));
     if (data_.array_two ().second > 0)
     {
-        list.push_front (std::make_tuple (reinterpret_cast<char*> (data_.array_two ().first),
-                                          data_.array_two ().second * sizeof (AccessEvent)));
+        segments.push_back (data_.array_two ().first, data_.array_two ().second * sizeof (AccessEvent));
     }
-    list.push_front (std::make_tuple (reinterpret_cast<char*> (data_.array_one ().first),
-                                      data_.array_one ().second * sizeof (AccessEvent)));
-    return list;
+    return segments;
 }
 
 template <>
-inline std::forward_list<ConstPointerSizePair>
+inline ConstSegments
 EventBuffer<boost::circular_buffer<AccessEvent>>::data () const
 {
-    std::forward_list<ConstPointerSizePair> list;
+    ConstSegments segments (data_.array_one ().first, data_.array_one ().second * sizeof (AccessEvent));
     if (data_.array_two ().second > 0)
     {
-        list.push_front (std::make_tuple (reinterpret_cast<const char*> (data_.array_two ().first),
-                                          data_.array_two ().second * sizeof (AccessEvent)));
+        segments.push_back (data_.array_two ().first, data_.array_two ().second * sizeof (AccessEvent));
     }
-    list.push_front (std::make_tuple (reinterpret_cast<const char*> (data_.array_one ().first),
-                                      data_.array_one ().second * sizeof (AccessEvent)));
-    return list;
+    return segments;
 }
 
 template <>
@@ -396,3 +665,13 @@ EventBuffer<boost::circular_buffer<AccessEvent>>::size() const
 {
     return data_.size();
 }
+
+template <>
+inline void
+EventBuffer<boost::circular_buffer<AccessEvent>>::reserve (std::size_t size)
+{
+    if (data_.capacity () < size)
+    {
+        data_.set_capacity (size);
+    }
+}
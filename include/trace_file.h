@@ -1,14 +1,29 @@
 #pragma once
+#include <algorithm>
 #include <boost/filesystem.hpp>
+#include <cerrno>
+#include <cstring>
 #include <fstream>
+#include <iterator>
+#include <limits>
 #include <sstream>
 #include <string>
 #include <string_view>
 #include <tuple>
 #include <vector>
 
+#include <event_column_buffer.h>
+#include <trace_encoding.h>
 #include <trace_events.h>
 
+extern "C"
+{
+#include <fcntl.h>
+#include <limits.h>
+#include <sys/uio.h>
+#include <unistd.h>
+}
+
 using FilePath = boost::filesystem::path;
 using AccessSequence = std::vector<AccessEvent>;
 
@@ -18,6 +33,20 @@ enum class TraceFileMode
     WRITE,
 };
 
+// FSTREAM writes through a buffered boost::filesystem::fstream. POSIX writes
+// through a file descriptor and gathers everything a write produces, e.g. tag,
+// meta data, both segments of a ring buffer and the time index, into a single
+// pwritev without copying it into a stream buffer first. DIRECT writes with
+// O_DIRECT, bypassing the page cache, so tracing does not change the cache
+// footprint of the traced application; data is staged in a huge page backed
+// buffer and written in whole blocks. Reading always uses the stream.
+enum class TraceIoBackend
+{
+    FSTREAM,
+    POSIX,
+    DIRECT,
+};
+
 inline size_t
 convert_thread_id (std::thread::id tid)
 {
@@ -61,6 +90,11 @@ struct TraceMetaData
     {
     }
 
+    explicit TraceMetaData (uint64_t size, uint64_t tid, uint64_t access_count)
+    : size_ (size), tid_ (tid), access_count_ (access_count)
+    {
+    }
+
     uint64_t
     size () const
     {
@@ -85,31 +119,148 @@ struct TraceMetaData
     uint64_t access_count_ = 0;
 };
 
+/*****************************************************************************
+ * Chunked traces.
+ *
+ * A chunked trace starts with its own tag and a StreamHeader, followed by an
+ * arbitrary number of chunks. Each chunk is self-describing, so a writer can
+ * flush a buffer whenever it is full and a reader only has to walk the chunk
+ * headers to find the events.
+ *****************************************************************************/
+
+struct StreamHeader
+{
+    uint64_t version = 1;
+    uint64_t thread_id = 0;
+};
+
+struct ChunkHeader
+{
+    uint64_t thread_id = 0;
+    uint64_t event_count = 0;
+    uint64_t access_count = 0;
+    uint64_t first_time = 0;
+    uint64_t last_time = 0;
+    uint64_t payload_size = 0;
+    TraceEncoding encoding = TraceEncoding::RAW;
+    uint32_t reserved = 0;
+};
+
+/*****************************************************************************
+ * Time index.
+ *
+ * Writers append a sparse index to the end of a trace: one entry per chunk
+ * of a chunked trace, or one per time_index_stride events of a single block
+ * trace. Entries store the smallest and largest timestamp, so ranges can be
+ * selected without assuming ordered events. A trailer at the very end points
+ * to the index. Traces without trailer, e.g. of a crashed writer, are read as
+ * before.
+ *****************************************************************************/
+
+constexpr uint64_t time_index_stride = 4096;
+
+struct TimeIndexEntry
+{
+    uint64_t offset = 0; // File offset of the chunk header or the first event
+    uint64_t event_count = 0;
+    uint64_t access_count = 0;
+    uint64_t min_time = 0;
+    uint64_t max_time = 0;
+};
+
+struct TimeIndexTrailer
+{
+    static constexpr char magic[8] = "ATRTIX";
+
+    uint64_t index_offset = 0;
+    uint64_t entry_count = 0;
+    char tag[8] = "ATRTIX";
+};
+
+enum class TraceFormat
+{
+    BLOB,
+    CHUNKED,
+    CONTAINER,
+};
+
 class TraceFile
 {
+    friend class MappedTraceFile;
+    friend class TraceStreamWriter;
+    friend class TraceSet;
+    friend class TraceContainer;
+    friend class TraceContainerWriter;
+    friend class TraceMerger;
 
     public:
-    explicit TraceFile (const FilePath& file, TraceFileMode mode)
+    explicit TraceFile (const FilePath& file, TraceFileMode mode, TraceIoBackend backend = TraceIoBackend::FSTREAM)
     {
+        if (mode == TraceFileMode::WRITE && backend != TraceIoBackend::FSTREAM)
+        {
+            int flags = O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC;
+            if (backend == TraceIoBackend::DIRECT)
+            {
+                direct_.resize (direct_buffer_size);
+                fd_ = ::open (file.c_str (), flags | O_DIRECT, 0644);
+                // File systems without direct I/O, e.g. tmpfs, get the same
+                // block-aligned writes through the page cache
+                if (fd_ == -1 && errno == EINVAL)
+                {
+                    fd_ = ::open (file.c_str (), flags, 0644);
+                }
+            }
+            else
+            {
+                fd_ = ::open (file.c_str (), flags, 0644);
+            }
+            if (fd_ == -1)
+            {
+                throw std::runtime_error ("Could not open trace file " + file.string () + ".");
+            }
+            return;
+        }
         auto ios_mode = ios_open_mode (mode);
         file_.open (file, ios_mode | std::ios::binary);
     }
 
+    TraceFile (const TraceFile&) = delete;
+    TraceFile& operator= (const TraceFile&) = delete;
+
     ~TraceFile ()
     {
+        if (fd_ != -1)
+        {
+            ::close (fd_);
+        }
         file_.close ();
     }
 
+    // RAW writes the single block format, every other encoding a chunked
+    // trace with one chunk.
     template <class T>
     void
-    write (const EventBuffer<T>& event_buffer, const TraceMetaData& md)
+    write (const EventBuffer<T>& event_buffer, const TraceMetaData& md, TraceEncoding encoding = TraceEncoding::RAW)
     {
+        if (encoding != TraceEncoding::RAW)
+        {
+            write_stream_header (md.thread_id ());
+            write_chunk (event_buffer.data (), md.thread_id (), md.access_count (), encoding);
+            write_time_index ();
+            return;
+        }
+
         write_meta_data (md);
 
-        for (auto [pointer, size] : event_buffer.data ())
+        auto segments = event_buffer.data ();
+        put_segments (segments);
+        uint64_t offset = tag_.size () + sizeof (TraceMetaData);
+        for (auto [pointer, size] : segments)
         {
-            write_raw_data (pointer, size);
+            index_events (reinterpret_cast<const AccessEvent*> (pointer), size / sizeof (AccessEvent), offset);
+            offset += size;
         }
+        write_time_index ();
     }
 
     template <class T>
@@ -117,33 +268,303 @@ class TraceFile
     read ()
     {
         TraceMetaData md;
-        read_meta_data (&md);
+        read_header (&md);
 
         EventBuffer<T> buffer (md.size ());
         for (PointerSizePair data : buffer.data ())
         {
-            read_raw_data (std::get<0> (data), std::get<1> (data));
+            read_events (reinterpret_cast<AccessEvent*> (std::get<0> (data)),
+                         std::get<1> (data) / sizeof (AccessEvent));
         }
 
         return {buffer, md};
     }
 
+    // Reads the events with t_begin <= time < t_end. Only the chunks or
+    // blocks whose time range overlaps the requested one are read if the
+    // trace has a time index, otherwise the whole trace is filtered.
+    template <class T>
+    std::tuple<EventBuffer<T>, TraceMetaData>
+    read_range (uint64_t t_begin, uint64_t t_end)
+    {
+        TraceMetaData md;
+        read_header (&md);
+
+        std::vector<AccessEvent> events;
+        for (const TimeIndexEntry& entry : read_time_ranges (md))
+        {
+            if (entry.max_time < t_begin || entry.min_time >= t_end)
+            {
+                continue;
+            }
+
+            staged_range_.resize (entry.event_count);
+            file_.seekg (entry.offset);
+            chunk_remaining_ = 0;
+            read_events (staged_range_.data (), entry.event_count);
+            std::copy_if (staged_range_.begin (), staged_range_.end (), std::back_inserter (events),
+                          [t_begin, t_end] (const AccessEvent& e) { return e.time >= t_begin && e.time < t_end; });
+        }
+        if (!file_)
+        {
+            throw std::runtime_error ("Trace ends with an incomplete chunk.");
+        }
+
+        EventBuffer<T> buffer;
+        buffer.reserve (events.size ());
+        for (const AccessEvent& e : events)
+        {
+            buffer.append (e);
+        }
+        return { buffer, TraceMetaData (events.size (), md.thread_id (), events.size ()) };
+    }
+
+    // Writes a chunked trace with one columnar chunk straight from the columns.
+    inline void
+    write (const EventColumnBuffer& column_buffer, const TraceMetaData& md);
+
+    // Reads only the given EventColumns. Columnar chunks are read column by
+    // column and unused columns are skipped on disk; other chunks are decoded
+    // and scattered into the columns.
+    inline std::tuple<EventColumnBuffer, TraceMetaData>
+    read_columns (uint32_t columns = all_event_columns);
+
     private:
     inline void
     write_meta_data (const TraceMetaData& md);
 
+    inline void
+    write_stream_header (uint64_t tid);
+
+    // Returns the header of a chunk with the events of the segments and adds
+    // its time index entry at the current write position. Payload size is
+    // left to the caller.
+    template <class Segments>
+    ChunkHeader
+    index_chunk (const Segments& segments, uint64_t tid, uint64_t access_count, TraceEncoding encoding)
+    {
+        ChunkHeader ch;
+        ch.encoding = encoding;
+        TimeIndexEntry entry;
+        entry.offset = write_position ();
+        entry.min_time = std::numeric_limits<uint64_t>::max ();
+        for (auto [pointer, size] : segments)
+        {
+            if (size == 0)
+            {
+                continue;
+            }
+            const AccessEvent* events = reinterpret_cast<const AccessEvent*> (pointer);
+            uint64_t count = size / sizeof (AccessEvent);
+            if (ch.event_count == 0)
+            {
+                ch.first_time = events[0].time;
+            }
+            ch.last_time = events[count - 1].time;
+            ch.event_count += count;
+            for (uint64_t i = 0; i < count; i++)
+            {
+                entry.min_time = std::min (entry.min_time, events[i].time);
+                entry.max_time = std::max (entry.max_time, events[i].time);
+            }
+            if (!canEncode (ch.encoding, events, count))
+            {
+                ch.encoding = TraceEncoding::RAW;
+            }
+        }
+        if (ch.event_count == 0)
+        {
+            return ch;
+        }
+
+        ch.thread_id = tid;
+        ch.access_count = std::max (access_count, ch.event_count);
+        entry.event_count = ch.event_count;
+        entry.access_count = ch.access_count;
+        time_index_.push_back (entry);
+        return ch;
+    }
+
+    // Reserves the file range of a RAW chunk with the snapshot's events for
+    // a caller that writes header and events itself, e.g. asynchronously. The
+    // events follow the header, which starts at the returned offset. Only
+    // possible with a file descriptor backend.
+    inline uint64_t
+    reserve_chunk (const EventSnapshot& snapshot, uint64_t tid, ChunkHeader* ch)
+    {
+        if (fd_ == -1 || !direct_.empty ())
+        {
+            throw std::runtime_error ("Chunks can only be reserved in traces written with the POSIX backend.");
+        }
+        flush_pending ();
+        uint64_t offset = fd_offset_;
+        *ch = index_chunk (snapshot.segments, tid, snapshot.access_count, TraceEncoding::RAW);
+        if (ch->event_count > 0)
+        {
+            ch->payload_size = ch->event_count * sizeof (AccessEvent);
+            fd_offset_ += sizeof (ChunkHeader) + ch->payload_size;
+        }
+        return offset;
+    }
+
+    inline int
+    fd () const
+    {
+        return fd_;
+    }
+
+    // Writes the segments of a data() snapshot as one chunk and returns its
+    // header; the event count is zero if nothing was written. Falls back to
+    // RAW if the events cannot be represented in the requested encoding.
+    template <class Segments>
+    ChunkHeader
+    write_chunk (const Segments& segments, uint64_t tid, uint64_t access_count, TraceEncoding encoding)
+    {
+        ChunkHeader ch = index_chunk (segments, tid, access_count, encoding);
+        if (ch.event_count == 0)
+        {
+            return ch;
+        }
+
+        if (ch.encoding == TraceEncoding::RAW)
+        {
+            ch.payload_size = ch.event_count * sizeof (AccessEvent);
+            put (&ch, sizeof (ChunkHeader));
+            put_segments (segments);
+            flush_pending ();
+            return ch;
+        }
+
+        // Encodings see the chunk as one contiguous range
+        payload_.clear ();
+        auto [pointer, size] = segments.front ();
+        if (size / sizeof (AccessEvent) == ch.event_count)
+        {
+            encodeEvents (ch.encoding, reinterpret_cast<const AccessEvent*> (pointer), ch.event_count, payload_);
+        }
+        else
+        {
+            staged_.clear ();
+            for (auto [pointer, size] : segments)
+            {
+                const AccessEvent* events = reinterpret_cast<const AccessEvent*> (pointer);
+                staged_.insert (staged_.end (), events, events + size / sizeof (AccessEvent));
+            }
+            encodeEvents (ch.encoding, staged_.data (), staged_.size (), payload_);
+        }
+        ch.payload_size = payload_.size ();
+        put (&ch, sizeof (ChunkHeader));
+        write_raw_data (payload_.data (), payload_.size ());
+        flush_pending ();
+        return ch;
+    }
+
     inline void
     write_raw_data (const char* data, size_t nbytes);
 
+    // Queues data for the POSIX backend, which must stay valid until the next
+    // flush_pending(), copies it to the staging buffer of the DIRECT backend
+    // or writes it to the stream.
+    inline void
+    put (const void* data, size_t nbytes);
+
+    // Queues all segments of a buffer at once for the POSIX backend, so both
+    // parts of a wrapped ring go out with the same pwritev.
+    template <class Pair>
+    void
+    put_segments (const SegmentView<Pair>& segments)
+    {
+        if (fd_ == -1 || !direct_.empty ())
+        {
+            for (auto [pointer, size] : segments)
+            {
+                put (pointer, size);
+            }
+            return;
+        }
+        struct iovec iov[SegmentView<Pair>::capacity];
+        pending_.insert (pending_.end (), iov, iov + segments.to_iovec (iov));
+    }
+
+    // Writes the queued data with as few pwritev calls as possible.
+    inline void
+    flush_pending ();
+
+    // Writes the staged data of the DIRECT backend. A partial last block is
+    // padded with zeros, written and kept staged, so the next flush rewrites
+    // it completed; the file is truncated to the data written.
+    inline void
+    flush_direct ();
+
+    // Offset at which the next put() ends up in the file.
+    inline uint64_t
+    write_position ();
+
+    // Makes everything written so far visible to readers of the file.
+    inline void
+    flush ();
+
+    // Adds index entries for events of a single block trace starting at the
+    // given file offset.
+    inline void
+    index_events (const AccessEvent* events, uint64_t count, uint64_t offset);
+
+    inline void
+    write_time_index ();
+
+    inline TraceFormat
+    read_format ();
+
+    // Loads the time index if the trace has one and limits the chunks to the
+    // data in front of it. Restores the read position.
+    inline void
+    read_time_index ();
+
+    // Time index of the trace or, without index, entries that cover all
+    // events. Expects the read position behind the header.
+    inline std::vector<TimeIndexEntry>
+    read_time_ranges (const TraceMetaData& md);
+
+    inline void
+    read_header (TraceMetaData* md);
+
     inline void
     read_meta_data (TraceMetaData* md);
 
+    inline void
+    read_stream_meta_data (TraceMetaData* md);
+
+    inline bool
+    read_chunk_header (ChunkHeader* ch);
+
+    inline void
+    read_events (AccessEvent* events, uint64_t count);
+
     inline void
     read_raw_data (char* data, size_t nbytes);
 
     private:
     boost::filesystem::fstream file_;
+    int fd_ = -1; // Output of the POSIX and DIRECT backend
+    uint64_t fd_offset_ = 0; // End of the written data; for DIRECT, of the staged data
+    std::vector<struct iovec> pending_;
+    std::vector<char, AlignedAllocator<char, huge_page_alignment>> direct_; // Staging buffer of the DIRECT backend
+    size_t direct_fill_ = 0; // Staged bytes, starting at a block boundary of the file
+    TraceFormat format_ = TraceFormat::BLOB;
+    ChunkHeader chunk_;
+    uint64_t chunk_remaining_ = 0;
+    std::vector<char> payload_; // Encoded payload of the current chunk
+    std::vector<AccessEvent> staged_; // Decoded events of a partially read chunk
+    std::vector<AccessEvent> staged_range_; // Events of a chunk or block selected by read_range
+    std::vector<TimeIndexEntry> time_index_;
+    uint64_t data_end_ = std::numeric_limits<uint64_t>::max (); // End of the chunks
+    static constexpr size_t direct_block_size = page_alignment;
+    static constexpr size_t direct_buffer_size = huge_page_alignment;
     static constexpr std::string_view tag_ = "ATRACE";
+    static constexpr std::string_view chunked_tag_ = "ATRCHK";
+    static constexpr std::string_view container_tag_ = "ATRSET";
+    static_assert (tag_.size () == chunked_tag_.size () && tag_.size () == container_tag_.size (),
+                   "All trace tags must have the same length.");
 };
 
 template <>
@@ -151,11 +572,11 @@ inline std::tuple<EventBuffer<boost::circular_buffer<AccessEvent>>, TraceMetaDat
 TraceFile::read ()
 {
     TraceMetaData md;
-    read_meta_data (&md);
+    read_header (&md);
 
     EventBuffer<boost::circular_buffer<AccessEvent>> buffer (md.size ());
     std::unique_ptr<AccessEvent[]> data = std::make_unique<AccessEvent[]> (md.size ());
-    read_raw_data (reinterpret_cast<char*> (data.get ()), md.size () * sizeof(AccessEvent));
+    read_events (data.get (), md.size ());
 
     for(uint64_t i = 0; i < md.size(); i++)
     {
@@ -168,32 +589,697 @@ TraceFile::read ()
 void
 TraceFile::write_meta_data (const TraceMetaData& md)
 {
-    file_ << tag_;
-    file_.write ((char*)&md, sizeof (TraceMetaData));
+    put (tag_.data (), tag_.size ());
+    put (&md, sizeof (TraceMetaData));
+}
+
+void
+TraceFile::write (const EventColumnBuffer& column_buffer, const TraceMetaData& md)
+{
+    if (column_buffer.columns () != all_event_columns)
+    {
+        throw std::invalid_argument ("Only column buffers with all columns can be written.");
+    }
+
+    write_stream_header (md.thread_id ());
+    uint64_t count = column_buffer.size ();
+    if (count == 0)
+    {
+        return;
+    }
+
+    ChunkHeader ch;
+    ch.thread_id = md.thread_id ();
+    ch.event_count = count;
+    ch.access_count = std::max (md.access_count (), count);
+    ch.first_time = column_buffer.time ().front ();
+    ch.last_time = column_buffer.time ().back ();
+    ch.payload_size = count * sizeof (AccessEvent);
+    ch.encoding = TraceEncoding::COLUMNAR;
+
+    TimeIndexEntry entry;
+    entry.offset = write_position ();
+    entry.event_count = ch.event_count;
+    entry.access_count = ch.access_count;
+    auto [min_time, max_time] = std::minmax_element (column_buffer.time ().begin (), column_buffer.time ().end ());
+    entry.min_time = *min_time;
+    entry.max_time = *max_time;
+    time_index_.push_back (entry);
+
+    put (&ch, sizeof (ChunkHeader));
+    write_raw_data ((const char*)column_buffer.time ().data (), count * sizeof (uint64_t));
+    write_raw_data ((const char*)column_buffer.address ().data (), count * sizeof (uint64_t));
+    write_raw_data ((const char*)column_buffer.ip ().data (), count * sizeof (uint64_t));
+    write_raw_data ((const char*)column_buffer.access_type ().data (), count * sizeof (AccessType));
+    write_raw_data ((const char*)column_buffer.memory_level ().data (), count * sizeof (MemoryLevel));
+    write_time_index ();
+}
+
+std::tuple<EventColumnBuffer, TraceMetaData>
+TraceFile::read_columns (uint32_t columns)
+{
+    TraceMetaData md;
+    read_header (&md);
+    EventColumnBuffer buffer (md.size (), columns);
+
+    auto scatter = [&buffer, columns] (const AccessEvent* events, uint64_t count, uint64_t offset)
+    {
+        for (uint64_t i = 0; i < count; i++)
+        {
+            const AccessEvent& e = events[i];
+            if (hasColumn (columns, EventColumn::TIME)) buffer.time ()[offset + i] = e.time;
+            if (hasColumn (columns, EventColumn::ADDRESS)) buffer.address ()[offset + i] = e.address;
+            if (hasColumn (columns, EventColumn::IP)) buffer.ip ()[offset + i] = e.ip;
+            if (hasColumn (columns, EventColumn::ACCESS_TYPE)) buffer.access_type ()[offset + i] = e.access_type;
+            if (hasColumn (columns, EventColumn::MEMORY_LEVEL))
+                buffer.memory_level ()[offset + i] = e.memory_level;
+        }
+    };
+
+    uint64_t offset = 0;
+    if (format_ == TraceFormat::BLOB)
+    {
+        constexpr uint64_t block_size = 1 << 16;
+        staged_.resize (std::min (block_size, md.size ()));
+        while (offset < md.size ())
+        {
+            uint64_t n = std::min (block_size, md.size () - offset);
+            read_events (staged_.data (), n);
+            scatter (staged_.data (), n, offset);
+            offset += n;
+        }
+        return { buffer, md };
+    }
+
+    ChunkHeader ch;
+    while (offset < md.size () && read_chunk_header (&ch))
+    {
+        if (ch.encoding != TraceEncoding::COLUMNAR)
+        {
+            payload_.resize (ch.payload_size);
+            read_raw_data (payload_.data (), payload_.size ());
+            staged_.resize (ch.event_count);
+            decodeEvents (ch.encoding, payload_.data (), payload_.size (), ch.event_count, staged_.data ());
+            scatter (staged_.data (), ch.event_count, offset);
+            offset += ch.event_count;
+            continue;
+        }
+
+        if (ch.payload_size != ch.event_count * sizeof (AccessEvent))
+        {
+            throw std::runtime_error ("Trace contains a chunk with an unsupported encoding.");
+        }
+        auto payload_start = file_.tellg ();
+        auto read_column = [&] (EventColumn column, void* data, uint64_t element_size)
+        {
+            if (!hasColumn (columns, column))
+            {
+                return;
+            }
+            file_.seekg (payload_start + static_cast<std::streamoff> (columnOffset (column, ch.event_count)));
+            read_raw_data (static_cast<char*> (data) + offset * element_size, ch.event_count * element_size);
+        };
+        read_column (EventColumn::TIME, buffer.time ().data (), sizeof (uint64_t));
+        read_column (EventColumn::ADDRESS, buffer.address ().data (), sizeof (uint64_t));
+        read_column (EventColumn::IP, buffer.ip ().data (), sizeof (uint64_t));
+        read_column (EventColumn::ACCESS_TYPE, buffer.access_type ().data (), sizeof (AccessType));
+        read_column (EventColumn::MEMORY_LEVEL, buffer.memory_level ().data (), sizeof (MemoryLevel));
+        file_.seekg (payload_start + static_cast<std::streamoff> (ch.payload_size));
+        offset += ch.event_count;
+    }
+
+    if (!file_ || offset != md.size ())
+    {
+        throw std::runtime_error ("Trace ends with an incomplete chunk.");
+    }
+    return { buffer, md };
+}
+
+void
+TraceFile::write_stream_header (uint64_t tid)
+{
+    StreamHeader sh;
+    sh.thread_id = tid;
+    put (chunked_tag_.data (), chunked_tag_.size ());
+    put (&sh, sizeof (StreamHeader));
+    flush_pending ();
 }
 
 void
 TraceFile::write_raw_data (const char* data, size_t nbytes)
 {
-    file_.write (data, nbytes);
+    put (data, nbytes);
 }
 
 void
-TraceFile::read_meta_data (TraceMetaData* md)
+TraceFile::put (const void* data, size_t nbytes)
+{
+    if (fd_ == -1)
+    {
+        file_.write (static_cast<const char*> (data), nbytes);
+        return;
+    }
+    if (!direct_.empty ())
+    {
+        const char* bytes = static_cast<const char*> (data);
+        while (nbytes > 0)
+        {
+            size_t count = std::min (nbytes, direct_.size () - direct_fill_);
+            std::memcpy (direct_.data () + direct_fill_, bytes, count);
+            direct_fill_ += count;
+            fd_offset_ += count;
+            bytes += count;
+            nbytes -= count;
+            if (direct_fill_ == direct_.size ())
+            {
+                flush_direct ();
+            }
+        }
+        return;
+    }
+    if (nbytes > 0)
+    {
+        pending_.push_back ({ const_cast<void*> (data), nbytes });
+    }
+}
+
+void
+TraceFile::flush_direct ()
+{
+    if (direct_fill_ == 0)
+    {
+        return;
+    }
+    size_t full = direct_fill_ / direct_block_size * direct_block_size;
+    size_t tail = direct_fill_ - full;
+    size_t size = full;
+    if (tail > 0)
+    {
+        std::memset (direct_.data () + direct_fill_, 0, direct_block_size - tail);
+        size += direct_block_size;
+    }
+
+    const char* data = direct_.data ();
+    uint64_t offset = fd_offset_ - direct_fill_;
+    while (size > 0)
+    {
+        ssize_t written = ::pwrite (fd_, data, size, offset);
+        if (written < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            throw std::runtime_error ("Could not write trace file.");
+        }
+        data += written;
+        size -= static_cast<size_t> (written);
+        offset += static_cast<uint64_t> (written);
+    }
+
+    if (tail > 0)
+    {
+        std::memmove (direct_.data (), direct_.data () + full, tail);
+        if (::ftruncate (fd_, static_cast<off_t> (fd_offset_)) != 0)
+        {
+            throw std::runtime_error ("Could not write trace file.");
+        }
+    }
+    direct_fill_ = tail;
+}
+
+void
+TraceFile::flush_pending ()
+{
+    size_t first = 0;
+    while (first < pending_.size ())
+    {
+        int count = static_cast<int> (std::min<size_t> (pending_.size () - first, IOV_MAX));
+        ssize_t written = ::pwritev (fd_, pending_.data () + first, count, fd_offset_);
+        if (written < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            pending_.clear ();
+            throw std::runtime_error ("Could not write trace file.");
+        }
+        fd_offset_ += written;
+
+        // Skip what has been written, the rest is retried
+        size_t remaining = static_cast<size_t> (written);
+        while (first < pending_.size () && remaining >= pending_[first].iov_len)
+        {
+            remaining -= pending_[first].iov_len;
+            first++;
+        }
+        if (remaining > 0)
+        {
+            pending_[first].iov_base = static_cast<char*> (pending_[first].iov_base) + remaining;
+            pending_[first].iov_len -= remaining;
+        }
+    }
+    pending_.clear ();
+}
+
+uint64_t
+TraceFile::write_position ()
+{
+    if (fd_ == -1)
+    {
+        return static_cast<uint64_t> (file_.tellp ());
+    }
+    uint64_t position = fd_offset_;
+    for (const struct iovec& iov : pending_)
+    {
+        position += iov.iov_len;
+    }
+    return position;
+}
+
+void
+TraceFile::flush ()
+{
+    if (fd_ == -1)
+    {
+        file_.flush ();
+        return;
+    }
+    flush_pending ();
+    flush_direct ();
+}
+
+void
+TraceFile::index_events (const AccessEvent* events, uint64_t count, uint64_t offset)
+{
+    for (uint64_t i = 0; i < count; i++)
+    {
+        if (time_index_.empty () || time_index_.back ().event_count == time_index_stride)
+        {
+            TimeIndexEntry entry;
+            entry.offset = offset + i * sizeof (AccessEvent);
+            entry.min_time = events[i].time;
+            entry.max_time = events[i].time;
+            time_index_.push_back (entry);
+        }
+        TimeIndexEntry& entry = time_index_.back ();
+        entry.event_count++;
+        entry.min_time = std::min (entry.min_time, events[i].time);
+        entry.max_time = std::max (entry.max_time, events[i].time);
+    }
+}
+
+void
+TraceFile::write_time_index ()
+{
+    TimeIndexTrailer trailer;
+    trailer.index_offset = write_position ();
+    trailer.entry_count = time_index_.size ();
+    write_raw_data ((const char*)time_index_.data (), time_index_.size () * sizeof (TimeIndexEntry));
+    write_raw_data ((const char*)&trailer, sizeof (TimeIndexTrailer));
+    flush_pending ();
+    flush_direct ();
+}
+
+TraceFormat
+TraceFile::read_format ()
 {
     constexpr std::size_t tag_len = tag_.size ();
     char tag_buffer[tag_len + 1];
     file_.read (tag_buffer, sizeof (char) * tag_len);
     tag_buffer[tag_len] = '\0';
-    if (tag_.compare(tag_buffer) != 0)
+    if (tag_.compare(tag_buffer) == 0)
+    {
+        return TraceFormat::BLOB;
+    }
+    if (chunked_tag_.compare (tag_buffer) == 0)
+    {
+        return TraceFormat::CHUNKED;
+    }
+    if (container_tag_.compare (tag_buffer) == 0)
+    {
+        return TraceFormat::CONTAINER;
+    }
+    throw std::runtime_error ("Trace does not contain the correct tag at the beginning.");
+}
+
+void
+TraceFile::read_time_index ()
+{
+    time_index_.clear ();
+    data_end_ = std::numeric_limits<uint64_t>::max ();
+
+    auto position = file_.tellg ();
+    file_.seekg (0, std::ios::end);
+    uint64_t file_size = static_cast<uint64_t> (file_.tellg ());
+    uint64_t data_begin = static_cast<uint64_t> (position);
+    if (file_size >= data_begin + sizeof (TimeIndexTrailer))
+    {
+        TimeIndexTrailer trailer;
+        uint64_t index_end = file_size - sizeof (TimeIndexTrailer);
+        file_.seekg (index_end);
+        read_raw_data ((char*)&trailer, sizeof (TimeIndexTrailer));
+        if (file_ && std::memcmp (trailer.tag, TimeIndexTrailer::magic, sizeof (trailer.tag)) == 0 &&
+            trailer.index_offset >= data_begin && trailer.index_offset <= index_end &&
+            index_end - trailer.index_offset == trailer.entry_count * sizeof (TimeIndexEntry))
+        {
+            time_index_.resize (trailer.entry_count);
+            file_.seekg (trailer.index_offset);
+            read_raw_data ((char*)time_index_.data (), time_index_.size () * sizeof (TimeIndexEntry));
+            data_end_ = trailer.index_offset;
+        }
+    }
+
+    file_.clear ();
+    file_.seekg (position);
+}
+
+std::vector<TimeIndexEntry>
+TraceFile::read_time_ranges (const TraceMetaData& md)
+{
+    if (!time_index_.empty () || md.size () == 0)
+    {
+        return time_index_;
+    }
+
+    TimeIndexEntry entry;
+    entry.max_time = std::numeric_limits<uint64_t>::max ();
+    if (format_ == TraceFormat::BLOB)
+    {
+        entry.offset = static_cast<uint64_t> (file_.tellg ());
+        entry.event_count = md.size ();
+        return { entry };
+    }
+
+    std::vector<TimeIndexEntry> entries;
+    ChunkHeader ch;
+    entry.offset = static_cast<uint64_t> (file_.tellg ());
+    while (read_chunk_header (&ch))
+    {
+        entry.event_count = ch.event_count;
+        entries.push_back (entry);
+        file_.seekg (ch.payload_size, std::ios::cur);
+        entry.offset = static_cast<uint64_t> (file_.tellg ());
+    }
+    file_.clear ();
+    return entries;
+}
+
+void
+TraceFile::read_header (TraceMetaData* md)
+{
+    format_ = read_format ();
+    if (format_ != TraceFormat::CONTAINER)
+    {
+        read_time_index ();
+    }
+    switch (format_)
+    {
+    case TraceFormat::BLOB:
+        file_.read ((char*)md, sizeof (TraceMetaData));
+        break;
+
+    case TraceFormat::CHUNKED:
+        read_stream_meta_data (md);
+        break;
+
+    case TraceFormat::CONTAINER:
+        throw std::runtime_error ("Trace is a container of several threads and has to be read with TraceContainer.");
+    }
+}
+
+void
+TraceFile::read_meta_data (TraceMetaData* md)
+{
+    if (read_format () != TraceFormat::BLOB)
     {
         throw std::runtime_error ("Trace does not contain the correct tag at the beginning.");
     }
     file_.read ((char*)md, sizeof (TraceMetaData));
 }
 
+void
+TraceFile::read_stream_meta_data (TraceMetaData* md)
+{
+    StreamHeader sh;
+    file_.read ((char*)&sh, sizeof (StreamHeader));
+    if (!file_)
+    {
+        throw std::runtime_error ("Trace does not contain a complete stream header.");
+    }
+
+    uint64_t size = 0;
+    uint64_t access_count = 0;
+    if (!time_index_.empty ())
+    {
+        for (const TimeIndexEntry& entry : time_index_)
+        {
+            size += entry.event_count;
+            access_count += entry.access_count;
+        }
+        *md = TraceMetaData (size, sh.thread_id, access_count);
+        return;
+    }
+
+    // Walk the chunk headers once to get the total size, then rewind
+    auto first_chunk = file_.tellg ();
+    ChunkHeader ch;
+    while (read_chunk_header (&ch))
+    {
+        size += ch.event_count;
+        access_count += ch.access_count;
+        file_.seekg (ch.payload_size, std::ios::cur);
+    }
+    file_.clear ();
+    file_.seekg (first_chunk);
+
+    *md = TraceMetaData (size, sh.thread_id, access_count);
+}
+
+bool
+TraceFile::read_chunk_header (ChunkHeader* ch)
+{
+    if (data_end_ != std::numeric_limits<uint64_t>::max () && static_cast<uint64_t> (file_.tellg ()) >= data_end_)
+    {
+        return false;
+    }
+    file_.read ((char*)ch, sizeof (ChunkHeader));
+    if (file_.gcount () == 0 && file_.eof ())
+    {
+        return false;
+    }
+    if (!file_)
+    {
+        throw std::runtime_error ("Trace ends with an incomplete chunk header.");
+    }
+    if (ch->encoding == TraceEncoding::RAW && ch->payload_size != ch->event_count * sizeof (AccessEvent))
+    {
+        throw std::runtime_error ("Trace contains a chunk with an unsupported encoding.");
+    }
+    return true;
+}
+
+void
+TraceFile::read_events (AccessEvent* events, uint64_t count)
+{
+    if (format_ == TraceFormat::BLOB)
+    {
+        read_raw_data (reinterpret_cast<char*> (events), count * sizeof (AccessEvent));
+        return;
+    }
+
+    while (count > 0)
+    {
+        if (chunk_remaining_ == 0)
+        {
+            if (!read_chunk_header (&chunk_))
+            {
+                throw std::runtime_error ("Trace contains less events than expected.");
+            }
+            chunk_remaining_ = chunk_.event_count;
+            if (chunk_.encoding == TraceEncoding::RAW)
+            {
+                continue;
+            }
+
+            payload_.resize (chunk_.payload_size);
+            read_raw_data (payload_.data (), payload_.size ());
+            if (!file_)
+            {
+                throw std::runtime_error ("Trace ends with an incomplete chunk.");
+            }
+
+            // Decode straight into the destination if the chunk fits
+            if (count >= chunk_.event_count)
+            {
+                decodeEvents (chunk_.encoding, payload_.data (), payload_.size (), chunk_.event_count, events);
+                events += chunk_.event_count;
+                count -= chunk_.event_count;
+                chunk_remaining_ = 0;
+                continue;
+            }
+            staged_.resize (chunk_.event_count);
+            decodeEvents (chunk_.encoding, payload_.data (), payload_.size (), chunk_.event_count, staged_.data ());
+            continue;
+        }
+
+        uint64_t n = std::min (count, chunk_remaining_);
+        if (chunk_.encoding == TraceEncoding::RAW)
+        {
+            read_raw_data (reinterpret_cast<char*> (events), n * sizeof (AccessEvent));
+            if (!file_)
+            {
+                throw std::runtime_error ("Trace ends with an incomplete chunk.");
+            }
+        }
+        else
+        {
+            std::copy_n (staged_.begin () + (chunk_.event_count - chunk_remaining_), n, events);
+        }
+        events += n;
+        count -= n;
+        chunk_remaining_ -= n;
+    }
+}
+
 void
 TraceFile::read_raw_data (char* data, size_t nbytes)
 {
     file_.read (data, nbytes);
 }
+
+/*****************************************************************************
+ * Writer for chunked traces.
+ *****************************************************************************/
+
+class TraceStreamWriter
+{
+    public:
+    explicit TraceStreamWriter (const FilePath& file,
+                                uint64_t tid,
+                                TraceEncoding encoding = TraceEncoding::RAW,
+                                TraceIoBackend backend = TraceIoBackend::FSTREAM)
+    : file_ (file, TraceFileMode::WRITE, backend), tid_ (tid), encoding_ (encoding)
+    {
+        file_.write_stream_header (tid_);
+    }
+
+    explicit TraceStreamWriter (const FilePath& file,
+                                const std::thread::id& tid,
+                                TraceEncoding encoding = TraceEncoding::RAW,
+                                TraceIoBackend backend = TraceIoBackend::FSTREAM)
+    : TraceStreamWriter (file, convert_thread_id (tid), encoding, backend)
+    {
+    }
+
+    TraceStreamWriter (const TraceStreamWriter&) = delete;
+    TraceStreamWriter& operator= (const TraceStreamWriter&) = delete;
+
+    ~TraceStreamWriter ()
+    {
+        close ();
+    }
+
+    // Appends the content of the buffer as a new chunk and returns the number
+    // of events written. Events and access count are taken from a single
+    // snapshot, so the buffer may keep growing concurrently.
+    template <class T>
+    uint64_t
+    write (const EventBuffer<T>& event_buffer)
+    {
+        return write (event_buffer.snapshot ());
+    }
+
+    uint64_t
+    write (const EventSnapshot& snapshot)
+    {
+        if (closed_)
+        {
+            throw std::runtime_error ("The trace stream has already been closed.");
+        }
+        uint64_t count = file_.write_chunk (snapshot.segments, tid_, snapshot.access_count, encoding_).event_count;
+        if (count == 0)
+        {
+            return 0;
+        }
+        file_.flush ();
+
+        size_ += count;
+        chunk_count_++;
+        return count;
+    }
+
+    // Appends the content of the buffer as a new chunk and removes the
+    // written events from it.
+    template <class T>
+    void
+    flush (EventBuffer<T>& event_buffer)
+    {
+        EventSnapshot snapshot = event_buffer.snapshot ();
+        event_buffer.consume (write (snapshot), snapshot);
+    }
+
+    // Reserves the file range of a RAW chunk with the content of the buffer
+    // and returns its header and offset. The caller has to write header and
+    // events there through fd() before the stream is closed. Requires the
+    // POSIX backend.
+    template <class T>
+    std::tuple<ChunkHeader, uint64_t>
+    reserve (const EventBuffer<T>& event_buffer)
+    {
+        if (closed_)
+        {
+            throw std::runtime_error ("The trace stream has already been closed.");
+        }
+        ChunkHeader ch;
+        uint64_t offset = file_.reserve_chunk (event_buffer.snapshot (), tid_, &ch);
+        if (ch.event_count > 0)
+        {
+            size_ += ch.event_count;
+            chunk_count_++;
+        }
+        return { ch, offset };
+    }
+
+    // File descriptor of a stream written with the POSIX backend, -1 otherwise.
+    int
+    fd () const
+    {
+        return file_.fd ();
+    }
+
+    uint64_t
+    size () const
+    {
+        return size_;
+    }
+
+    uint64_t
+    chunk_count () const
+    {
+        return chunk_count_;
+    }
+
+    // Appends the time index. No chunks can be added afterwards; a stream
+    // that is never closed is still readable, just without index.
+    void
+    close ()
+    {
+        if (closed_)
+        {
+            return;
+        }
+        file_.write_time_index ();
+        file_.flush ();
+        closed_ = true;
+    }
+
+    private:
+    TraceFile file_;
+    uint64_t tid_ = 0;
+    TraceEncoding encoding_ = TraceEncoding::RAW;
+    uint64_t size_ = 0;
+    uint64_t chunk_count_ = 0;
+    bool closed_ = false;
+};
@@ -0,0 +1,244 @@
+#pragma once
+#include <algorithm>
+#include <memory>
+#include <optional>
+#include <stdexcept>
+#include <vector>
+
+#include <trace_events.h>
+#include <trace_file.h>
+
+/*****************************************************************************
+ * K-way timestamp merge.
+ *
+ * Merges the events of many time ordered inputs into one time ordered
+ * sequence without materializing it. A binary min-heap holds the next
+ * timestamp of every input, so each event costs O(log k) for k inputs. Events
+ * with equal timestamps are returned in the order the inputs were added.
+ *
+ * Buffers are merged in place and must outlive the merger. Trace files are
+ * streamed in blocks of block_size events, so memory stays bounded by
+ * k * block_size events regardless of the trace sizes.
+ *****************************************************************************/
+
+struct MergedEvent
+{
+    uint64_t thread_id = 0;
+    AccessEvent event;
+};
+
+class TraceMerger
+{
+    public:
+    explicit TraceMerger (uint64_t block_size = 4096) : block_size_ (block_size)
+    {
+        if (block_size_ == 0)
+        {
+            throw std::invalid_argument ("The merge block size must not be zero.");
+        }
+    }
+
+    TraceMerger (const TraceMerger&) = delete;
+    TraceMerger& operator= (const TraceMerger&) = delete;
+
+    template <class T>
+    void
+    add (const EventBuffer<T>& event_buffer, uint64_t tid)
+    {
+        Input input;
+        input.thread_id = tid;
+        for (auto [pointer, size] : event_buffer.data ())
+        {
+            if (size > 0)
+            {
+                input.segments.push_back ({ reinterpret_cast<const AccessEvent*> (pointer),
+                                            reinterpret_cast<const AccessEvent*> (pointer + size) });
+            }
+        }
+        push (std::move (input));
+    }
+
+    // Streams a single trace, either a single block or a chunked one.
+    inline void
+    add (const FilePath& file)
+    {
+        Input input;
+        input.file = std::make_unique<TraceFile> (file, TraceFileMode::READ);
+        TraceMetaData md;
+        input.file->read_header (&md);
+        input.thread_id = md.thread_id ();
+        input.remaining = md.size ();
+        push (std::move (input));
+    }
+
+    inline bool
+    empty () const
+    {
+        return heap_.empty ();
+    }
+
+    // Returns the next event in timestamp order or nothing if all inputs are
+    // exhausted.
+    inline std::optional<MergedEvent>
+    next ()
+    {
+        if (heap_.empty ())
+        {
+            return std::nullopt;
+        }
+
+        Input& input = inputs_[heap_.front ().input];
+        MergedEvent merged{ input.thread_id, *input.pos++ };
+        if (advance (input))
+        {
+            heap_.front ().time = input.pos->time;
+            sift_down ();
+        }
+        else
+        {
+            std::pop_heap (heap_.begin (), heap_.end (), later);
+            heap_.pop_back ();
+        }
+        return merged;
+    }
+
+    private:
+    struct Input
+    {
+        uint64_t thread_id = 0;
+        const AccessEvent* pos = nullptr;
+        const AccessEvent* end = nullptr;
+        std::vector<std::pair<const AccessEvent*, const AccessEvent*>> segments; // Remaining buffer segments
+        std::unique_ptr<TraceFile> file; // Streamed input
+        uint64_t remaining = 0; // Events of the file not read yet
+        std::vector<AccessEvent> block;
+    };
+
+    struct HeapEntry
+    {
+        uint64_t time;
+        uint64_t input;
+    };
+
+    static inline bool
+    later (const HeapEntry& a, const HeapEntry& b)
+    {
+        return a.time > b.time || (a.time == b.time && a.input > b.input);
+    }
+
+    inline void
+    push (Input&& input)
+    {
+        std::reverse (input.segments.begin (), input.segments.end ());
+        inputs_.push_back (std::move (input));
+        Input& added = inputs_.back ();
+        if (advance (added))
+        {
+            heap_.push_back ({ added.pos->time, inputs_.size () - 1 });
+            std::push_heap (heap_.begin (), heap_.end (), later);
+        }
+    }
+
+    // Makes pos point to the next event of the input. Returns false if the
+    // input is exhausted.
+    inline bool
+    advance (Input& input)
+    {
+        if (input.pos != input.end)
+        {
+            return true;
+        }
+
+        if (!input.segments.empty ())
+        {
+            std::tie (input.pos, input.end) = input.segments.back ();
+            input.segments.pop_back ();
+            return true;
+        }
+
+        if (input.remaining == 0)
+        {
+            input.file.reset ();
+            input.block = std::vector<AccessEvent> ();
+            return false;
+        }
+
+        uint64_t count = std::min (input.remaining, block_size_);
+        input.block.resize (count);
+        input.file->read_events (input.block.data (), count);
+        if (!input.file->file_)
+        {
+            throw std::runtime_error ("Trace ends with an incomplete chunk.");
+        }
+        input.remaining -= count;
+        input.pos = input.block.data ();
+        input.end = input.pos + count;
+        return true;
+    }
+
+    // Restores the heap after the key of the top entry grew.
+    inline void
+    sift_down ()
+    {
+        size_t size = heap_.size ();
+        size_t pos = 0;
+        HeapEntry entry = heap_[0];
+        while (true)
+        {
+            size_t child = 2 * pos + 1;
+            if (child >= size)
+            {
+                break;
+            }
+            if (child + 1 < size && later (heap_[child], heap_[child + 1]))
+            {
+                child++;
+            }
+            if (!later (entry, heap_[child]))
+            {
+                break;
+            }
+            heap_[pos] = heap_[child];
+            pos = child;
+        }
+        heap_[pos] = entry;
+    }
+
+    private:
+    uint64_t block_size_;
+    std::vector<Input> inputs_;
+    std::vector<HeapEntry> heap_;
+};
+
+// Merges the traces into one chunked trace in timestamp order. The per event
+// thread ids are not part of the trace format, so the merged trace carries
+// the given thread id. Returns the number of merged events.
+inline uint64_t
+mergeTraces (const std::vector<FilePath>& inputs,
+             const FilePath& output,
+             uint64_t tid = 0,
+             TraceEncoding encoding = TraceEncoding::DELTA,
+             uint64_t block_size = 4096)
+{
+    TraceMerger merger (block_size);
+    for (const FilePath& input : inputs)
+    {
+        merger.add (input);
+    }
+
+    TraceStreamWriter writer (output, tid, encoding);
+    EventVectorBuffer buffer;
+    buffer.reserve (block_size);
+    uint64_t count = 0;
+    while (auto merged = merger.next ())
+    {
+        buffer.append (merged->event);
+        if (buffer.size () == block_size)
+        {
+            writer.flush (buffer);
+        }
+        count++;
+    }
+    writer.flush (buffer);
+    return count;
+}
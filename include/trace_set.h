@@ -0,0 +1,365 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <deque>
+#include <exception>
+#include <map>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <tuple>
+#include <vector>
+
+#include <io_uring.h>
+#include <trace_events.h>
+#include <trace_file.h>
+
+extern "C"
+{
+#include <fcntl.h>
+#include <unistd.h>
+}
+
+/*****************************************************************************
+ * Parallel loader for a directory of per-thread traces.
+ *
+ * Files are handed out to a pool of reader threads through an atomic
+ * counter. Whenever a reader picks up a file, it asks the kernel to read
+ * ahead the file the pool will reach next, so the next open finds its data
+ * in the page cache instead of waiting for the file system.
+ *
+ * With the IO_URING backend a single thread reads the events of all single
+ * block traces straight into their buffers, keeping reads of many files in
+ * flight at once. Chunked traces need their chunk headers walked and decoded,
+ * so they are still read by the thread pool.
+ *****************************************************************************/
+
+class TraceSet
+{
+    public:
+    // Collects all regular files in the directory. A thread count of zero
+    // uses one reader per hardware thread.
+    explicit TraceSet (const FilePath& directory, unsigned int threads = 0)
+    : threads_ (threads != 0 ? threads : std::max (1u, std::thread::hardware_concurrency ()))
+    {
+        if (!boost::filesystem::is_directory (directory))
+        {
+            throw std::invalid_argument ("Trace set path is not a directory.");
+        }
+        for (const auto& entry : boost::filesystem::directory_iterator (directory))
+        {
+            if (boost::filesystem::is_regular_file (entry.status ()))
+            {
+                files_.push_back (entry.path ());
+            }
+        }
+        std::sort (files_.begin (), files_.end ());
+    }
+
+    inline const std::vector<FilePath>&
+    files () const
+    {
+        return files_;
+    }
+
+    inline unsigned int
+    threads () const
+    {
+        return threads_;
+    }
+
+    // Reads all traces and returns them by thread id. Rethrows the first
+    // error of a reader after all readers have finished. Falls back to the
+    // BLOCKING backend if io_uring is not available.
+    template <class T>
+    std::map<uint64_t, std::tuple<EventBuffer<T>, TraceMetaData>>
+    read (AsyncIoBackend backend = AsyncIoBackend::BLOCKING)
+    {
+        std::map<uint64_t, std::tuple<EventBuffer<T>, TraceMetaData>> traces;
+        if (backend == AsyncIoBackend::IO_URING)
+        {
+            std::unique_ptr<IoUring> ring;
+            try
+            {
+                ring = std::make_unique<IoUring> (ring_entries);
+            }
+            catch (const std::runtime_error&)
+            {
+            }
+            if (ring)
+            {
+                read_files (read_io_uring (*ring, &traces), &traces);
+                return traces;
+            }
+        }
+        read_files (files_, &traces);
+        return traces;
+    }
+
+    private:
+    template <class T>
+    using TraceMap = std::map<uint64_t, std::tuple<EventBuffer<T>, TraceMetaData>>;
+
+    // A trace read through the ring and its reads not yet completed.
+    struct RingFile
+    {
+        int fd = -1;
+        uint64_t pending_reads = 0;
+    };
+
+    // A slice of the events of one trace, resubmitted until complete.
+    struct RingRead
+    {
+        size_t file = 0; // Index of the RingFile
+        char* data = nullptr;
+        uint64_t size = 0;
+        uint64_t offset = 0;
+    };
+
+    static constexpr unsigned int ring_entries = 64;
+    static constexpr size_t max_open_files = 64;
+    static constexpr uint64_t max_read_size = 1ull << 30;
+
+    // Reads the files with the thread pool.
+    template <class T>
+    void
+    read_files (const std::vector<FilePath>& files, TraceMap<T>* traces)
+    {
+        std::mutex mutex;
+        std::exception_ptr error;
+        std::atomic<size_t> next{ 0 };
+
+        auto reader = [&] ()
+        {
+            for (size_t i = next++; i < files.size (); i = next++)
+            {
+                if (i + threads_ < files.size ())
+                {
+                    read_ahead (files[i + threads_]);
+                }
+
+                try
+                {
+                    TraceFile file (files[i], TraceFileMode::READ);
+                    auto trace = file.read<T> ();
+                    uint64_t tid = std::get<1> (trace).thread_id ();
+
+                    bool inserted = false;
+                    {
+                        std::lock_guard<std::mutex> lock (mutex);
+                        inserted = traces->emplace (tid, std::move (trace)).second;
+                    }
+                    if (!inserted)
+                    {
+                        throw std::runtime_error ("Trace set contains thread " + std::to_string (tid) + " twice.");
+                    }
+                }
+                catch (...)
+                {
+                    std::lock_guard<std::mutex> lock (mutex);
+                    if (!error)
+                    {
+                        error = std::current_exception ();
+                    }
+                }
+            }
+        };
+
+        // The first files are not picked up by any reader's read ahead
+        for (size_t i = 0; i < std::min<size_t> (threads_, files.size ()); i++)
+        {
+            read_ahead (files[i]);
+        }
+
+        std::vector<std::thread> pool;
+        for (unsigned int i = 1; i < std::min<size_t> (threads_, files.size ()); i++)
+        {
+            pool.emplace_back (reader);
+        }
+        reader ();
+        for (std::thread& thread : pool)
+        {
+            thread.join ();
+        }
+
+        if (error)
+        {
+            std::rethrow_exception (error);
+        }
+    }
+
+    // Reads the single block traces through the ring and returns the files
+    // left for read_files. The header is small and read synchronously; the
+    // events are read into the final buffers in slices of max_read_size. At
+    // most max_open_files traces are open at once, each until its last read
+    // has completed, so large sets stay within RLIMIT_NOFILE.
+    template <class T>
+    std::vector<FilePath>
+    read_io_uring (IoUring& ring, TraceMap<T>* traces)
+    {
+        std::vector<FilePath> remaining;
+        std::deque<RingFile> files;
+        std::deque<RingRead> reads;
+        size_t open_files = 0;
+        std::exception_ptr error;
+
+        auto close_file = [&open_files] (RingFile& file)
+        {
+            ::close (file.fd);
+            file.fd = -1;
+            open_files--;
+        };
+
+        // Advances a read by the bytes transferred and resubmits the rest.
+        // The trace is closed once none of its reads is left.
+        auto complete = [&] (const IoUring::Completion& completion)
+        {
+            RingRead& read = reads[completion.user_data];
+            if (completion.result > 0)
+            {
+                read.data += completion.result;
+                read.size -= static_cast<uint64_t> (completion.result);
+                read.offset += static_cast<uint64_t> (completion.result);
+            }
+            else if (completion.result != -EINTR && completion.result != -EAGAIN)
+            {
+                if (!error)
+                {
+                    error = std::make_exception_ptr (std::runtime_error (
+                    completion.result == 0 ? "Trace ends before all events were read." :
+                                             "Could not read trace: " + std::string (std::strerror (-completion.result)) + "."));
+                }
+                read.size = 0;
+            }
+
+            RingFile& file = files[read.file];
+            if (read.size > 0)
+            {
+                // The completion freed the entry needed for the resubmission
+                ring.prep_read (file.fd, read.data, static_cast<uint32_t> (read.size), read.offset, completion.user_data);
+                ring.submit ();
+            }
+            else if (--file.pending_reads == 0)
+            {
+                close_file (file);
+            }
+        };
+
+        try
+        {
+            for (const FilePath& path : files_)
+            {
+                while (open_files == max_open_files)
+                {
+                    complete (ring.wait ());
+                }
+
+                int fd = ::open (path.c_str (), O_RDONLY | O_CLOEXEC);
+                if (fd == -1)
+                {
+                    throw std::runtime_error ("Could not open trace " + path.string () + ".");
+                }
+                files.push_back ({ fd, 0 });
+                open_files++;
+                RingFile& file = files.back ();
+
+                char header[TraceFile::tag_.size () + sizeof (TraceMetaData)];
+                if (::pread (fd, header, sizeof (header), 0) != static_cast<ssize_t> (sizeof (header)) ||
+                    TraceFile::tag_.compare (0, TraceFile::tag_.size (), header, TraceFile::tag_.size ()) != 0)
+                {
+                    close_file (file);
+                    remaining.push_back (path);
+                    continue;
+                }
+                TraceMetaData md;
+                std::memcpy (&md, header + TraceFile::tag_.size (), sizeof (TraceMetaData));
+
+                // Buffers that are not created at full size, e.g. rings, are
+                // filled by appending
+                EventBuffer<T> buffer (md.size ());
+                if (buffer.size () != md.size ())
+                {
+                    close_file (file);
+                    remaining.push_back (path);
+                    continue;
+                }
+                auto [it, inserted] = traces->emplace (md.thread_id (), std::make_tuple (std::move (buffer), md));
+                if (!inserted)
+                {
+                    throw std::runtime_error ("Trace set contains thread " + std::to_string (md.thread_id ()) + " twice.");
+                }
+
+                size_t first_read = reads.size ();
+                uint64_t offset = sizeof (header);
+                for (auto [data, size] : std::get<0> (it->second).data ())
+                {
+                    for (uint64_t begin = 0; begin < size; begin += max_read_size)
+                    {
+                        reads.push_back ({ files.size () - 1, data + begin, std::min (max_read_size, size - begin),
+                                           offset + begin });
+                    }
+                    offset += size;
+                }
+                file.pending_reads = reads.size () - first_read;
+                if (file.pending_reads == 0)
+                {
+                    close_file (file);
+                    continue;
+                }
+                for (size_t i = first_read; i < reads.size (); i++)
+                {
+                    while (!ring.prep_read (fd, reads[i].data, static_cast<uint32_t> (reads[i].size), reads[i].offset, i))
+                    {
+                        complete (ring.wait ());
+                    }
+                }
+                ring.submit ();
+            }
+        }
+        catch (...)
+        {
+            if (!error)
+            {
+                error = std::current_exception ();
+            }
+        }
+
+        // The buffers must outlive every read the kernel may still perform
+        while (ring.in_flight () > 0)
+        {
+            complete (ring.wait ());
+        }
+        for (RingFile& file : files)
+        {
+            if (file.fd != -1)
+            {
+                close_file (file);
+            }
+        }
+        if (error)
+        {
+            std::rethrow_exception (error);
+        }
+        return remaining;
+    }
+
+    // Starts an asynchronous read of the whole file into the page cache.
+    static inline void
+    read_ahead (const FilePath& file)
+    {
+        int fd = ::open (file.c_str (), O_RDONLY | O_CLOEXEC);
+        if (fd == -1)
+        {
+            return;
+        }
+        ::posix_fadvise (fd, 0, 0, POSIX_FADV_WILLNEED);
+        ::close (fd);
+    }
+
+    private:
+    unsigned int threads_;
+    std::vector<FilePath> files_;
+};
@@ -1,24 +1,152 @@
+#include <cstddef>
 #include <memory>
+#include <mutex>
 #include <sstream>
+#include <stdexcept>
+#include <string>
+#include <tuple>
+#include <type_traits>
 
+#include <pybind11/numpy.h>
 #include <pybind11/pybind11.h>
+#include <pybind11/stl.h>
 #include <pybind11/stl_bind.h>
 
+#include <access_histogram.h>
+#include <cache_simulator.h>
+#include <dwarf_symbolizer.h>
+#include <event_column_buffer.h>
+#include <mapped_trace_file.h>
+#include <reuse_distance.h>
+#include <trace_container.h>
 #include <trace_events.h>
 #include <trace_file.h>
+#include <trace_merge.h>
+#include <trace_set.h>
 
 // TODO Named arguments
 // TODO Provide = operator for event buffer
 
 namespace py = pybind11;
+using namespace pybind11::literals;
 
+// Returns the histogram as numpy arrays of IPs, keys and counts.
 template<class Container>
-void declare_event_buffer(py::module &m, const char * pyclass_name)
+std::tuple<py::array_t<uint64_t>, py::array_t<uint32_t>, py::array_t<uint64_t>>
+access_histogram(const Container & buffer, HistogramKey key, unsigned int threads)
 {
-    py::class_<Container> (m, pyclass_name)
+    AccessHistogram histogram;
+    {
+        py::gil_scoped_release release;
+        histogram = accessHistogram(buffer, key, threads);
+    }
+    return { py::array_t<uint64_t>(histogram.ips.size(), histogram.ips.data()),
+             py::array_t<uint32_t>(histogram.keys.size(), histogram.keys.data()),
+             py::array_t<uint64_t>(histogram.counts.size(), histogram.counts.data()) };
+}
+
+// numpy structured dtype matching the memory layout of AccessEvent.
+py::dtype access_event_dtype()
+{
+    py::dict description;
+    description["names"] = py::make_tuple("timestamp", "address", "ip", "type", "level");
+    description["formats"] = py::make_tuple("<u8", "<u8", "<u8", "<u4", "<u4");
+    description["offsets"] = py::make_tuple(offsetof(AccessEvent, time), offsetof(AccessEvent, address),
+                                            offsetof(AccessEvent, ip), offsetof(AccessEvent, access_type),
+                                            offsetof(AccessEvent, memory_level));
+    description["itemsize"] = sizeof(AccessEvent);
+    return py::dtype::from_args(description);
+}
+
+// Wraps size events at data in a numpy array without copying them. The array
+// keeps owner alive; dtype and copy follow numpy's __array__ protocol.
+py::array events_array(const char * data, uint64_t size, py::handle owner, bool writeable,
+                       py::object dtype, py::object copy)
+{
+    py::array array(access_event_dtype(), { size }, { sizeof(AccessEvent) }, data, owner);
+    if (!writeable)
+    {
+        array.attr("setflags")("write"_a = false);
+    }
+    if (!dtype.is_none())
+    {
+        return array.attr("astype")(dtype);
+    }
+    if (!copy.is_none() && copy.cast<bool>())
+    {
+        return array.attr("copy")();
+    }
+    return array;
+}
+
+// Column handed in from Python, converted to a contiguous array of T if needed.
+template<class T>
+using input_column = py::array_t<T, py::array::c_style | py::array::forcecast>;
+
+// Appends one event per row of the columns. Vector buffers reserve the space
+// up front; ring buffers keep their capacity and drop the oldest events.
+template<class Container>
+void extend_from_arrays(Container & buffer, input_column<uint64_t> time, input_column<uint64_t> address,
+                        input_column<uint64_t> ip, input_column<uint32_t> type, input_column<uint32_t> level)
+{
+    size_t size = time.size();
+    if (address.size() != size || ip.size() != size || type.size() != size || level.size() != size)
+    {
+        throw std::invalid_argument("All columns must have the same length.");
+    }
+
+    const uint64_t * t = time.data();
+    const uint64_t * a = address.data();
+    const uint64_t * i = ip.data();
+    const uint32_t * at = type.data();
+    const uint32_t * l = level.data();
+    for (size_t n = 0; n < size; n++)
+    {
+        if (!isSingleBit(at[n], access_type_count) || !isSingleBit(l[n], memory_level_count))
+        {
+            throw py::value_error("Row " + std::to_string(n) + " has an invalid access type or memory level.");
+        }
+    }
+
+    py::gil_scoped_release release;
+    if constexpr (std::is_same_v<Container, EventVectorBuffer>)
+    {
+        buffer.reserve(buffer.size() + size);
+    }
+    for (size_t n = 0; n < size; n++)
+    {
+        buffer.append(AccessEvent(t[n], a[n], i[n], static_cast<AccessType>(at[n]), static_cast<MemoryLevel>(l[n])));
+    }
+}
+
+// Appends the rows of a structured array with the fields of
+// access_event_dtype(), e.g. one obtained from another buffer.
+template<class Container>
+void extend_from_structured(Container & buffer, py::array events)
+{
+    if (events.dtype().attr("names").is_none() || events.ndim() != 1)
+    {
+        throw std::invalid_argument("Expected a one-dimensional structured array.");
+    }
+    auto field = [&](const char * name) { return events[py::str(name)]; };
+    extend_from_arrays(buffer,
+                       field("timestamp").cast<input_column<uint64_t>>(),
+                       field("address").cast<input_column<uint64_t>>(),
+                       field("ip").cast<input_column<uint64_t>>(),
+                       field("type").cast<input_column<uint32_t>>(),
+                       field("level").cast<input_column<uint32_t>>());
+}
+
+template<class Container>
+py::class_<Container> declare_event_buffer(py::module &m, const char * pyclass_name)
+{
+    return py::class_<Container> (m, pyclass_name)
     .def (py::init<> ())
     .def (py::init<std::size_t> ())
     .def ("append", py::overload_cast<const AccessEvent&> (&Container::append))
+    .def ("extend_from_arrays", &extend_from_arrays<Container>,
+          py::arg ("time"), py::arg ("address"), py::arg ("ip"), py::arg ("type"), py::arg ("level"))
+    .def ("extend_from_structured", &extend_from_structured<Container>, py::arg ("events"))
     .def ("__len__", &Container::size)
     .def ("__iter__", [](Container& eb)
                       { return py::make_iterator (eb.begin (), eb.end ()); },
@@ -49,17 +177,29 @@ void declare_event_buffer(py::module &m, const char * pyclass_name)
                       });
 }
 
+// Exposes a column as numpy array that keeps the owning buffer alive.
+template<class T, class Column>
+py::array_t<T> column_array(py::object owner, const std::vector<Column> & column)
+{
+    static_assert(sizeof(T) == sizeof(Column), "Column type and array type must have the same size.");
+    return py::array_t<T>(column.size(), reinterpret_cast<const T*>(column.data()), owner);
+}
+
+// Holds the TraceFile of a Python TraceFile object. The bindings release the
+// GIL, so calls on the same object from several Python threads are
+// serialized here; the file position and decode buffers are shared state.
 class TraceFileWrapper
 {
     public:
 
-    TraceFileWrapper(const std::string & path, TraceFileMode mode)
-    :path_(path),mode_(mode)
+    TraceFileWrapper(const std::string & path, TraceFileMode mode, TraceIoBackend backend)
+    :path_(path),mode_(mode),backend_(backend)
     {}
 
     inline void open()
     {
-        trace_file_ = std::make_unique<TraceFile>(path_, mode_);
+        std::lock_guard<std::mutex> lock(mutex_);
+        trace_file_ = std::make_unique<TraceFile>(path_, mode_, backend_);
     }
 
     inline std::string path()
@@ -68,25 +208,52 @@ class TraceFileWrapper
     }
 
     template <class T>
-    inline void write(const EventBuffer<T>& event_buffer, const TraceMetaData& md)
+    inline void write(const EventBuffer<T>& event_buffer, const TraceMetaData& md, TraceEncoding encoding)
     {
-        trace_file_->write(event_buffer, md);
+        std::lock_guard<std::mutex> lock(mutex_);
+        file().write(event_buffer, md, encoding);
     }
 
     template <class T>
     inline std::tuple<EventBuffer<T>, TraceMetaData> read()
     {
-        return trace_file_->read<T>();
+        std::lock_guard<std::mutex> lock(mutex_);
+        return file().read<T>();
+    }
+
+    template <class T>
+    inline std::tuple<EventBuffer<T>, TraceMetaData> read_range(uint64_t t_begin, uint64_t t_end)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return file().read_range<T>(t_begin, t_end);
+    }
+
+    inline std::tuple<EventColumnBuffer, TraceMetaData> read_columns(uint32_t columns)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return file().read_columns(columns);
     }
 
     inline void close()
     {
+        std::lock_guard<std::mutex> lock(mutex_);
         trace_file_.reset(nullptr);
     }
 
     private:
+    TraceFile & file()
+    {
+        if (!trace_file_)
+        {
+            throw std::runtime_error("Trace file " + path_ + " is not open.");
+        }
+        return *trace_file_;
+    }
+
     std::string path_;
     TraceFileMode mode_;
+    TraceIoBackend backend_;
+    std::mutex mutex_;
     std::unique_ptr<TraceFile> trace_file_;
 };
 
@@ -100,6 +267,21 @@ PYBIND11_MODULE (tracefile, m)
     .value ("READ", TraceFileMode::READ)
     .value ("WRITE", TraceFileMode::WRITE);
 
+    py::enum_<TraceIoBackend> (m, "TraceIoBackend")
+    .value ("FSTREAM", TraceIoBackend::FSTREAM)
+    .value ("POSIX", TraceIoBackend::POSIX)
+    .value ("DIRECT", TraceIoBackend::DIRECT);
+
+    py::enum_<AsyncIoBackend> (m, "AsyncIoBackend")
+    .value ("BLOCKING", AsyncIoBackend::BLOCKING)
+    .value ("IO_URING", AsyncIoBackend::IO_URING);
+
+    py::enum_<TraceEncoding> (m, "TraceEncoding")
+    .value ("RAW", TraceEncoding::RAW)
+    .value ("PACKED", TraceEncoding::PACKED)
+    .value ("DELTA", TraceEncoding::DELTA)
+    .value ("COLUMNAR", TraceEncoding::COLUMNAR);
+
     py::enum_<AccessType> (m, "AccessType")
     .value ("LOAD", AccessType::LOAD)
     .value ("STORE", AccessType::STORE)
@@ -148,9 +330,51 @@ PYBIND11_MODULE (tracefile, m)
                          return py::str(obj);
                      });
 
-    declare_event_buffer<EventVectorBuffer>(m, "EventVectorBuffer");
+    // The array views the vector's storage, so it is invalidated when the
+    // buffer grows.
+    declare_event_buffer<EventVectorBuffer>(m, "EventVectorBuffer")
+    .def("__array__", [](py::object self, py::object dtype, py::object copy)
+                      {
+                          EventVectorBuffer & buffer = self.cast<EventVectorBuffer&>();
+                          auto [pointer, size] = buffer.data().front();
+                          return events_array(pointer, size / sizeof(AccessEvent), self, true, dtype, copy);
+                      },
+         py::arg("dtype") = py::none(), py::arg("copy") = py::none());
     declare_event_buffer<EventRingBuffer>(m, "EventRingBuffer");
 
+    py::enum_<EventColumn> (m, "EventColumn", py::arithmetic ())
+    .value ("TIME", EventColumn::TIME)
+    .value ("ADDRESS", EventColumn::ADDRESS)
+    .value ("IP", EventColumn::IP)
+    .value ("ACCESS_TYPE", EventColumn::ACCESS_TYPE)
+    .value ("MEMORY_LEVEL", EventColumn::MEMORY_LEVEL);
+
+    py::class_<EventColumnBuffer>(m, "EventColumnBuffer")
+    .def(py::init<>())
+    .def(py::init<const EventVectorBuffer&>())
+    .def(py::init<const EventRingBuffer&>())
+    .def("append", &EventColumnBuffer::append)
+    .def("columns", &EventColumnBuffer::columns)
+    .def("__len__", &EventColumnBuffer::size)
+    .def("__getitem__", [](const EventColumnBuffer & buffer, ssize_t index)
+                        {
+                            if (index < 0 || static_cast<uint64_t>(index) >= buffer.size())
+                            {
+                                throw py::index_error();
+                            }
+                            return buffer[index];
+                        })
+    .def("time", [](py::object self)
+                 { return column_array<uint64_t>(self, self.cast<const EventColumnBuffer&>().time()); })
+    .def("address", [](py::object self)
+                    { return column_array<uint64_t>(self, self.cast<const EventColumnBuffer&>().address()); })
+    .def("ip", [](py::object self)
+               { return column_array<uint64_t>(self, self.cast<const EventColumnBuffer&>().ip()); })
+    .def("access_type", [](py::object self)
+                        { return column_array<uint32_t>(self, self.cast<const EventColumnBuffer&>().access_type()); })
+    .def("memory_level", [](py::object self)
+                         { return column_array<uint32_t>(self, self.cast<const EventColumnBuffer&>().memory_level()); });
+
     py::class_<TraceMetaData>(m, "TraceMetaData")
     .def(py::init<const EventRingBuffer&, uint64_t>())
     .def(py::init<const EventVectorBuffer&, uint64_t>())
@@ -170,21 +394,219 @@ PYBIND11_MODULE (tracefile, m)
                      });
 
     py::class_<TraceFileWrapper>(m, "TraceFile")
-    .def(py::init<const std::string&, TraceFileMode>())
+    .def(py::init<const std::string&, TraceFileMode, TraceIoBackend>(),
+         py::arg("path"), py::arg("mode"), py::arg("backend") = TraceIoBackend::FSTREAM)
     .def("__enter__", [](TraceFileWrapper & tf)
                       {
-                          tf.open();
+                          {
+                              py::gil_scoped_release release;
+                              tf.open();
+                          }
                           return py::cast(&tf);
                       })
     .def("__exit__", [](TraceFileWrapper & tf, py::object exc_type,
                         py::object exc_value, py::object traceback)
                       {
+                          py::gil_scoped_release release;
                           tf.close();
                       })
     .def("path", &TraceFileWrapper::path)
-    .def("write", py::overload_cast<const EventVectorBuffer&, const TraceMetaData&>(&TraceFileWrapper::write<std::vector<AccessEvent>>))
-    .def("write", py::overload_cast<const EventRingBuffer&, const TraceMetaData&>(&         TraceFileWrapper::write<boost::circular_buffer<AccessEvent>>))
-    .def("read", py::overload_cast<>(&TraceFileWrapper::read<std::vector<AccessEvent>>))
-    .def("read", py::overload_cast<>(&TraceFileWrapper::read<boost::circular_buffer<AccessEvent>>));
+    .def("write", py::overload_cast<const EventVectorBuffer&, const TraceMetaData&, TraceEncoding>(&TraceFileWrapper::write<std::vector<AccessEvent>>),
+         py::arg("buffer"), py::arg("meta_data"), py::arg("encoding") = TraceEncoding::RAW, py::call_guard<py::gil_scoped_release>())
+    .def("write", py::overload_cast<const EventRingBuffer&, const TraceMetaData&, TraceEncoding>(&TraceFileWrapper::write<boost::circular_buffer<AccessEvent>>),
+         py::arg("buffer"), py::arg("meta_data"), py::arg("encoding") = TraceEncoding::RAW, py::call_guard<py::gil_scoped_release>())
+    .def("read", py::overload_cast<>(&TraceFileWrapper::read<std::vector<AccessEvent>>), py::call_guard<py::gil_scoped_release>())
+    .def("read", py::overload_cast<>(&TraceFileWrapper::read<boost::circular_buffer<AccessEvent>>), py::call_guard<py::gil_scoped_release>())
+    .def("read_range", &TraceFileWrapper::read_range<std::vector<AccessEvent>>,
+         py::arg("t_begin"), py::arg("t_end"), py::call_guard<py::gil_scoped_release>())
+    .def("read_columns", &TraceFileWrapper::read_columns, py::arg("columns") = all_event_columns, py::call_guard<py::gil_scoped_release>());
+
+    py::class_<MappedTraceFile>(m, "MappedTraceFile")
+    .def(py::init<const std::string&>(), py::call_guard<py::gil_scoped_release>())
+    .def("meta_data", &MappedTraceFile::meta_data)
+    .def("__len__", [](const MappedTraceFile & mtf)
+                    {
+                        return mtf.events().size();
+                    })
+    .def("__iter__", [](const MappedTraceFile & mtf)
+                     { return py::make_iterator (mtf.events().begin (), mtf.events().end ()); },
+                     py::keep_alive<0, 1> ())
+    .def("__getitem__", [](const MappedTraceFile & mtf, ssize_t index)
+                        {
+                            if (index < 0)
+                            {
+                                index += mtf.events().size();
+                            }
+                            if (index < 0 || static_cast<uint64_t>(index) >= mtf.events().size())
+                            {
+                                throw py::index_error();
+                            }
+                            return mtf.events()[index];
+                        })
+    .def("__array__", [](py::object self, py::object dtype, py::object copy)
+                      {
+                          const EventView & events = self.cast<const MappedTraceFile&>().events();
+                          return events_array(events.data(), events.size(), self, false, dtype, copy);
+                      },
+         py::arg("dtype") = py::none(), py::arg("copy") = py::none());
+
+    py::class_<TraceStreamWriter>(m, "TraceStreamWriter")
+    .def(py::init<const std::string&, uint64_t, TraceEncoding, TraceIoBackend>(),
+         py::arg("path"), py::arg("thread_id"), py::arg("encoding") = TraceEncoding::RAW,
+         py::arg("backend") = TraceIoBackend::FSTREAM, py::call_guard<py::gil_scoped_release>())
+    .def("write", &TraceStreamWriter::write<std::vector<AccessEvent>>, py::call_guard<py::gil_scoped_release>())
+    .def("write", &TraceStreamWriter::write<boost::circular_buffer<AccessEvent>>, py::call_guard<py::gil_scoped_release>())
+    .def("flush", &TraceStreamWriter::flush<std::vector<AccessEvent>>, py::call_guard<py::gil_scoped_release>())
+    .def("flush", &TraceStreamWriter::flush<boost::circular_buffer<AccessEvent>>, py::call_guard<py::gil_scoped_release>())
+    .def("size", &TraceStreamWriter::size)
+    .def("chunk_count", &TraceStreamWriter::chunk_count)
+    .def("close", &TraceStreamWriter::close, py::call_guard<py::gil_scoped_release>());
+
+    py::class_<TraceContainerWriter>(m, "TraceContainerWriter")
+    .def(py::init<const std::string&, TraceEncoding>(),
+         py::arg("path"), py::arg("encoding") = TraceEncoding::RAW)
+    .def("__enter__", [](py::object self)
+                      {
+                          return self;
+                      })
+    .def("__exit__", [](TraceContainerWriter & writer, py::object exc_type,
+                        py::object exc_value, py::object traceback)
+                     {
+                         py::gil_scoped_release release;
+                         writer.close();
+                     })
+    .def("write", py::overload_cast<const EventVectorBuffer&, const TraceMetaData&>(&TraceContainerWriter::write<std::vector<AccessEvent>>), py::call_guard<py::gil_scoped_release>())
+    .def("write", py::overload_cast<const EventRingBuffer&, const TraceMetaData&>(&TraceContainerWriter::write<boost::circular_buffer<AccessEvent>>), py::call_guard<py::gil_scoped_release>())
+    .def("write", py::overload_cast<const EventVectorBuffer&, uint64_t>(&TraceContainerWriter::write<std::vector<AccessEvent>>), py::call_guard<py::gil_scoped_release>())
+    .def("write", py::overload_cast<const EventRingBuffer&, uint64_t>(&TraceContainerWriter::write<boost::circular_buffer<AccessEvent>>), py::call_guard<py::gil_scoped_release>())
+    .def("close", &TraceContainerWriter::close, py::call_guard<py::gil_scoped_release>());
+
+    py::class_<TraceSet>(m, "TraceSet")
+    .def(py::init<const std::string&, unsigned int>(), py::arg("path"), py::arg("threads") = 0)
+    .def("files", [](const TraceSet & set)
+                  {
+                      std::vector<std::string> files;
+                      for (const FilePath & file : set.files())
+                      {
+                          files.push_back(file.string());
+                      }
+                      return files;
+                  })
+    .def("threads", &TraceSet::threads)
+    .def("read", &TraceSet::read<std::vector<AccessEvent>>, py::arg("backend") = AsyncIoBackend::BLOCKING,
+         py::call_guard<py::gil_scoped_release>());
+
+    py::class_<TraceMerger>(m, "TraceMerger")
+    .def(py::init<uint64_t>(), py::arg("block_size") = 4096)
+    .def("add", &TraceMerger::add<std::vector<AccessEvent>>, py::arg("buffer"), py::arg("thread_id"), py::keep_alive<1, 2>())
+    .def("add", &TraceMerger::add<boost::circular_buffer<AccessEvent>>, py::arg("buffer"), py::arg("thread_id"), py::keep_alive<1, 2>())
+    .def("add", [](TraceMerger & merger, const std::string & path)
+                {
+                    merger.add(FilePath(path));
+                }, py::arg("path"))
+    .def("__iter__", [](py::object self)
+                     {
+                         return self;
+                     })
+    .def("__next__", [](TraceMerger & merger)
+                     {
+                         auto merged = merger.next();
+                         if (!merged)
+                         {
+                             throw py::stop_iteration();
+                         }
+                         return std::make_tuple(merged->thread_id, merged->event);
+                     });
+
+    m.def("merge_traces", [](const std::vector<std::string> & inputs, const std::string & output,
+                             uint64_t thread_id, TraceEncoding encoding)
+                          {
+                              return mergeTraces(std::vector<FilePath>(inputs.begin(), inputs.end()), output,
+                                                 thread_id, encoding);
+                          },
+          py::arg("inputs"), py::arg("output"), py::arg("thread_id") = 0, py::arg("encoding") = TraceEncoding::DELTA,
+          py::call_guard<py::gil_scoped_release>());
+
+    py::class_<ReuseDistanceAnalyzer>(m, "ReuseDistanceAnalyzer")
+    .def(py::init<uint64_t, unsigned int>(), py::arg("line_size") = 64, py::arg("sample_shift") = 0)
+    .def("access", &ReuseDistanceAnalyzer::access)
+    .def("analyze", &ReuseDistanceAnalyzer::analyze<std::vector<AccessEvent>>, py::call_guard<py::gil_scoped_release>())
+    .def("analyze", &ReuseDistanceAnalyzer::analyze<boost::circular_buffer<AccessEvent>>, py::call_guard<py::gil_scoped_release>())
+    .def("histogram", [](const ReuseDistanceAnalyzer & analyzer)
+                      {
+                          const std::vector<uint64_t> & histogram = analyzer.histogram();
+                          return py::array_t<uint64_t>(histogram.size(), histogram.data());
+                      })
+    .def("cold_misses", &ReuseDistanceAnalyzer::cold_misses)
+    .def("accesses", &ReuseDistanceAnalyzer::accesses)
+    .def("miss_ratio", &ReuseDistanceAnalyzer::miss_ratio, py::arg("cache_lines"));
+
+    py::enum_<ReplacementPolicy> (m, "ReplacementPolicy")
+    .value ("LRU", ReplacementPolicy::LRU)
+    .value ("PLRU", ReplacementPolicy::PLRU)
+    .value ("RANDOM", ReplacementPolicy::RANDOM);
+
+    py::class_<CacheConfig>(m, "CacheConfig")
+    .def(py::init([](uint64_t size, uint32_t associativity, uint32_t line_size, ReplacementPolicy policy)
+                  {
+                      return CacheConfig{ size, associativity, line_size, policy };
+                  }),
+         py::arg("size"), py::arg("associativity"), py::arg("line_size") = 64, py::arg("policy") = ReplacementPolicy::LRU)
+    .def_readwrite("size", &CacheConfig::size)
+    .def_readwrite("associativity", &CacheConfig::associativity)
+    .def_readwrite("line_size", &CacheConfig::line_size)
+    .def_readwrite("policy", &CacheConfig::policy);
+
+    py::class_<CacheStats>(m, "CacheStats")
+    .def_readonly("hits", &CacheStats::hits)
+    .def_readonly("accesses", &CacheStats::accesses)
+    .def_readonly("matches", &CacheStats::matches)
+    .def("count", &CacheStats::count, py::arg("level"), py::arg("recorded"))
+    .def("match_ratio", &CacheStats::match_ratio);
+
+    py::class_<CacheSimulator>(m, "CacheSimulator")
+    .def(py::init<const std::vector<CacheConfig>&>(), py::arg("levels"))
+    .def("simulate", &CacheSimulator::simulate<std::vector<AccessEvent>>, py::call_guard<py::gil_scoped_release>())
+    .def("simulate", &CacheSimulator::simulate<boost::circular_buffer<AccessEvent>>, py::call_guard<py::gil_scoped_release>())
+    .def("stats", &CacheSimulator::stats);
+
+    m.def("simulate_cache_configs", &simulateCacheConfigs<std::vector<AccessEvent>>,
+          py::arg("buffer"), py::arg("hierarchies"), py::arg("threads") = 0,
+          py::call_guard<py::gil_scoped_release>());
+
+    py::enum_<HistogramKey> (m, "HistogramKey")
+    .value ("MEMORY_LEVEL", HistogramKey::MEMORY_LEVEL)
+    .value ("ACCESS_TYPE", HistogramKey::ACCESS_TYPE);
+
+    m.def("access_histogram", &access_histogram<EventVectorBuffer>,
+          py::arg("buffer"), py::arg("key") = HistogramKey::MEMORY_LEVEL, py::arg("threads") = 0);
+    m.def("access_histogram", &access_histogram<EventRingBuffer>,
+          py::arg("buffer"), py::arg("key") = HistogramKey::MEMORY_LEVEL, py::arg("threads") = 0);
+
+    py::class_<SourceLocation>(m, "SourceLocation")
+    .def_readonly("file", &SourceLocation::file)
+    .def_readonly("line", &SourceLocation::line);
+
+    py::class_<DwarfSymbolizer>(m, "DwarfSymbolizer")
+    .def(py::init<const std::string&>(), py::arg("binary"))
+    .def("files", &DwarfSymbolizer::files)
+    .def("row_count", &DwarfSymbolizer::row_count)
+    .def("lookup", py::overload_cast<uint64_t>(&DwarfSymbolizer::lookup, py::const_))
+    .def("lookup", &DwarfSymbolizer::lookup<std::vector<AccessEvent>>, py::call_guard<py::gil_scoped_release>())
+    .def("lookup", &DwarfSymbolizer::lookup<boost::circular_buffer<AccessEvent>>, py::call_guard<py::gil_scoped_release>())
+    .def("to_string", &DwarfSymbolizer::to_string);
+
+    py::class_<SourceCodeLocation>(m, "SourceCodeLocation")
+    .def(py::init<const std::string&>(), py::arg("binary"))
+    .def("access_statistics", &SourceCodeLocation::access_statistics<std::vector<AccessEvent>>,
+         py::arg("buffer"), py::arg("threads") = 0, py::call_guard<py::gil_scoped_release>())
+    .def("access_statistics", &SourceCodeLocation::access_statistics<boost::circular_buffer<AccessEvent>>,
+         py::arg("buffer"), py::arg("threads") = 0, py::call_guard<py::gil_scoped_release>());
+
+    py::class_<TraceContainer>(m, "TraceContainer")
+    .def(py::init<const std::string&>())
+    .def("thread_ids", &TraceContainer::thread_ids)
+    .def("meta_data", &TraceContainer::meta_data)
+    .def("read", &TraceContainer::read<std::vector<AccessEvent>>, py::call_guard<py::gil_scoped_release>());
 
 }
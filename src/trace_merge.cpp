@@ -0,0 +1,29 @@
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <trace_merge.h>
+
+// Merges per-thread traces into one trace in timestamp order.
+int
+main (int argc, char** argv)
+{
+    if (argc < 3)
+    {
+        std::cerr << "Usage: " << argv[0] << " OUTPUT INPUT..." << std::endl;
+        return 1;
+    }
+
+    std::vector<FilePath> inputs (argv + 2, argv + argc);
+    try
+    {
+        uint64_t count = mergeTraces (inputs, argv[1]);
+        std::cout << "Merged " << count << " events of " << inputs.size () << " traces." << std::endl;
+    }
+    catch (const std::exception& e)
+    {
+        std::cerr << e.what () << std::endl;
+        return 1;
+    }
+    return 0;
+}
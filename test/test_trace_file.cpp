@@ -2,13 +2,28 @@
                           // in one cpp file
 #include <boost/filesystem.hpp>
 #include <catch.hpp>
+#include <map>
+#include <sys/resource.h>
 #include <thread>
+#include <tuple>
 #include <vector>
 #include <trace_events.h>
 
 #define private public
 #include <trace_file.h>
 #undef private
+#include <access_histogram.h>
+#include <async_trace_writer.h>
+#include <cache_simulator.h>
+#include <dwarf_symbolizer.h>
+#include <mapped_trace_file.h>
+#include <perf_decode.h>
+#include <perf_sample_reader.h>
+#include <reuse_distance.h>
+#include <spsc_ring.h>
+#include <trace_container.h>
+#include <trace_merge.h>
+#include <trace_set.h>
 
 namespace bf = boost::filesystem;
 
@@ -115,6 +130,51 @@ TEST_CASE("EventRingBuffer")
     REQUIRE (iter->memory_level == ae2.memory_level);
 }
 
+TEST_CASE ("SegmentView")
+{
+    REQUIRE (Segments::capacity == 2);
+
+    EventVectorBuffer vector_buffer;
+    REQUIRE (vector_buffer.data ().bytes () == 0);
+    struct iovec iov[Segments::capacity];
+    REQUIRE (vector_buffer.data ().to_iovec (iov) == 0);
+    for (uint64_t i = 0; i < 3; i++)
+    {
+        vector_buffer.append (AccessEvent (i, i, i, AccessType::LOAD, MemoryLevel::MEM_LVL_L1));
+    }
+    auto contiguous = vector_buffer.data ();
+    REQUIRE (contiguous.size () == 1);
+    REQUIRE (contiguous.bytes () == 3 * sizeof (AccessEvent));
+    REQUIRE (contiguous.to_iovec (iov) == 1);
+    REQUIRE (iov[0].iov_base == std::get<0> (contiguous.front ()));
+
+    // A ring that wrapped around holds its oldest events at the end
+    EventRingBuffer ring (4);
+    for (uint64_t i = 0; i < 6; i++)
+    {
+        ring.append (AccessEvent (i, i, i, AccessType::LOAD, MemoryLevel::MEM_LVL_L1));
+    }
+    const EventRingBuffer& const_ring = ring;
+    ConstSegments wrapped = const_ring.data ();
+    REQUIRE (wrapped.size () == 2);
+    REQUIRE (wrapped.bytes () == 4 * sizeof (AccessEvent));
+    REQUIRE (reinterpret_cast<const AccessEvent*> (std::get<0> (wrapped[0]))->time == 2);
+    REQUIRE (reinterpret_cast<const AccessEvent*> (std::get<0> (wrapped[1]))->time == 4);
+    REQUIRE (wrapped.to_iovec (iov) == 2);
+    REQUIRE (iov[0].iov_len == 2 * sizeof (AccessEvent));
+    REQUIRE (iov[0].iov_len + iov[1].iov_len == wrapped.bytes ());
+
+    std::vector<uint64_t> times;
+    for (auto [pointer, size] : wrapped)
+    {
+        for (uint64_t i = 0; i < size / sizeof (AccessEvent); i++)
+        {
+            times.push_back (reinterpret_cast<const AccessEvent*> (pointer)[i].time);
+        }
+    }
+    REQUIRE (times == std::vector<uint64_t>{ 2, 3, 4, 5 });
+}
+
 TEST_CASE ("tracefile::circular_buffer")
 {
     const char* p = "./foobar";
@@ -208,4 +268,1619 @@ TEST_CASE ("trace_events::memoryLevelFromPerf")
     REQUIRE (f);
 
     REQUIRE (memoryLevelFromPerf (data_src.mem_lvl) == MemoryLevel::MEM_LVL_L1);
-}
\ No newline at end of file
+}
+
+TEST_CASE ("mapped_trace_file::read")
+{
+    const char* p = "./foomapped";
+    AccessEvent ae1 (1, 0x1, 10, AccessType::STORE, MemoryLevel::MEM_LVL_L1);
+    AccessEvent ae2 (2, 0x2, 20, AccessType::LOAD, MemoryLevel::MEM_LVL_L2);
+    EventVectorBuffer eb;
+    eb.append (ae1);
+    eb.append (ae2);
+
+    auto md1 = TraceMetaData (eb, std::this_thread::get_id ());
+    {
+        TraceFile tf (p, TraceFileMode::WRITE);
+        tf.write (eb, md1);
+    }
+
+    {
+        MappedTraceFile mtf (p);
+        const EventView& events = mtf.events ();
+
+        REQUIRE (mtf.meta_data ().size () == md1.size ());
+        REQUIRE (mtf.meta_data ().thread_id () == md1.thread_id ());
+        REQUIRE (events.size () == 2);
+        REQUIRE (events.end () - events.begin () == 2);
+
+        REQUIRE (events[0].time == ae1.time);
+        REQUIRE (events[0].address == ae1.address);
+        REQUIRE (events[0].ip == ae1.ip);
+        REQUIRE (events[0].access_type == ae1.access_type);
+        REQUIRE (events[0].memory_level == ae1.memory_level);
+
+        REQUIRE (events[1].time == ae2.time);
+        REQUIRE (events[1].address == ae2.address);
+        REQUIRE (events[1].ip == ae2.ip);
+        REQUIRE (events[1].access_type == ae2.access_type);
+        REQUIRE (events[1].memory_level == ae2.memory_level);
+
+        uint64_t sum = 0;
+        for (const AccessEvent& e : events)
+        {
+            sum += e.time;
+        }
+        REQUIRE (sum == ae1.time + ae2.time);
+
+        REQUIRE (events.subview (1, 1)[0].time == ae2.time);
+        REQUIRE_THROWS (events.subview (1, 2));
+    }
+
+    REQUIRE (bf::remove (p));
+}
+
+TEST_CASE ("mapped_trace_file::invalid")
+{
+    const char* p = "./foomapped";
+    {
+        TraceFile tf (p, TraceFileMode::WRITE);
+    }
+    REQUIRE_THROWS (MappedTraceFile (p));
+
+    {
+        EventVectorBuffer eb (4);
+        TraceFile tf (p, TraceFileMode::WRITE);
+        tf.write (eb, TraceMetaData (eb, 1));
+    }
+    // Cut the time index and the last byte of the events
+    bf::resize_file (p, bf::file_size (p) - sizeof (TimeIndexEntry) - sizeof (TimeIndexTrailer) - 1);
+    REQUIRE_THROWS (MappedTraceFile (p));
+
+    REQUIRE (bf::remove (p));
+}
+
+TEST_CASE ("tracefile::stream")
+{
+    const char* p = "./foostream";
+    EventVectorBuffer eb;
+    {
+        TraceStreamWriter writer (p, 42);
+        for (uint64_t i = 0; i < 10; i++)
+        {
+            eb.append (AccessEvent (i, 0x100 + i, 10 + i, AccessType::LOAD, MemoryLevel::MEM_LVL_L1));
+            if (eb.size () == 4)
+            {
+                writer.flush (eb);
+                REQUIRE (eb.size () == 0);
+            }
+        }
+        writer.flush (eb);
+        writer.flush (eb);
+
+        REQUIRE (writer.size () == 10);
+        REQUIRE (writer.chunk_count () == 3);
+    }
+
+    {
+        TraceFile tf (p, TraceFileMode::READ);
+        auto [result, md] = tf.read<std::vector<AccessEvent>> ();
+
+        REQUIRE (md.size () == 10);
+        REQUIRE (md.thread_id () == 42);
+        REQUIRE (md.access_count () == 10);
+        REQUIRE (result.size () == 10);
+        for (uint64_t i = 0; i < 10; i++)
+        {
+            REQUIRE (result[i].time == i);
+            REQUIRE (result[i].address == 0x100 + i);
+            REQUIRE (result[i].ip == 10 + i);
+        }
+    }
+
+    {
+        TraceFile tf (p, TraceFileMode::READ);
+        auto [result, md] = tf.read<boost::circular_buffer<AccessEvent>> ();
+
+        REQUIRE (result.size () == 10);
+        REQUIRE (result[9].time == 9);
+    }
+
+    // Cut the time index and the last byte of the chunks
+    bf::resize_file (p, bf::file_size (p) - 3 * sizeof (TimeIndexEntry) - sizeof (TimeIndexTrailer) - 1);
+    {
+        TraceFile tf (p, TraceFileMode::READ);
+        REQUIRE_THROWS (tf.read<std::vector<AccessEvent>> ());
+    }
+
+    REQUIRE (bf::remove (p));
+}
+
+TEST_CASE ("tracefile::posix_backend")
+{
+    const char* p = "./fooposix";
+    const char* q = "./fooposix_fstream";
+
+    // Ring whose readable range wraps around, i.e. two segments
+    EventRingBuffer eb (8);
+    for (uint64_t i = 0; i < 13; i++)
+    {
+        eb.append (AccessEvent (i, 0x100 + 8 * i, 10 + i, AccessType::LOAD, MemoryLevel::MEM_LVL_L1));
+    }
+    REQUIRE (eb.data ().size () == 2);
+
+    for (TraceEncoding encoding : { TraceEncoding::RAW, TraceEncoding::DELTA })
+    {
+        {
+            TraceFile tf (p, TraceFileMode::WRITE, TraceIoBackend::POSIX);
+            tf.write (eb, TraceMetaData (eb, 7), encoding);
+        }
+        {
+            TraceFile tf (q, TraceFileMode::WRITE);
+            tf.write (eb, TraceMetaData (eb, 7), encoding);
+        }
+        REQUIRE (bf::file_size (p) == bf::file_size (q));
+
+        TraceFile tf (p, TraceFileMode::READ);
+        auto [result, md] = tf.read<std::vector<AccessEvent>> ();
+        REQUIRE (md.thread_id () == 7);
+        REQUIRE (result.size () == 8);
+        REQUIRE (result[0].time == 5);
+        REQUIRE (result[7].time == 12);
+        REQUIRE (result[7].address == 0x100 + 8 * 12);
+
+        TraceFile indexed (p, TraceFileMode::READ);
+        auto [range, range_md] = indexed.read_range<std::vector<AccessEvent>> (6, 9);
+        REQUIRE (range.size () == 3);
+    }
+
+    {
+        TraceStreamWriter writer (p, 3, TraceEncoding::PACKED, TraceIoBackend::POSIX);
+        writer.write (eb);
+        writer.write (eb);
+    }
+    TraceFile tf (p, TraceFileMode::READ);
+    auto [result, md] = tf.read<std::vector<AccessEvent>> ();
+    REQUIRE (md.size () == 16);
+    REQUIRE (result[15].time == 12);
+
+    REQUIRE_THROWS_AS (TraceFile ("./no/such/dir/foo", TraceFileMode::WRITE, TraceIoBackend::POSIX),
+                       std::runtime_error);
+    REQUIRE (bf::remove (p));
+    REQUIRE (bf::remove (q));
+}
+
+TEST_CASE ("tracefile::direct_backend")
+{
+    const char* p = "./foodirect";
+    const char* q = "./foodirect_fstream";
+
+    EventHugePageBuffer eb;
+    eb.reserve (100000);
+    REQUIRE (reinterpret_cast<uintptr_t> (std::get<0> (eb.data ().front ())) % huge_page_alignment == 0);
+    EventAlignedBuffer aligned;
+    aligned.append (AccessEvent (1, 2, 3, AccessType::LOAD, MemoryLevel::MEM_LVL_L1));
+    REQUIRE (reinterpret_cast<uintptr_t> (std::get<0> (aligned.data ().front ())) % page_alignment == 0);
+
+    // More than one staging buffer, ending in a partial block
+    for (uint64_t i = 0; i < 100000; i++)
+    {
+        eb.append (AccessEvent (i, 0x100 + 8 * i, 10 + i % 7, AccessType::LOAD, MemoryLevel::MEM_LVL_L1));
+    }
+    for (TraceEncoding encoding : { TraceEncoding::RAW, TraceEncoding::DELTA })
+    {
+        {
+            TraceFile tf (p, TraceFileMode::WRITE, TraceIoBackend::DIRECT);
+            tf.write (eb, TraceMetaData (eb, 7), encoding);
+        }
+        {
+            TraceFile tf (q, TraceFileMode::WRITE);
+            tf.write (eb, TraceMetaData (eb, 7), encoding);
+        }
+        REQUIRE (bf::file_size (p) == bf::file_size (q));
+
+        TraceFile tf (p, TraceFileMode::READ);
+        auto [result, md] = tf.read<std::vector<AccessEvent>> ();
+        REQUIRE (md.thread_id () == 7);
+        REQUIRE (result.size () == eb.size ());
+        REQUIRE (result[99999].address == 0x100 + 8 * 99999);
+    }
+
+    // Every flush of a stream ends in the middle of a block, which the next
+    // flush has to complete
+    {
+        TraceStreamWriter writer (p, 7, TraceEncoding::RAW, TraceIoBackend::DIRECT);
+        EventVectorBuffer chunk;
+        for (uint64_t i = 0; i < 1000; i++)
+        {
+            chunk.append (AccessEvent (i, i, i, AccessType::STORE, MemoryLevel::MEM_LVL_L2));
+            if (i % 97 == 96)
+            {
+                writer.flush (chunk);
+                TraceFile partial (p, TraceFileMode::READ);
+                REQUIRE (std::get<0> (partial.read<std::vector<AccessEvent>> ()).size () == i + 1);
+            }
+        }
+        writer.flush (chunk);
+        REQUIRE_THROWS_AS (writer.reserve (chunk), std::runtime_error);
+    }
+    TraceFile tf (p, TraceFileMode::READ);
+    auto [result, md] = tf.read<std::vector<AccessEvent>> ();
+    REQUIRE (result.size () == 1000);
+    bool ordered = true;
+    for (uint64_t i = 0; i < 1000; i++)
+    {
+        ordered = ordered && result[i].time == i;
+    }
+    REQUIRE (ordered);
+    TraceFile indexed (p, TraceFileMode::READ);
+    REQUIRE (std::get<0> (indexed.read_range<std::vector<AccessEvent>> (500, 600)).size () == 100);
+
+    REQUIRE (bf::remove (p));
+    REQUIRE (bf::remove (q));
+}
+
+TEST_CASE ("async_trace_writer")
+{
+    const char* paths[] = { "./fooasync0", "./fooasync1" };
+    constexpr uint64_t events = 10000;
+    for (AsyncIoBackend backend : { AsyncIoBackend::BLOCKING, AsyncIoBackend::IO_URING })
+    {
+        AsyncWriterStats stats;
+        {
+            AsyncTraceWriter writer (64, 2, backend);
+            REQUIRE ((writer.backend () == backend || !IoUring::supported ()));
+            std::vector<std::thread> threads;
+            for (uint64_t t = 0; t < 2; t++)
+            {
+                AsyncTraceWriter::Producer& producer = writer.add_producer (paths[t], t);
+                threads.emplace_back ([&producer]
+                                      {
+                                          for (uint64_t i = 0; i < events; i++)
+                                          {
+                                              producer.append (AccessEvent (i, i, producer.thread_id (),
+                                                                            AccessType::LOAD,
+                                                                            MemoryLevel::MEM_LVL_L1));
+                                          }
+                                      });
+            }
+            for (auto& thread : threads)
+            {
+                thread.join ();
+            }
+            writer.close ();
+            stats = writer.stats ();
+        }
+
+        REQUIRE (stats.events_written == 2 * events);
+        REQUIRE (stats.buffers_written == 2 * ((events + 63) / 64));
+        REQUIRE (stats.pending_buffers == 0);
+        REQUIRE (stats.max_pending_buffers >= 1);
+
+        for (uint64_t t = 0; t < 2; t++)
+        {
+            TraceFile tf (paths[t], TraceFileMode::READ);
+            auto [result, md] = tf.read<std::vector<AccessEvent>> ();
+            REQUIRE (md.thread_id () == t);
+            REQUIRE (result.size () == events);
+            bool ordered = true;
+            for (uint64_t i = 0; i < events; i++)
+            {
+                ordered = ordered && result[i].time == i && result[i].ip == t;
+            }
+            REQUIRE (ordered);
+
+            TraceFile indexed (paths[t], TraceFileMode::READ);
+            auto [range, range_md] = indexed.read_range<std::vector<AccessEvent>> (100, 200);
+            REQUIRE (range.size () == 100);
+            REQUIRE (bf::remove (paths[t]));
+        }
+    }
+}
+
+TEST_CASE ("io_uring")
+{
+    if (!IoUring::supported ())
+    {
+        WARN ("io_uring is not available, only the blocking fallback is tested.");
+        return;
+    }
+
+    const char* p = "./foouring";
+    int fd = ::open (p, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    REQUIRE (fd != -1);
+
+    IoUring ring (4);
+    REQUIRE (ring.entries () == 4);
+    std::vector<uint64_t> data (1024);
+    for (uint64_t i = 0; i < data.size (); i++)
+    {
+        data[i] = i;
+    }
+    bool registered = ring.register_buffers ({ { data.data (), data.size () * sizeof (uint64_t) } });
+
+    // Two halves in reverse order, the second from the registered buffer
+    REQUIRE (ring.prep_write (fd, data.data () + 512, 4096, 4096, 1));
+    REQUIRE (ring.prep_write (fd, data.data (), 4096, 0, 2, registered ? 0 : -1));
+    ring.submit ();
+    REQUIRE (ring.in_flight () == 2);
+    uint64_t completed = 0;
+    for (int i = 0; i < 2; i++)
+    {
+        IoUring::Completion completion = ring.wait ();
+        REQUIRE (completion.result == 4096);
+        completed |= completion.user_data;
+    }
+    REQUIRE (completed == 3);
+    REQUIRE (ring.in_flight () == 0);
+
+    std::vector<uint64_t> read (1024);
+    for (int i = 0; i < 4; i++)
+    {
+        REQUIRE (ring.prep_read (fd, read.data () + 256 * i, 2048, 2048 * i, i));
+    }
+    REQUIRE (!ring.prep_read (fd, read.data (), 8, 0, 4));
+    ring.submit ();
+    while (ring.in_flight () > 0)
+    {
+        REQUIRE (ring.wait ().result == 2048);
+    }
+    REQUIRE (read == data);
+
+    ::close (fd);
+    REQUIRE (bf::remove (p));
+}
+
+TEST_CASE ("EventSpscBuffer")
+{
+    EventSpscBuffer buffer (3);
+    REQUIRE (buffer.capacity () == 4);
+
+    for (uint64_t i = 0; i < 5; i++)
+    {
+        buffer.append (AccessEvent (i, i, i, AccessType::LOAD, MemoryLevel::MEM_LVL_L1));
+    }
+    REQUIRE (buffer.size () == 4);
+    REQUIRE (buffer.dropped () == 1);
+    REQUIRE (buffer.access_count () == 5);
+
+    buffer.consume (3);
+    REQUIRE (buffer.size () == 1);
+    REQUIRE (buffer[0].time == 3);
+    REQUIRE (buffer.access_count () == 1);
+
+    buffer.append (AccessEvent (5, 5, 5, AccessType::LOAD, MemoryLevel::MEM_LVL_L1));
+    buffer.append (AccessEvent (6, 6, 6, AccessType::LOAD, MemoryLevel::MEM_LVL_L1));
+
+    // Readable range 3..6 wraps around the end of the ring
+    std::vector<uint64_t> times;
+    int segments = 0;
+    for (auto [pointer, size] : buffer.data ())
+    {
+        segments++;
+        const AccessEvent* events = reinterpret_cast<const AccessEvent*> (pointer);
+        for (uint64_t i = 0; i < size / sizeof (AccessEvent); i++)
+        {
+            times.push_back (events[i].time);
+        }
+    }
+    REQUIRE (segments == 2);
+    REQUIRE (times == std::vector<uint64_t>{ 3, 5, 6 });
+
+    buffer.clear ();
+    REQUIRE (buffer.size () == 0);
+}
+
+TEST_CASE ("EventSpscBuffer::concurrent_drain")
+{
+    const char* p = "./foospsc";
+    constexpr uint64_t events = 100000;
+    EventSpscBuffer buffer (256);
+    std::atomic<bool> done{ false };
+
+    {
+        TraceStreamWriter writer (p, 7);
+        std::thread producer ([&buffer, &done]
+                              {
+                                  for (uint64_t i = 0; i < events; i++)
+                                  {
+                                      while (buffer.size () == buffer.capacity ())
+                                      {
+                                          std::this_thread::yield ();
+                                      }
+                                      buffer.append (AccessEvent (i, i, i, AccessType::STORE,
+                                                                  MemoryLevel::MEM_LVL_L2));
+                                  }
+                                  done = true;
+                              });
+        while (!done || buffer.size () > 0)
+        {
+            writer.flush (buffer);
+        }
+        producer.join ();
+        REQUIRE (writer.size () == events);
+    }
+
+    TraceFile tf (p, TraceFileMode::READ);
+    auto [result, md] = tf.read<std::vector<AccessEvent>> ();
+    REQUIRE (result.size () == events);
+    REQUIRE (buffer.dropped () == 0);
+    REQUIRE (md.access_count () == events);
+    bool ordered = true;
+    for (uint64_t i = 0; i < events; i++)
+    {
+        ordered = ordered && result[i].time == i;
+    }
+    REQUIRE (ordered);
+    REQUIRE (bf::remove (p));
+}
+
+TEST_CASE ("EventSpscBuffer::drops_during_drain")
+{
+    const char* p = "./foospscdrops";
+    EventSpscBuffer buffer (4);
+    uint64_t appended = 0;
+    auto append = [&buffer, &appended] (uint64_t count)
+    {
+        for (uint64_t i = 0; i < count; i++, appended++)
+        {
+            buffer.append (AccessEvent (appended, appended, 1, AccessType::LOAD, MemoryLevel::MEM_LVL_L1));
+        }
+    };
+
+    {
+        TraceStreamWriter writer (p, 7);
+
+        // Drops before the snapshot belong to its chunk, drops between the
+        // snapshot and consume() to the next one
+        append (6);
+        EventSnapshot snapshot = buffer.snapshot ();
+        REQUIRE (snapshot.access_count == 6);
+        append (3);
+        REQUIRE (buffer.dropped () == 5);
+        uint64_t count = writer.write (snapshot);
+        buffer.consume (count, snapshot);
+        REQUIRE (count == 4);
+        REQUIRE (buffer.access_count () == 3);
+
+        // Drops without events stay pending until a chunk carries them
+        EventSnapshot empty = buffer.snapshot ();
+        REQUIRE (writer.write (empty) == 0);
+        buffer.consume (0, empty);
+        REQUIRE (buffer.access_count () == 3);
+        append (4);
+        writer.flush (buffer);
+        REQUIRE (buffer.access_count () == 0);
+        REQUIRE (writer.size () == 8);
+    }
+
+    {
+        TraceFile tf (p, TraceFileMode::READ);
+        auto [result, md] = tf.read<std::vector<AccessEvent>> ();
+        REQUIRE (result.size () == 8);
+        REQUIRE (md.access_count () == appended);
+    }
+
+    // A producer that never waits drops events while the consumer drains;
+    // every access must still be counted exactly once
+    constexpr uint64_t events = 200000;
+    EventSpscBuffer racing (64);
+    std::atomic<bool> done{ false };
+    {
+        TraceStreamWriter writer (p, 8);
+        std::thread producer ([&racing, &done]
+                              {
+                                  for (uint64_t i = 0; i < events; i++)
+                                  {
+                                      racing.append (AccessEvent (i, i, i, AccessType::STORE,
+                                                                  MemoryLevel::MEM_LVL_L2));
+                                  }
+                                  done = true;
+                              });
+        while (!done || racing.size () > 0)
+        {
+            writer.flush (racing);
+        }
+        producer.join ();
+        writer.flush (racing);
+    }
+    TraceFile tf (p, TraceFileMode::READ);
+    auto [result, md] = tf.read<std::vector<AccessEvent>> ();
+    REQUIRE (result.size () + racing.dropped () == events);
+    REQUIRE (md.access_count () + racing.access_count () == events);
+    REQUIRE (bf::remove (p));
+}
+
+TEST_CASE ("perf_sample_reader::synthetic")
+{
+    SyntheticPerfRing synthetic (4096);
+    PerfSampleReader reader (synthetic.ring ());
+    EventVectorBuffer buffer;
+
+    perf_mem_data_src load;
+    load.val = 0;
+    load.mem_op = PERF_MEM_OP_LOAD;
+    load.mem_lvl = PERF_MEM_LVL_HIT | PERF_MEM_LVL_L2;
+
+    perf_mem_data_src store;
+    store.val = 0;
+    store.mem_op = PERF_MEM_OP_STORE;
+    store.mem_lvl = PERF_MEM_LVL_MISS | PERF_MEM_LVL_LOC_RAM;
+
+    // 4096 / 40 byte samples: the ring wraps in the middle of a record
+    uint64_t time = 0;
+    for (int round = 0; round < 5; round++)
+    {
+        for (int i = 0; i < 70; i++, time++)
+        {
+            REQUIRE (synthetic.push_sample (0x400000 + time, time, 0x1000 + 8 * time,
+                                            time % 2 ? store.val : load.val));
+        }
+        REQUIRE (reader.read (buffer) == 70);
+    }
+
+    REQUIRE (buffer.size () == time);
+    bool decoded = true;
+    for (uint64_t i = 0; i < time; i++)
+    {
+        decoded = decoded && buffer[i].time == i && buffer[i].ip == 0x400000 + i &&
+                  buffer[i].address == 0x1000 + 8 * i &&
+                  buffer[i].access_type == (i % 2 ? AccessType::STORE : AccessType::LOAD) &&
+                  buffer[i].memory_level == (i % 2 ? MemoryLevel::MEM_LVL_LOC_RAM : MemoryLevel::MEM_LVL_L2);
+    }
+    REQUIRE (decoded);
+
+    // A full ring rejects further samples until the reader drained it
+    while (synthetic.push_sample (0, 0, 0, 0))
+    {
+    }
+    REQUIRE (reader.read (buffer) > 0);
+    REQUIRE (synthetic.push_sample (0, 0, 0, 0));
+}
+
+TEST_CASE ("perf_sample_reader::software_event")
+{
+    std::unique_ptr<PerfSampleReader> reader;
+    try
+    {
+        reader = std::make_unique<PerfSampleReader> (perfSoftwareEventAttr (100000));
+    }
+    catch (const std::runtime_error& e)
+    {
+        WARN ("Skipped, perf_event_open is not available: " << e.what ());
+        return;
+    }
+
+    EventVectorBuffer buffer;
+    reader->enable ();
+    volatile uint64_t sink = 0;
+    for (uint64_t i = 0; i < 50000000; i++)
+    {
+        sink += i;
+    }
+    reader->disable ();
+    reader->read (buffer);
+
+    REQUIRE (buffer.size () > 0);
+    for (uint64_t i = 1; i < buffer.size (); i++)
+    {
+        REQUIRE (buffer[i - 1].time <= buffer[i].time);
+    }
+}
+
+TEST_CASE ("perf_decode::tables")
+{
+    bool identical = true;
+    for (uint64_t op = 0; op < (1u << perf_mem_op_bits); op++)
+    {
+        perf_mem_data_src src;
+        src.val = 0;
+        src.mem_op = op;
+        identical = identical && accessTypeFromDataSource (src.val) == accessTypeFromPerf (op);
+    }
+    for (uint64_t lvl = 0; lvl < (1u << perf_mem_lvl_bits); lvl++)
+    {
+        perf_mem_data_src src;
+        src.val = 0;
+        src.mem_lvl = lvl;
+        identical = identical && memoryLevelFromDataSource (src.val) == memoryLevelFromPerf (lvl);
+    }
+    REQUIRE (identical);
+}
+
+TEST_CASE ("perf_decode::batch")
+{
+    constexpr size_t count = 1027;
+    std::vector<uint64_t> data_src (count);
+    uint64_t state = 0x9e3779b97f4a7c15ull;
+    for (uint64_t& value : data_src)
+    {
+        state ^= state << 13;
+        state ^= state >> 7;
+        state ^= state << 17;
+        value = state;
+    }
+
+    std::vector<AccessType> types (count);
+    std::vector<MemoryLevel> levels (count);
+    decodePerfDataSources (data_src.data (), count, types.data (), levels.data ());
+
+    bool identical = true;
+    for (size_t i = 0; i < count; i++)
+    {
+        perf_mem_data_src src;
+        src.val = data_src[i];
+        identical = identical && types[i] == accessTypeFromPerf (src.mem_op) &&
+                    levels[i] == memoryLevelFromPerf (src.mem_lvl);
+    }
+    REQUIRE (identical);
+}
+
+TEST_CASE ("tracefile::packed")
+{
+    const char* p = "./foopacked";
+    constexpr uint64_t events = 1000;
+    EventVectorBuffer eb;
+    for (uint64_t i = 0; i < events; i++)
+    {
+        eb.append (AccessEvent (i, 0x7ffd00000000 + 8 * i, 0xffffffff81000000 + i,
+                                i % 3 ? AccessType::LOAD : AccessType::STORE,
+                                i % 2 ? MemoryLevel::MEM_LVL_L3 : MemoryLevel::MEM_LVL_UNC));
+    }
+
+    {
+        TraceFile tf (p, TraceFileMode::WRITE);
+        tf.write (eb, TraceMetaData (eb, 5), TraceEncoding::PACKED);
+    }
+    REQUIRE (bf::file_size (p) < events * sizeof (AccessEvent) * 7 / 10);
+
+    {
+        TraceFile tf (p, TraceFileMode::READ);
+        auto [result, md] = tf.read<std::vector<AccessEvent>> ();
+        REQUIRE (md.thread_id () == 5);
+        REQUIRE (result.size () == events);
+        bool identical = true;
+        for (uint64_t i = 0; i < events; i++)
+        {
+            identical = identical && result[i].time == eb[i].time && result[i].address == eb[i].address &&
+                        result[i].ip == eb[i].ip && result[i].access_type == eb[i].access_type &&
+                        result[i].memory_level == eb[i].memory_level;
+        }
+        REQUIRE (identical);
+    }
+
+    {
+        // Reading in pieces goes through the decoded staging area
+        TraceFile tf (p, TraceFileMode::READ);
+        TraceMetaData md;
+        tf.read_header (&md);
+        AccessEvent e[3];
+        tf.read_events (e, 3);
+        tf.read_events (e, 3);
+        REQUIRE (e[0].time == 3);
+        REQUIRE (e[2].address == eb[5].address);
+    }
+
+    // Addresses beyond 48 bits fall back to the raw encoding
+    eb.append (AccessEvent (events, 0x0123456789abcdef, 0, AccessType::LOAD, MemoryLevel::MEM_LVL_L1));
+    {
+        TraceStreamWriter writer (p, 5, TraceEncoding::PACKED);
+        writer.write (eb);
+    }
+    {
+        TraceFile tf (p, TraceFileMode::READ);
+        auto [result, md] = tf.read<boost::circular_buffer<AccessEvent>> ();
+        REQUIRE (result.size () == events + 1);
+        REQUIRE (result[events].address == 0x0123456789abcdef);
+    }
+    REQUIRE (bf::file_size (p) > (events + 1) * sizeof (AccessEvent));
+
+    REQUIRE (bf::remove (p));
+}
+
+TEST_CASE ("tracefile::delta")
+{
+    const char* p = "./foodelta";
+    constexpr uint64_t events = 10000;
+
+    // Two interleaved strided loops, the second one with kernel addresses
+    EventRingBuffer eb (events);
+    for (uint64_t i = 0; i < events + 100; i++)
+    {
+        bool first = i % 2 == 0;
+        eb.append (AccessEvent (1000 + 3 * i, first ? 0x7ffd00000000 + 8 * i : 0xffff888000000000 - 64 * i,
+                                first ? 0x401000 : 0x401020, first ? AccessType::LOAD : AccessType::STORE,
+                                first ? MemoryLevel::MEM_LVL_L1 : MemoryLevel::MEM_LVL_LFB));
+    }
+    auto segments = eb.data ();
+    REQUIRE (std::distance (segments.begin (), segments.end ()) == 2);
+
+    {
+        TraceFile tf (p, TraceFileMode::WRITE);
+        tf.write (eb, TraceMetaData (eb, 3), TraceEncoding::DELTA);
+    }
+    REQUIRE (bf::file_size (p) * 4 < events * sizeof (AccessEvent));
+
+    {
+        TraceFile tf (p, TraceFileMode::READ);
+        auto [result, md] = tf.read<std::vector<AccessEvent>> ();
+        REQUIRE (result.size () == events);
+        bool identical = true;
+        for (uint64_t i = 0; i < events; i++)
+        {
+            identical = identical && result[i].time == eb[i].time && result[i].address == eb[i].address &&
+                        result[i].ip == eb[i].ip && result[i].access_type == eb[i].access_type &&
+                        result[i].memory_level == eb[i].memory_level;
+        }
+        REQUIRE (identical);
+    }
+
+    bf::resize_file (p, bf::file_size (p) - 2);
+    {
+        TraceFile tf (p, TraceFileMode::READ);
+        REQUIRE_THROWS (tf.read<std::vector<AccessEvent>> ());
+    }
+
+    std::vector<char> payload{ 1, 0, 2, 5, 0, 0 };
+    AccessEvent e;
+    REQUIRE_THROWS (decodeEvents (TraceEncoding::DELTA, payload.data (), payload.size (), 1, &e));
+
+    REQUIRE (bf::remove (p));
+}
+
+TEST_CASE ("trace_encoding::type_level")
+{
+    const char* p = "./footypelevel";
+    AccessEvent valid (1, 0x1000, 0x401000, AccessType::EXEC, MemoryLevel::MEM_LVL_REM_CCE2);
+    AccessEvent multi_level (2, 0x1008, 0x401000, AccessType::LOAD, static_cast<MemoryLevel> (0x28));
+    AccessEvent no_type (3, 0x1010, 0x401000, static_cast<AccessType> (0), MemoryLevel::MEM_LVL_L1);
+    AccessEvent high_type (4, 0x1018, 0x401000, static_cast<AccessType> (1u << 5), MemoryLevel::MEM_LVL_L1);
+    AccessEvent high_level (5, 0x1020, 0x401000, AccessType::LOAD, static_cast<MemoryLevel> (1u << memory_level_count));
+
+    for (TraceEncoding encoding : { TraceEncoding::PACKED, TraceEncoding::DELTA })
+    {
+        REQUIRE (canEncode (encoding, &valid, 1));
+        for (const AccessEvent& e : { multi_level, no_type, high_type, high_level })
+        {
+            REQUIRE_FALSE (canEncode (encoding, &e, 1));
+        }
+    }
+
+    // Chunks that cannot hold the type or level are written RAW instead
+    EventVectorBuffer eb;
+    for (const AccessEvent& e : { valid, multi_level, no_type, high_type, high_level })
+    {
+        eb.append (e);
+    }
+    for (TraceEncoding encoding : { TraceEncoding::PACKED, TraceEncoding::DELTA })
+    {
+        {
+            TraceFile tf (p, TraceFileMode::WRITE);
+            tf.write (eb, TraceMetaData (eb, 1), encoding);
+        }
+        TraceFile tf (p, TraceFileMode::READ);
+        auto [result, md] = tf.read<std::vector<AccessEvent>> ();
+        REQUIRE (result.size () == eb.size ());
+        for (uint64_t i = 0; i < eb.size (); i++)
+        {
+            REQUIRE (result[i].access_type == eb[i].access_type);
+            REQUIRE (result[i].memory_level == eb[i].memory_level);
+        }
+    }
+
+    // Bit positions no encoder writes are rejected as corrupt
+    std::vector<char> out;
+    encodeEvents (TraceEncoding::PACKED, &valid, 1, out);
+    AccessEvent e;
+    decodeEvents (TraceEncoding::PACKED, out.data (), out.size (), 1, &e);
+    REQUIRE (e.memory_level == MemoryLevel::MEM_LVL_REM_CCE2);
+    for (uint8_t type_level : { static_cast<uint8_t> (memory_level_count << 3), static_cast<uint8_t> (0xff),
+                                static_cast<uint8_t> (access_type_count) })
+    {
+        out[packed_event_size - 1] = static_cast<char> (type_level);
+        REQUIRE_THROWS (decodeEvents (TraceEncoding::PACKED, out.data (), out.size (), 1, &e));
+    }
+
+    out.clear ();
+    encodeEvents (TraceEncoding::DELTA, &valid, 1, out);
+    decodeEvents (TraceEncoding::DELTA, out.data (), out.size (), 1, &e);
+    REQUIRE (e.access_type == AccessType::EXEC);
+    out.back () = static_cast<char> (memory_level_count << 3);
+    REQUIRE_THROWS (decodeEvents (TraceEncoding::DELTA, out.data (), out.size (), 1, &e));
+
+    REQUIRE (bf::remove (p));
+}
+
+TEST_CASE ("tracefile::columnar")
+{
+    const char* p = "./foocolumnar";
+    constexpr uint64_t events = 100;
+    EventVectorBuffer eb;
+    for (uint64_t i = 0; i < events; i++)
+    {
+        eb.append (AccessEvent (i, 0x1000 + i, 0x400000 + i % 4, i % 2 ? AccessType::LOAD : AccessType::STORE,
+                                i % 3 ? MemoryLevel::MEM_LVL_L2 : MemoryLevel::MEM_LVL_L1));
+    }
+
+    EventColumnBuffer columns (eb);
+    REQUIRE (columns.size () == events);
+    REQUIRE (columns[7].address == eb[7].address);
+    REQUIRE (columns.memory_level ()[3] == MemoryLevel::MEM_LVL_L1);
+
+    for (TraceEncoding encoding : { TraceEncoding::COLUMNAR, TraceEncoding::RAW, TraceEncoding::DELTA })
+    {
+        {
+            TraceFile tf (p, TraceFileMode::WRITE);
+            tf.write (eb, TraceMetaData (eb, 9), encoding);
+        }
+
+        {
+            TraceFile tf (p, TraceFileMode::READ);
+            auto [result, md] = tf.read<std::vector<AccessEvent>> ();
+            REQUIRE (result.size () == events);
+            REQUIRE (result[5].ip == eb[5].ip);
+            REQUIRE (result[5].memory_level == eb[5].memory_level);
+        }
+
+        {
+            TraceFile tf (p, TraceFileMode::READ);
+            auto [result, md] = tf.read_columns (EventColumn::IP | EventColumn::MEMORY_LEVEL);
+            REQUIRE (md.thread_id () == 9);
+            REQUIRE (result.size () == events);
+            REQUIRE (result.time ().empty ());
+            REQUIRE (result.address ().empty ());
+            REQUIRE (result.access_type ().empty ());
+            bool identical = true;
+            for (uint64_t i = 0; i < events; i++)
+            {
+                identical = identical && result.ip ()[i] == eb[i].ip &&
+                            result.memory_level ()[i] == eb[i].memory_level && result[i].time == 0;
+            }
+            REQUIRE (identical);
+        }
+    }
+
+    {
+        TraceFile tf (p, TraceFileMode::WRITE);
+        tf.write (columns, TraceMetaData (eb, 9));
+    }
+    {
+        TraceFile tf (p, TraceFileMode::READ);
+        auto [result, md] = tf.read_columns ();
+        REQUIRE (result.size () == events);
+        REQUIRE (result[42].time == eb[42].time);
+        REQUIRE (result[42].access_type == eb[42].access_type);
+    }
+
+    REQUIRE (bf::remove (p));
+}
+
+TEST_CASE ("trace_container")
+{
+    const char* p = "./foocontainer";
+    uint64_t chunks_end = 0;
+    auto event = [] (uint64_t tid, uint64_t i)
+    { return AccessEvent (i, 0x1000 * tid + i, 10 + tid, AccessType::LOAD, MemoryLevel::MEM_LVL_L1); };
+
+    {
+        TraceContainerWriter writer (p, TraceEncoding::DELTA);
+        EventVectorBuffer eb;
+        for (uint64_t i = 0; i < 30; i++)
+        {
+            for (uint64_t tid = 1; tid <= 3; tid++)
+            {
+                eb.append (event (tid, i));
+            }
+            // Interleave the chunks of the threads
+            for (uint64_t tid = 1; tid <= 3 && (i % 10) == 9; tid++)
+            {
+                EventVectorBuffer thread_buffer;
+                for (const AccessEvent& e : eb)
+                {
+                    if (e.ip == 10 + tid)
+                    {
+                        thread_buffer.append (e);
+                    }
+                }
+                writer.write (thread_buffer, tid);
+            }
+            if ((i % 10) == 9)
+            {
+                eb.clear ();
+            }
+        }
+        REQUIRE (writer.index ().size () == 9);
+        chunks_end = writer.index ().back ().offset + writer.index ().back ().size;
+    }
+
+    {
+        TraceContainer container (p);
+        REQUIRE (container.index ().size () == 9);
+        REQUIRE (container.thread_ids () == std::vector<uint64_t>{ 1, 2, 3 });
+        REQUIRE (container.meta_data (2).size () == 30);
+        REQUIRE (container.meta_data (2).access_count () == 30);
+        REQUIRE_THROWS_AS (container.meta_data (4), std::invalid_argument);
+
+        auto [result, md] = container.read<std::vector<AccessEvent>> (2);
+        REQUIRE (md.thread_id () == 2);
+        REQUIRE (result.size () == 30);
+        for (uint64_t i = 0; i < 30; i++)
+        {
+            REQUIRE (result[i].time == i);
+            REQUIRE (result[i].address == event (2, i).address);
+        }
+
+        auto [ring, ring_md] = container.read<boost::circular_buffer<AccessEvent>> (3);
+        REQUIRE (ring.size () == 30);
+        REQUIRE (ring[29].address == event (3, 29).address);
+    }
+
+    {
+        TraceFile tf (p, TraceFileMode::READ);
+        REQUIRE_THROWS (tf.read<std::vector<AccessEvent>> ());
+    }
+
+    // Without the index the complete chunks are walked
+    bf::resize_file (p, chunks_end - 1);
+    {
+        TraceContainer container (p);
+        REQUIRE (container.index ().size () == 8);
+        auto [result, md] = container.read<std::vector<AccessEvent>> (1);
+        REQUIRE (result.size () == 30);
+        REQUIRE (result[29].address == event (1, 29).address);
+    }
+
+    REQUIRE (bf::remove (p));
+}
+
+TEST_CASE ("tracefile::read_range")
+{
+    const char* p = "./foorange";
+    const uint64_t n = 3 * time_index_stride + 10;
+    EventVectorBuffer eb;
+    for (uint64_t i = 0; i < n; i++)
+    {
+        eb.append (AccessEvent (i, 0x100 + i, 42, AccessType::LOAD, MemoryLevel::MEM_LVL_L1));
+    }
+    // Out of order timestamp in the first block
+    eb[7].time = 2 * time_index_stride + 5;
+
+    {
+        TraceFile tf (p, TraceFileMode::WRITE);
+        tf.write (eb, TraceMetaData (eb, 1));
+        REQUIRE (tf.time_index_.size () == 4);
+    }
+
+    {
+        TraceFile tf (p, TraceFileMode::READ);
+        auto [result, md] = tf.read_range<std::vector<AccessEvent>> (2 * time_index_stride, 2 * time_index_stride + 10);
+        REQUIRE (md.size () == 11);
+        REQUIRE (result.size () == 11);
+        REQUIRE (result[0].address == 0x100 + 7);
+        REQUIRE (result[1].time == 2 * time_index_stride);
+        REQUIRE (result[10].time == 2 * time_index_stride + 9);
+    }
+
+    {
+        TraceFile tf (p, TraceFileMode::READ);
+        auto [result, md] = tf.read<std::vector<AccessEvent>> ();
+        REQUIRE (result.size () == n);
+    }
+
+    {
+        TraceStreamWriter writer (p, 2, TraceEncoding::DELTA);
+        eb.clear ();
+        for (uint64_t i = 0; i < n; i++)
+        {
+            eb.append (AccessEvent (i, 0x100 + i, 42, AccessType::LOAD, MemoryLevel::MEM_LVL_L1));
+            if (eb.size () == 1000)
+            {
+                writer.flush (eb);
+            }
+        }
+        writer.flush (eb);
+    }
+
+    {
+        TraceFile tf (p, TraceFileMode::READ);
+        auto [result, md] = tf.read_range<boost::circular_buffer<AccessEvent>> (1500, 2500);
+        REQUIRE (tf.time_index_.size () == 13);
+        REQUIRE (md.thread_id () == 2);
+        REQUIRE (result.size () == 1000);
+        REQUIRE (result[0].time == 1500);
+        REQUIRE (result[999].time == 2499);
+    }
+
+    // Without index, e.g. after a crash, all chunks are filtered
+    bf::resize_file (p, bf::file_size (p) - 13 * sizeof (TimeIndexEntry) - sizeof (TimeIndexTrailer));
+    {
+        TraceFile tf (p, TraceFileMode::READ);
+        auto [result, md] = tf.read_range<std::vector<AccessEvent>> (1500, 2500);
+        REQUIRE (tf.time_index_.empty ());
+        REQUIRE (result.size () == 1000);
+        REQUIRE (result[999].time == 2499);
+    }
+
+    REQUIRE (bf::remove (p));
+}
+
+TEST_CASE ("trace_set")
+{
+    const bf::path dir = "./footraceset";
+    bf::create_directory (dir);
+    for (uint64_t tid = 1; tid <= 9; tid++)
+    {
+        EventVectorBuffer eb;
+        for (uint64_t i = 0; i < 100 * tid; i++)
+        {
+            eb.append (AccessEvent (i, 0x1000 * tid + i, tid, AccessType::LOAD, MemoryLevel::MEM_LVL_L1));
+        }
+        TraceFile tf (dir / ("trace." + std::to_string (tid) + ".bin"), TraceFileMode::WRITE);
+        tf.write (eb, TraceMetaData (eb, tid), tid % 2 == 0 ? TraceEncoding::DELTA : TraceEncoding::RAW);
+    }
+
+    {
+        TraceSet set (dir, 3);
+        REQUIRE (set.files ().size () == 9);
+        for (AsyncIoBackend backend : { AsyncIoBackend::BLOCKING, AsyncIoBackend::IO_URING })
+        {
+            auto traces = set.read<std::vector<AccessEvent>> (backend);
+            REQUIRE (traces.size () == 9);
+            for (auto& [tid, trace] : traces)
+            {
+                auto& [buffer, md] = trace;
+                REQUIRE (md.thread_id () == tid);
+                REQUIRE (buffer.size () == 100 * tid);
+                REQUIRE (buffer[buffer.size () - 1].address == 0x1000 * tid + 100 * tid - 1);
+            }
+        }
+
+        // Rings are not created at full size and fall back to the thread pool
+        auto traces = set.read<boost::circular_buffer<AccessEvent>> (AsyncIoBackend::IO_URING);
+        REQUIRE (traces.size () == 9);
+        REQUIRE (std::get<0> (traces.at (9)).size () == 900);
+        REQUIRE (std::get<0> (traces.at (9))[899].address == 0x1000 * 9 + 899);
+    }
+
+    {
+        std::ofstream (dir / "trace.broken.bin") << "broken";
+        TraceSet set (dir);
+        REQUIRE_THROWS_AS (set.read<std::vector<AccessEvent>> (), std::runtime_error);
+        REQUIRE_THROWS_AS (set.read<std::vector<AccessEvent>> (AsyncIoBackend::IO_URING), std::runtime_error);
+    }
+
+    {
+        // Header claims more events than the file holds
+        EventVectorBuffer eb;
+        eb.append (AccessEvent (0, 0, 0, AccessType::LOAD, MemoryLevel::MEM_LVL_L1));
+        TraceFile tf (dir / "trace.broken.bin", TraceFileMode::WRITE);
+        tf.write (eb, TraceMetaData (1000, 10, 1000));
+    }
+    {
+        TraceSet set (dir);
+        REQUIRE_THROWS_AS (set.read<std::vector<AccessEvent>> (AsyncIoBackend::IO_URING), std::runtime_error);
+    }
+
+    REQUIRE_THROWS_AS (TraceSet (dir / "trace.1.bin"), std::invalid_argument);
+    REQUIRE (bf::remove_all (dir) == 11);
+
+    // More traces than the process may keep open at once
+    bf::create_directory (dir);
+    constexpr uint64_t many = 300;
+    for (uint64_t tid = 0; tid < many; tid++)
+    {
+        EventVectorBuffer eb;
+        eb.append (AccessEvent (tid, tid, tid, AccessType::LOAD, MemoryLevel::MEM_LVL_L1));
+        TraceFile tf (dir / ("trace." + std::to_string (tid) + ".bin"), TraceFileMode::WRITE);
+        tf.write (eb, TraceMetaData (eb, tid), tid % 3 == 0 ? TraceEncoding::DELTA : TraceEncoding::RAW);
+    }
+    struct rlimit limit;
+    REQUIRE (::getrlimit (RLIMIT_NOFILE, &limit) == 0);
+    struct rlimit lowered = limit;
+    lowered.rlim_cur = 128;
+    REQUIRE (::setrlimit (RLIMIT_NOFILE, &lowered) == 0);
+    std::map<uint64_t, std::tuple<EventVectorBuffer, TraceMetaData>> many_traces;
+    std::string failure;
+    try
+    {
+        many_traces = TraceSet (dir, 4).read<std::vector<AccessEvent>> (AsyncIoBackend::IO_URING);
+    }
+    catch (const std::exception& e)
+    {
+        failure = e.what ();
+    }
+    REQUIRE (::setrlimit (RLIMIT_NOFILE, &limit) == 0);
+    REQUIRE (failure.empty ());
+    REQUIRE (many_traces.size () == many);
+    REQUIRE (std::get<0> (many_traces.at (many - 1))[0].address == many - 1);
+    REQUIRE (bf::remove_all (dir) == many + 1);
+}
+
+TEST_CASE ("trace_merge")
+{
+    // Thread tid accesses at tid, tid + 5, tid + 10, ...
+    std::vector<EventVectorBuffer> buffers (5);
+    for (uint64_t tid = 0; tid < buffers.size (); tid++)
+    {
+        for (uint64_t i = 0; i < 100; i++)
+        {
+            buffers[tid].append (AccessEvent (tid + 5 * i, 0x1000 * tid + i, tid, AccessType::LOAD, MemoryLevel::MEM_LVL_L1));
+        }
+    }
+    EventRingBuffer ring (8);
+    for (uint64_t i = 0; i < 12; i++)
+    {
+        ring.append (AccessEvent (2 * i, 0xf000 + i, 7, AccessType::STORE, MemoryLevel::MEM_LVL_L1));
+    }
+
+    {
+        TraceMerger merger (3);
+        for (uint64_t tid = 0; tid < buffers.size (); tid++)
+        {
+            merger.add (buffers[tid], tid);
+        }
+        merger.add (ring, 7);
+        merger.add (EventVectorBuffer (), 8);
+
+        uint64_t count = 0;
+        uint64_t last_time = 0;
+        uint64_t ring_events = 0;
+        while (auto merged = merger.next ())
+        {
+            REQUIRE (merged->event.time >= last_time);
+            if (merged->thread_id == 7)
+            {
+                REQUIRE (merged->event.address == 0xf004 + ring_events++);
+            }
+            else
+            {
+                REQUIRE (merged->event.ip == merged->thread_id);
+            }
+            last_time = merged->event.time;
+            count++;
+        }
+        REQUIRE (count == 508);
+        REQUIRE (merger.empty ());
+        REQUIRE_FALSE (merger.next ());
+    }
+
+    std::vector<FilePath> files;
+    for (uint64_t tid = 0; tid < buffers.size (); tid++)
+    {
+        files.push_back ("./foomerge." + std::to_string (tid));
+        TraceFile tf (files.back (), TraceFileMode::WRITE);
+        tf.write (buffers[tid], TraceMetaData (buffers[tid], tid), tid % 2 == 0 ? TraceEncoding::RAW : TraceEncoding::DELTA);
+    }
+
+    const char* p = "./foomerged";
+    REQUIRE (mergeTraces (files, p, 99, TraceEncoding::DELTA, 7) == 500);
+    {
+        TraceFile tf (p, TraceFileMode::READ);
+        auto [result, md] = tf.read<std::vector<AccessEvent>> ();
+        REQUIRE (md.thread_id () == 99);
+        REQUIRE (result.size () == 500);
+        for (uint64_t i = 0; i < result.size (); i++)
+        {
+            REQUIRE (result[i].time == i);
+            REQUIRE (result[i].ip == i % 5);
+        }
+    }
+
+    for (const FilePath& file : files)
+    {
+        REQUIRE (bf::remove (file));
+    }
+    REQUIRE (bf::remove (p));
+}
+
+TEST_CASE ("reuse_distance")
+{
+    {
+        ReuseDistanceAnalyzer analyzer (64);
+        for (uint64_t address : { 0x0, 0x40, 0x80, 0x10, 0x80, 0x48 })
+        {
+            analyzer.access (address);
+        }
+        REQUIRE (analyzer.accesses () == 6);
+        REQUIRE (analyzer.cold_misses () == 3);
+        REQUIRE (analyzer.histogram () == std::vector<uint64_t>{ 0, 1, 2 });
+        REQUIRE (analyzer.miss_ratio (2) == Approx (5.0 / 6.0));
+        REQUIRE (analyzer.miss_ratio (3) == Approx (3.0 / 6.0));
+    }
+
+    // Compare with a naive LRU stack; enough accesses to compact the tree
+    {
+        std::mt19937_64 rng (42);
+        std::geometric_distribution<uint64_t> distribution (0.002);
+        EventVectorBuffer eb;
+        for (uint64_t i = 0; i < 20000; i++)
+        {
+            eb.append (AccessEvent (i, distribution (rng) * 64, 0, AccessType::LOAD, MemoryLevel::MEM_LVL_L1));
+        }
+
+        ReuseDistanceAnalyzer analyzer (64);
+        analyzer.analyze (eb);
+
+        std::vector<uint64_t> stack;
+        std::vector<uint64_t> histogram;
+        uint64_t cold_misses = 0;
+        for (const AccessEvent& e : eb)
+        {
+            uint64_t line = e.address / 64;
+            auto it = std::find (stack.begin (), stack.end (), line);
+            if (it == stack.end ())
+            {
+                cold_misses++;
+            }
+            else
+            {
+                uint64_t distance = std::distance (stack.begin (), it);
+                histogram.resize (std::max<uint64_t> (histogram.size (), distance + 1));
+                histogram[distance]++;
+                stack.erase (it);
+            }
+            stack.insert (stack.begin (), line);
+        }
+        REQUIRE (analyzer.cold_misses () == cold_misses);
+        REQUIRE (analyzer.histogram () == histogram);
+    }
+
+    // Sampled cyclic scan over 4096 lines
+    {
+        ReuseDistanceAnalyzer analyzer (64, 3);
+        for (uint64_t round = 0; round < 8; round++)
+        {
+            for (uint64_t line = 0; line < 4096; line++)
+            {
+                analyzer.access (line * 64);
+            }
+        }
+        REQUIRE (analyzer.accesses () == 8 * 4096);
+        REQUIRE (analyzer.cold_misses () == Approx (4096).epsilon (0.1));
+        REQUIRE (analyzer.miss_ratio (3500) == Approx (1.0));
+        REQUIRE (analyzer.miss_ratio (4600) == Approx (0.125).epsilon (0.1));
+    }
+
+    REQUIRE_THROWS_AS (ReuseDistanceAnalyzer (48), std::invalid_argument);
+}
+
+TEST_CASE ("cache_simulator::policies")
+{
+    {
+        // Two sets of two ways
+        CacheLevel lru (CacheConfig{ 256, 2, 64, ReplacementPolicy::LRU });
+        REQUIRE_FALSE (lru.access (0x000));
+        REQUIRE_FALSE (lru.access (0x080));
+        REQUIRE (lru.access (0x008));
+        REQUIRE_FALSE (lru.access (0x100));
+        REQUIRE (lru.access (0x000));
+        REQUIRE_FALSE (lru.access (0x080));
+        REQUIRE_FALSE (lru.access (0x040));
+        REQUIRE (lru.access (0x000));
+    }
+
+    {
+        // One set of four ways
+        CacheLevel plru (CacheConfig{ 256, 4, 64, ReplacementPolicy::PLRU });
+        for (uint64_t line = 0; line < 4; line++)
+        {
+            REQUIRE_FALSE (plru.access (line * 64));
+        }
+        REQUIRE (plru.access (0));
+        REQUIRE_FALSE (plru.access (4 * 64));
+        REQUIRE (plru.access (0));
+        REQUIRE (plru.access (2 * 64));
+        REQUIRE (plru.access (3 * 64));
+        REQUIRE_FALSE (plru.access (1 * 64));
+    }
+
+    {
+        CacheLevel random (CacheConfig{ 256, 4, 64, ReplacementPolicy::RANDOM });
+        uint64_t hits = 0;
+        for (uint64_t i = 0; i < 1000; i++)
+        {
+            hits += random.access ((i % 5) * 64);
+        }
+        REQUIRE (hits > 0);
+        REQUIRE (hits < 1000);
+    }
+
+    REQUIRE_THROWS_AS (CacheLevel (CacheConfig{ 256, 3, 64, ReplacementPolicy::LRU }), std::invalid_argument);
+    REQUIRE_THROWS_AS (CacheLevel (CacheConfig{ 384, 2, 64, ReplacementPolicy::LRU }), std::invalid_argument);
+    REQUIRE_THROWS_AS (CacheLevel (CacheConfig{ 768, 3, 64, ReplacementPolicy::PLRU }), std::invalid_argument);
+}
+
+TEST_CASE ("cache_simulator::hierarchy")
+{
+    EventVectorBuffer eb;
+    for (uint64_t round = 0; round < 4; round++)
+    {
+        for (uint64_t line = 0; line < 16; line++)
+        {
+            MemoryLevel recorded = round == 0 ? MemoryLevel::MEM_LVL_LOC_RAM : MemoryLevel::MEM_LVL_L2;
+            eb.append (AccessEvent (round * 16 + line, line * 64, 0, AccessType::LOAD, recorded));
+        }
+    }
+
+    // 8 lines of L1 and 32 lines of L2
+    std::vector<CacheConfig> hierarchy = { CacheConfig{ 512, 2, 64, ReplacementPolicy::LRU },
+                                           CacheConfig{ 2048, 4, 64, ReplacementPolicy::PLRU } };
+    CacheSimulator simulator (hierarchy);
+    simulator.simulate (eb);
+
+    const CacheStats& stats = simulator.stats ();
+    REQUIRE (stats.accesses == 64);
+    REQUIRE (stats.hits == std::vector<uint64_t>{ 0, 48, 16 });
+    REQUIRE (stats.matches == 64);
+    REQUIRE (stats.count (1, MemoryLevel::MEM_LVL_L2) == 48);
+    REQUIRE (stats.count (2, MemoryLevel::MEM_LVL_LOC_RAM) == 16);
+    REQUIRE (stats.match_ratio () == Approx (1.0));
+
+    std::vector<std::vector<CacheConfig>> hierarchies;
+    for (uint64_t l2_size : { 512, 1024, 2048, 4096 })
+    {
+        hierarchies.push_back ({ hierarchy[0], CacheConfig{ l2_size, 4, 64, ReplacementPolicy::LRU } });
+    }
+    auto results = simulateCacheConfigs (eb, hierarchies, 3);
+    REQUIRE (results.size () == 4);
+    REQUIRE (results[0].hits == std::vector<uint64_t>{ 0, 0, 64 });
+    REQUIRE (results[2].hits == stats.hits);
+    REQUIRE (results[3].hits == stats.hits);
+
+    hierarchies.push_back ({ CacheConfig{ 100, 2, 64, ReplacementPolicy::LRU } });
+    REQUIRE_THROWS_AS (simulateCacheConfigs (eb, hierarchies), std::invalid_argument);
+}
+
+TEST_CASE ("cache_simulator::invalid_memory_level")
+{
+    // Levels from a corrupt trace: no bit, several bits and bits beyond the
+    // known ones
+    const MemoryLevel invalid[] = { MemoryLevel (0), MemoryLevel (PERF_MEM_LVL_HIT | PERF_MEM_LVL_L1),
+                                    MemoryLevel (1u << memory_level_count), MemoryLevel (1u << 31) };
+    for (MemoryLevel level : invalid)
+    {
+        REQUIRE (memoryLevelIndex (level) == memoryLevelIndex (MemoryLevel::MEM_LVL_NA));
+    }
+    REQUIRE (memoryLevelIndex (MemoryLevel::MEM_LVL_UNC) == memory_level_count - 1);
+
+    EventVectorBuffer eb;
+    for (uint64_t i = 0; i < 8; i++)
+    {
+        eb.append (AccessEvent (i, 0, 0, AccessType::LOAD, invalid[i % 4]));
+    }
+    CacheSimulator simulator ({ CacheConfig{ 512, 2, 64, ReplacementPolicy::LRU } });
+    simulator.simulate (eb);
+    simulator.access (AccessEvent (8, 0, 0, AccessType::LOAD, MemoryLevel (1u << 31)));
+
+    CacheStats stats = simulator.stats ();
+    REQUIRE (stats.accesses == 9);
+    REQUIRE (stats.count (0, MemoryLevel::MEM_LVL_NA) == 8);
+    REQUIRE (stats.count (1, MemoryLevel::MEM_LVL_NA) == 1);
+    REQUIRE (stats.count (0, MemoryLevel (1u << 31)) == 8);
+    REQUIRE (stats.matches == 0);
+}
+
+namespace
+{
+// Writes an ELF64 file with the given sections and no program headers.
+void
+writeElf (const char* path, std::vector<std::pair<std::string, std::vector<uint8_t>>> sections)
+{
+    sections.emplace_back (".shstrtab", std::vector<uint8_t> (1, 0));
+    std::vector<uint8_t>& names = sections.back ().second;
+    std::vector<Elf64_Shdr> headers (1, Elf64_Shdr{});
+    for (const auto& [name, content] : sections)
+    {
+        Elf64_Shdr header{};
+        header.sh_name = names.size ();
+        header.sh_type = SHT_PROGBITS;
+        headers.push_back (header);
+        names.insert (names.end (), name.begin (), name.end ());
+        names.push_back (0);
+    }
+    headers.back ().sh_type = SHT_STRTAB;
+
+    std::vector<uint8_t> data;
+    for (size_t i = 0; i < sections.size (); i++)
+    {
+        headers[i + 1].sh_offset = sizeof (Elf64_Ehdr) + data.size ();
+        headers[i + 1].sh_size = sections[i].second.size ();
+        data.insert (data.end (), sections[i].second.begin (), sections[i].second.end ());
+    }
+
+    Elf64_Ehdr header{};
+    std::memcpy (header.e_ident, ELFMAG, SELFMAG);
+    header.e_ident[EI_CLASS] = ELFCLASS64;
+    header.e_ident[EI_DATA] = ELFDATA2LSB;
+    header.e_ident[EI_VERSION] = EV_CURRENT;
+    header.e_type = ET_EXEC;
+    header.e_machine = EM_X86_64;
+    header.e_version = EV_CURRENT;
+    header.e_ehsize = sizeof (Elf64_Ehdr);
+    header.e_shoff = sizeof (Elf64_Ehdr) + data.size ();
+    header.e_shentsize = sizeof (Elf64_Shdr);
+    header.e_shnum = headers.size ();
+    header.e_shstrndx = headers.size () - 1;
+
+    std::ofstream file (path, std::ios::binary);
+    file.write (reinterpret_cast<const char*> (&header), sizeof (header));
+    file.write (reinterpret_cast<const char*> (data.data ()), data.size ());
+    file.write (reinterpret_cast<const char*> (headers.data ()), headers.size () * sizeof (Elf64_Shdr));
+}
+
+template <class T>
+void
+appendValue (std::vector<uint8_t>& bytes, T value)
+{
+    const uint8_t* p = reinterpret_cast<const uint8_t*> (&value);
+    bytes.insert (bytes.end (), p, p + sizeof (T));
+}
+
+void
+appendString (std::vector<uint8_t>& bytes, const std::string& string)
+{
+    bytes.insert (bytes.end (), string.begin (), string.end ());
+    bytes.push_back (0);
+}
+
+// Prefixes a line table header and program with unit length, version and
+// header length.
+std::vector<uint8_t>
+lineUnit (uint16_t version, const std::vector<uint8_t>& header, const std::vector<uint8_t>& program)
+{
+    std::vector<uint8_t> prefix;
+    appendValue<uint16_t> (prefix, version);
+    if (version >= 5)
+    {
+        appendValue<uint8_t> (prefix, 8); // address_size
+        appendValue<uint8_t> (prefix, 0); // segment_selector_size
+    }
+    appendValue<uint32_t> (prefix, header.size ());
+
+    std::vector<uint8_t> unit;
+    appendValue<uint32_t> (unit, prefix.size () + header.size () + program.size ());
+    unit.insert (unit.end (), prefix.begin (), prefix.end ());
+    unit.insert (unit.end (), header.begin (), header.end ());
+    unit.insert (unit.end (), program.begin (), program.end ());
+    return unit;
+}
+
+// min_inst_length, max_ops, default_is_stmt, line_base, line_range,
+// opcode_base and standard opcode lengths
+const std::vector<uint8_t> line_parameters = { 1, 1, 1, uint8_t (-5), 14, 13, 0, 1, 1, 1, 1, 0, 0, 0, 1, 0, 0, 1 };
+} // namespace
+
+TEST_CASE ("dwarf_symbolizer")
+{
+    const char* p = "./foo.elf";
+
+    // DWARF 4 unit over a.c and b.c
+    std::vector<uint8_t> header4 = line_parameters;
+    header4.push_back (0); // No include directories
+    for (const char* name : { "a.c", "b.c" })
+    {
+        appendString (header4, name);
+        header4.insert (header4.end (), { 0, 0, 0 });
+    }
+    header4.push_back (0);
+    std::vector<uint8_t> program4 = {
+        0, 9, 2, 0x00, 0x10, 0, 0, 0, 0, 0, 0, // set_address 0x1000
+        3, 9, 1, // advance_line 9, copy: 0x1000 a.c:10
+        2, 0x10, 3, 2, 1, // advance_pc 16, advance_line 2, copy: 0x1010 a.c:12
+        4, 2, 2, 8, 1, // set_file 2, advance_pc 8, copy: 0x1018 b.c:12
+        75, // special opcode, address + 4, line + 1: 0x101c b.c:13
+        2, 4, 0, 1, 1, // advance_pc 4, end_sequence at 0x1020
+    };
+
+    // DWARF 5 unit over c.c, whose name is in .debug_line_str
+    std::vector<uint8_t> header5 = line_parameters;
+    header5.insert (header5.end (), { 1, 1, 0x08, 1 }); // Directories: path as string
+    appendString (header5, "/src");
+    header5.insert (header5.end (), { 2, 1, 0x1f, 2, 0x0b, 1 }); // Files: path as line_strp, directory as data1
+    appendValue<uint32_t> (header5, 0);
+    header5.push_back (0);
+    std::vector<uint8_t> program5 = {
+        0, 9, 2, 0x00, 0x20, 0, 0, 0, 0, 0, 0, // set_address 0x2000
+        3, 4, 1, // advance_line 4, copy: 0x2000 c.c:5
+        2, 0x10, 0, 1, 1, // advance_pc 16, end_sequence at 0x2010
+    };
+
+    std::vector<uint8_t> debug_line = lineUnit (4, header4, program4);
+    std::vector<uint8_t> unit5 = lineUnit (5, header5, program5);
+    debug_line.insert (debug_line.end (), unit5.begin (), unit5.end ());
+    std::vector<uint8_t> line_strings;
+    appendString (line_strings, "c.c");
+    writeElf (p, { { ".debug_line", debug_line }, { ".debug_line_str", line_strings } });
+
+    DwarfSymbolizer symbolizer (p);
+    REQUIRE (symbolizer.row_count () == 7);
+    auto location = [&] (uint64_t ip)
+    {
+        auto found = symbolizer.lookup (ip);
+        return found ? symbolizer.to_string (*found) : std::string ("?");
+    };
+    REQUIRE (location (0xfff) == "?");
+    REQUIRE (location (0x1000) == "a.c:10");
+    REQUIRE (location (0x100f) == "a.c:10");
+    REQUIRE (location (0x1010) == "a.c:12");
+    REQUIRE (location (0x1018) == "b.c:12");
+    REQUIRE (location (0x101c) == "b.c:13");
+    REQUIRE (location (0x101f) == "b.c:13");
+    REQUIRE (location (0x1020) == "?");
+    REQUIRE (location (0x2008) == "c.c:5");
+    REQUIRE (location (0x2010) == "?");
+
+    EventVectorBuffer eb;
+    for (uint64_t ip : { 0x1000, 0x1000, 0x101c, 0x3000, 0x2008, 0x1004 })
+    {
+        eb.append (AccessEvent (0, 0, ip, AccessType::LOAD, MemoryLevel::MEM_LVL_L1));
+    }
+    eb[1].memory_level = MemoryLevel::MEM_LVL_L2;
+    auto locations = symbolizer.lookup (eb);
+    REQUIRE (locations.size () == 4);
+    REQUIRE (symbolizer.to_string (locations.at (0x1004)) == "a.c:10");
+    REQUIRE (symbolizer.to_string (locations.at (0x2008)) == "c.c:5");
+    REQUIRE (locations.count (0x3000) == 0);
+
+    SourceCodeLocation scl (p);
+    auto statistics = scl.access_statistics (eb);
+    REQUIRE (statistics.size () == 3);
+    REQUIRE (statistics["a.c:10"][MemoryLevel::MEM_LVL_L1] == 2);
+    REQUIRE (statistics["a.c:10"][MemoryLevel::MEM_LVL_L2] == 1);
+    REQUIRE (statistics["b.c:13"][MemoryLevel::MEM_LVL_L1] == 1);
+    REQUIRE (statistics["c.c:5"][MemoryLevel::MEM_LVL_L1] == 1);
+    // Cached IPs give the same result
+    REQUIRE (scl.access_statistics (eb) == statistics);
+
+    std::ofstream (p, std::ios::binary) << "not an ELF file at all, but long enough for a header..................";
+    REQUIRE_THROWS_AS (DwarfSymbolizer (p), std::runtime_error);
+    REQUIRE (bf::remove (p));
+}
+
+TEST_CASE ("access_histogram")
+{
+    const MemoryLevel levels[] = { MemoryLevel::MEM_LVL_L1, MemoryLevel::MEM_LVL_L2, MemoryLevel::MEM_LVL_L3 };
+    const AccessType types[] = { AccessType::LOAD, AccessType::STORE };
+
+    // Large enough to be split over several threads
+    EventVectorBuffer eb;
+    std::map<std::tuple<uint64_t, uint32_t>, uint64_t> expected_levels, expected_types;
+    for (uint64_t i = 0; i < 300000; i++)
+    {
+        uint64_t ip = 0x400000 + (i * 7919) % 5000;
+        MemoryLevel level = levels[i % 3];
+        AccessType type = types[(i / 5) % 2];
+        eb.append (AccessEvent (i, i * 64, ip, type, level));
+        expected_levels[{ ip, static_cast<uint32_t> (level) }]++;
+        expected_types[{ ip, static_cast<uint32_t> (type) }]++;
+    }
+
+    auto check = [] (const AccessHistogram& histogram, const std::map<std::tuple<uint64_t, uint32_t>, uint64_t>& expected)
+    {
+        std::vector<uint64_t> ips, counts;
+        std::vector<uint32_t> keys;
+        for (auto [ip_key, count] : expected)
+        {
+            ips.push_back (std::get<0> (ip_key));
+            keys.push_back (std::get<1> (ip_key));
+            counts.push_back (count);
+        }
+        REQUIRE (histogram.ips == ips);
+        REQUIRE (histogram.keys == keys);
+        REQUIRE (histogram.counts == counts);
+    };
+    check (accessHistogram (eb, HistogramKey::MEMORY_LEVEL, 1), expected_levels);
+    check (accessHistogram (eb, HistogramKey::MEMORY_LEVEL, 4), expected_levels);
+    check (accessHistogram (eb, HistogramKey::ACCESS_TYPE, 3), expected_types);
+
+    EventRingBuffer rb (4);
+    for (uint64_t i = 0; i < 6; i++)
+    {
+        rb.append (AccessEvent (i, 0, i % 2, AccessType::LOAD, MemoryLevel::MEM_LVL_L1));
+    }
+    AccessHistogram ring = accessHistogram (rb);
+    REQUIRE (ring.ips == std::vector<uint64_t>{ 0, 1 });
+    REQUIRE (ring.counts == std::vector<uint64_t>{ 2, 2 });
+
+    REQUIRE (accessHistogram (EventVectorBuffer ()).ips.empty ());
+}
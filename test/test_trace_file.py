@@ -1,6 +1,8 @@
 #! /usr/bin/env python3
 import os.path
 import unittest
+from concurrent.futures import ThreadPoolExecutor
+import numpy as np
 import tracefile as tf
 
 class TestAccessEvent(unittest.TestCase):
@@ -77,6 +79,48 @@ class TestEventBuffer(unittest.TestCase):
         self.assertEqual(a2.type, buffer[0].type)
         self.assertEqual(a2.level, buffer[0].level)
 
+    def test_array(self):
+        buffer = tf.EventVectorBuffer()
+        buffer.append(tf.AccessEvent(1, 1, 42, tf.AccessType.LOAD, tf.MemoryLevel.MEM_LVL_L1))
+        buffer.append(tf.AccessEvent(2, 2, 44, tf.AccessType.STORE, tf.MemoryLevel.MEM_LVL_L2))
+
+        array = np.asarray(buffer)
+        self.assertEqual(array.dtype.names, ("timestamp", "address", "ip", "type", "level"))
+        self.assertEqual(list(array["ip"]), [42, 44])
+        self.assertEqual(array["level"][1], int(tf.MemoryLevel.MEM_LVL_L2))
+
+        # The array shares the buffer's storage
+        array["ip"][0] = 43
+        self.assertEqual(buffer[0].ip, 43)
+
+    def test_extend(self):
+        buffer = tf.EventVectorBuffer()
+        n = 1000
+        buffer.extend_from_arrays(np.arange(n), np.arange(n) * 64, np.full(n, 42),
+                                  np.full(n, int(tf.AccessType.LOAD)), np.full(n, int(tf.MemoryLevel.MEM_LVL_L1)))
+        self.assertEqual(len(buffer), n)
+        self.assertEqual(buffer[10].address, 640)
+        self.assertEqual(buffer[10].type, tf.AccessType.LOAD)
+        self.assertEqual(buffer[10].level, tf.MemoryLevel.MEM_LVL_L1)
+
+        copy = tf.EventRingBuffer(10)
+        copy.extend_from_structured(np.asarray(buffer))
+        self.assertEqual(len(copy), 10)
+        self.assertEqual(copy[0].timestamp, n - 10)
+
+        with self.assertRaises(ValueError):
+            buffer.extend_from_arrays(np.arange(2), np.arange(2), np.arange(2), np.arange(2), np.arange(3))
+
+        # Types and levels have to be single known bits, nothing is appended otherwise
+        load = int(tf.AccessType.LOAD)
+        l1 = int(tf.MemoryLevel.MEM_LVL_L1)
+        for types, levels in (([load, 0], [l1, l1]), ([load, 1 << 5], [l1, l1]),
+                              ([load, load], [l1, l1 | int(tf.MemoryLevel.MEM_LVL_HIT)]),
+                              ([load, load], [l1, 1 << 14])):
+            with self.assertRaises(ValueError):
+                buffer.extend_from_arrays(np.arange(2), np.arange(2), np.arange(2), np.array(types), np.array(levels))
+        self.assertEqual(len(buffer), n)
+
 class TestTraceMetaData(unittest.TestCase):
     def test_creation(self):
         buffer = tf.EventVectorBuffer()
@@ -121,6 +165,239 @@ class TestTraceFile(unittest.TestCase):
             self.assertEqual(expect.ip, current.ip)
             self.assertEqual(expect.type, current.type)
             self.assertEqual(expect.level, current.level)
+    def test_write_read_packed(self):
+        path = "./foo.txt"
+        write_buffer = tf.EventVectorBuffer()
+        for i in range(100):
+            write_buffer.append(tf.AccessEvent(i, 0x7ffd0000 + i, 42, tf.AccessType.LOAD, tf.MemoryLevel.MEM_LVL_L1))
+        md = tf.TraceMetaData(write_buffer, 100)
+        with tf.TraceFile(path, tf.TraceFileMode.WRITE) as file:
+            file.write(write_buffer, md, tf.TraceEncoding.PACKED)
+
+        self.assertLess(os.stat(path).st_size, 100 * 32)
+
+        with tf.TraceFile(path, tf.TraceFileMode.READ) as file:
+            read_buffer, read_md = file.read()
+
+        self.assertEqual(md.size(), read_md.size())
+        for expect, current in zip(write_buffer, read_buffer):
+            self.assertEqual(expect.timestamp, current.timestamp)
+            self.assertEqual(expect.address, current.address)
+            self.assertEqual(expect.ip, current.ip)
+            self.assertEqual(expect.type, current.type)
+            self.assertEqual(expect.level, current.level)
+
+    def test_read_columns(self):
+        path = "./foo.txt"
+        write_buffer = tf.EventVectorBuffer()
+        for i in range(10):
+            write_buffer.append(tf.AccessEvent(i, 0x1000 + i, 42 + i % 2, tf.AccessType.LOAD, tf.MemoryLevel.MEM_LVL_L2))
+        md = tf.TraceMetaData(write_buffer, 100)
+        with tf.TraceFile(path, tf.TraceFileMode.WRITE) as file:
+            file.write(write_buffer, md, tf.TraceEncoding.COLUMNAR)
+
+        with tf.TraceFile(path, tf.TraceFileMode.READ) as file:
+            columns, read_md = file.read_columns(tf.EventColumn.IP | tf.EventColumn.MEMORY_LEVEL)
+
+        self.assertEqual(len(columns), 10)
+        self.assertEqual(len(columns.time()), 0)
+        self.assertEqual(list(columns.ip()), [42 + i % 2 for i in range(10)])
+        self.assertEqual(columns[3].level, tf.MemoryLevel.MEM_LVL_L2)
+
+    def test_read_range(self):
+        path = "./foo.txt"
+        write_buffer = tf.EventVectorBuffer()
+        for i in range(10000):
+            write_buffer.append(tf.AccessEvent(i, 0x1000 + i, 42, tf.AccessType.LOAD, tf.MemoryLevel.MEM_LVL_L1))
+        md = tf.TraceMetaData(write_buffer, 100)
+        with tf.TraceFile(path, tf.TraceFileMode.WRITE) as file:
+            file.write(write_buffer, md)
+
+        with tf.TraceFile(path, tf.TraceFileMode.READ) as file:
+            buffer, read_md = file.read_range(5000, 5100)
+
+        self.assertEqual(read_md.size(), 100)
+        self.assertEqual([e.timestamp for e in buffer], list(range(5000, 5100)))
+
+    def test_parallel_read(self):
+        path = "./foo.txt"
+        n = 10000
+        write_buffer = tf.EventVectorBuffer()
+        write_buffer.extend_from_arrays(np.arange(n), np.arange(n) * 64, np.full(n, 42),
+                                        np.full(n, int(tf.AccessType.LOAD)), np.full(n, int(tf.MemoryLevel.MEM_LVL_L1)))
+        with tf.TraceFile(path, tf.TraceFileMode.WRITE) as file:
+            file.write(write_buffer, tf.TraceMetaData(write_buffer, 100), tf.TraceEncoding.DELTA)
+
+        # Calls on one TraceFile from several threads run one after another
+        def read(i):
+            if i % 2:
+                buffer, md = file.read_range(1000, 2000)
+                return np.asarray(buffer)["timestamp"].tolist() == list(range(1000, 2000))
+            buffer, md = file.read()
+            return md.size() == n and np.array_equal(np.asarray(buffer)["address"], np.arange(n) * 64)
+
+        with tf.TraceFile(path, tf.TraceFileMode.READ) as file:
+            with ThreadPoolExecutor(max_workers=8) as pool:
+                results = list(pool.map(read, range(32)))
+        self.assertTrue(all(results))
+
+class TestTraceContainer(unittest.TestCase):
+    def test_write_read(self):
+        path = "./foo.container"
+        with tf.TraceContainerWriter(path, tf.TraceEncoding.DELTA) as writer:
+            for tid in [3, 1, 2]:
+                buffer = tf.EventVectorBuffer()
+                for i in range(10):
+                    buffer.append(tf.AccessEvent(i, 0x1000 * tid + i, tid, tf.AccessType.STORE, tf.MemoryLevel.MEM_LVL_L3))
+                writer.write(buffer, tid)
+
+        container = tf.TraceContainer(path)
+        self.assertEqual(container.thread_ids(), [1, 2, 3])
+        self.assertEqual(container.meta_data(2).size(), 10)
+        buffer, md = container.read(2)
+        self.assertEqual(md.thread_id(), 2)
+        self.assertEqual([e.address for e in buffer], [0x2000 + i for i in range(10)])
+        os.remove(path)
+
+class TestTraceSet(unittest.TestCase):
+    def test_read(self):
+        path = "./foo.traceset"
+        os.mkdir(path)
+        for tid in range(1, 5):
+            buffer = tf.EventVectorBuffer()
+            for i in range(tid * 10):
+                buffer.append(tf.AccessEvent(i, 0x1000 * tid + i, tid, tf.AccessType.LOAD, tf.MemoryLevel.MEM_LVL_L1))
+            with tf.TraceFile(os.path.join(path, "trace.{}.bin".format(tid)), tf.TraceFileMode.WRITE) as file:
+                file.write(buffer, tf.TraceMetaData(buffer, tid))
+
+        traces = tf.TraceSet(path, 2).read()
+        self.assertEqual(sorted(traces.keys()), [1, 2, 3, 4])
+        buffer, md = traces[3]
+        self.assertEqual(md.thread_id(), 3)
+        self.assertEqual(len(buffer), 30)
+
+        traces = tf.TraceSet(path).read(tf.AsyncIoBackend.IO_URING)
+        self.assertEqual(sorted(traces.keys()), [1, 2, 3, 4])
+        self.assertEqual([e.address for e in traces[4][0]], [0x4000 + i for i in range(40)])
+
+        for file in os.listdir(path):
+            os.remove(os.path.join(path, file))
+        os.rmdir(path)
+
+class TestTraceMerger(unittest.TestCase):
+    def test_merge(self):
+        merger = tf.TraceMerger()
+        for tid in range(3):
+            buffer = tf.EventVectorBuffer()
+            for i in range(10):
+                buffer.append(tf.AccessEvent(tid + 3 * i, i, tid, tf.AccessType.LOAD, tf.MemoryLevel.MEM_LVL_L1))
+            merger.add(buffer, tid)
+
+        merged = list(merger)
+        self.assertEqual(len(merged), 30)
+        self.assertEqual([e.timestamp for _, e in merged], list(range(30)))
+        self.assertEqual([tid for tid, _ in merged[:4]], [0, 1, 2, 0])
+
+class TestReuseDistanceAnalyzer(unittest.TestCase):
+    def test_analyze(self):
+        buffer = tf.EventVectorBuffer()
+        for i, address in enumerate([0x0, 0x40, 0x80, 0x10, 0x80, 0x48]):
+            buffer.append(tf.AccessEvent(i, address, 0, tf.AccessType.LOAD, tf.MemoryLevel.MEM_LVL_L1))
+
+        analyzer = tf.ReuseDistanceAnalyzer(64)
+        analyzer.analyze(buffer)
+        self.assertEqual(analyzer.accesses(), 6)
+        self.assertEqual(analyzer.cold_misses(), 3)
+        self.assertEqual(list(analyzer.histogram()), [0, 1, 2])
+        self.assertAlmostEqual(analyzer.miss_ratio(3), 0.5)
+
+class TestCacheSimulator(unittest.TestCase):
+    def test_simulate(self):
+        buffer = tf.EventVectorBuffer()
+        for i in range(64):
+            level = tf.MemoryLevel.MEM_LVL_LOC_RAM if i < 16 else tf.MemoryLevel.MEM_LVL_L2
+            buffer.append(tf.AccessEvent(i, (i % 16) * 64, 0, tf.AccessType.LOAD, level))
+
+        l1 = tf.CacheConfig(512, 2)
+        l2 = tf.CacheConfig(2048, 4, 64, tf.ReplacementPolicy.PLRU)
+        simulator = tf.CacheSimulator([l1, l2])
+        simulator.simulate(buffer)
+        stats = simulator.stats()
+        self.assertEqual(stats.hits, [0, 48, 16])
+        self.assertEqual(stats.count(2, tf.MemoryLevel.MEM_LVL_LOC_RAM), 16)
+        self.assertAlmostEqual(stats.match_ratio(), 1.0)
+
+        results = tf.simulate_cache_configs(buffer, [[l1], [l1, l2]], 2)
+        self.assertEqual(results[0].hits, [0, 64])
+        self.assertEqual(results[1].hits, [0, 48, 16])
+
+class TestAccessHistogram(unittest.TestCase):
+    def test_histogram(self):
+        buffer = tf.EventVectorBuffer()
+        for i in range(10):
+            level = tf.MemoryLevel.MEM_LVL_L1 if i % 2 else tf.MemoryLevel.MEM_LVL_L2
+            buffer.append(tf.AccessEvent(i, 0, i % 3, tf.AccessType.LOAD, level))
+
+        ips, levels, counts = tf.access_histogram(buffer)
+        self.assertEqual(list(ips), [0, 0, 1, 1, 2, 2])
+        self.assertEqual(list(levels), [int(tf.MemoryLevel.MEM_LVL_L1), int(tf.MemoryLevel.MEM_LVL_L2)] * 3)
+        self.assertEqual(list(counts), [2, 2, 2, 1, 1, 2])
+
+        ips, types, counts = tf.access_histogram(buffer, tf.HistogramKey.ACCESS_TYPE, 2)
+        self.assertEqual(list(ips), [0, 1, 2])
+        self.assertEqual(list(counts), [4, 3, 3])
+
+class TestTraceStreamWriter(unittest.TestCase):
+    def test_write_read(self):
+        path = "./foo.txt"
+        buffer = tf.EventVectorBuffer()
+        writer = tf.TraceStreamWriter(path, 100)
+        for i in range(5):
+            buffer.append(tf.AccessEvent(i, i, 42, tf.AccessType.LOAD, tf.MemoryLevel.MEM_LVL_L1))
+            if len(buffer) == 2:
+                writer.flush(buffer)
+                self.assertEqual(len(buffer), 0)
+        writer.flush(buffer)
+        self.assertEqual(writer.size(), 5)
+        self.assertEqual(writer.chunk_count(), 3)
+        del writer
+
+        with tf.TraceFile(path, tf.TraceFileMode.READ) as file:
+            read_buffer, read_md = file.read()
+
+        self.assertEqual(read_md.size(), 5)
+        self.assertEqual(read_md.thread_id(), 100)
+        self.assertEqual([e.timestamp for e in read_buffer], list(range(5)))
+
+class TestMappedTraceFile(unittest.TestCase):
+    def test_read(self):
+        path = "./foo.txt"
+        a1 = tf.AccessEvent(1, 1, 42, tf.AccessType.LOAD, tf.MemoryLevel.MEM_LVL_L1)
+        a2 = tf.AccessEvent(2, 2, 44, tf.AccessType.STORE, tf.MemoryLevel.MEM_LVL_L2)
+        write_buffer = tf.EventVectorBuffer()
+        write_buffer.append(a1)
+        write_buffer.append(a2)
+        md = tf.TraceMetaData(write_buffer, 100)
+        with tf.TraceFile(path, tf.TraceFileMode.WRITE) as file:
+            file.write(write_buffer, md)
+
+        mapped = tf.MappedTraceFile(path)
+        self.assertEqual(md.size(), mapped.meta_data().size())
+        self.assertEqual(md.thread_id(), mapped.meta_data().thread_id())
+        self.assertEqual(len(write_buffer), len(mapped))
+        self.assertEqual(a2.ip, mapped[-1].ip)
+
+        for expect, current in zip(write_buffer, mapped):
+            self.assertEqual(expect.timestamp, current.timestamp)
+            self.assertEqual(expect.address, current.address)
+            self.assertEqual(expect.ip, current.ip)
+            self.assertEqual(expect.type, current.type)
+            self.assertEqual(expect.level, current.level)
+
+        array = np.asarray(mapped)
+        self.assertFalse(array.flags.writeable)
+        self.assertEqual(list(array["timestamp"]), [1, 2])
+        self.assertEqual(array["type"][1], int(tf.AccessType.STORE))
 
 
 if __name__ == '__main__':